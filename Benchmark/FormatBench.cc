@@ -0,0 +1,491 @@
+// Times the file-format core on synthetic inputs: cement library loading the way RCFHandler
+// loads it, tree building, path lookup, layered mounts, P3D chunk parsing, ChunkFile traversal,
+// loader reads through LoadStream, PNG decoding and half float conversion. Every case prints one
+// JSON line with the best and median time, the revision is tagged on so results of different
+// commits can be lined up
+//
+//   cmake -S . -B build && cmake --build build
+//   ./build/FormatBench --entries 100000 --depth 6 --repeat 9 > results.jsonl
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <filesystem>
+#include <fcntl.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "SyntheticCorpus.hxx"
+#include "FileHandlers/rcf/RcfArchive.hxx"
+#include "FileHandlers/rcf/RcfTree.hxx"
+#include "FileHandlers/rcf/RcfIndexCache.hxx"
+#include "FileHandlers/rcf/RcfFileSystem.hxx"
+#include "FileHandlers/io/PathSearch.hxx"
+#include "FileHandlers/io/ContentHash.hxx"
+
+#ifndef FORMATBENCH_REVISION
+#define FORMATBENCH_REVISION "unknown"
+#endif
+
+struct Settings {
+    size_t entries = 20000;
+    unsigned int depth = 4;
+    uint32_t entrySize = 4096;
+    unsigned int chunkRoots = 64;
+    unsigned int chunkDepth = 3;
+    unsigned int chunkFanout = 8;
+    uint32_t chunkBody = 64;
+    unsigned int textures = 16;
+    uint32_t textureSize = 256;
+    size_t vertices = 1 << 20;
+    int repeat = 5;
+    std::string filter;
+    std::string revision = FORMATBENCH_REVISION;
+    std::filesystem::path directory;
+};
+
+// ChunkFile prints every chunk it begins and the writer its summary, stdout goes to the null device meanwhile
+class QuietStdout
+{
+public:
+    QuietStdout()
+    {
+        fflush(stdout);
+#ifdef _WIN32
+        m_Saved = _dup(_fileno(stdout));
+        int null = _open("NUL", _O_WRONLY);
+        if (null >= 0) {
+            _dup2(null, _fileno(stdout));
+            _close(null);
+        }
+#else
+        m_Saved = dup(fileno(stdout));
+        int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+        if (null >= 0) {
+            dup2(null, fileno(stdout));
+            close(null);
+        }
+#endif
+    }
+
+    ~QuietStdout()
+    {
+        fflush(stdout);
+        if (m_Saved < 0) return;
+#ifdef _WIN32
+        _dup2(m_Saved, _fileno(stdout));
+        _close(m_Saved);
+#else
+        dup2(m_Saved, fileno(stdout));
+        close(m_Saved);
+#endif
+    }
+
+private:
+    int m_Saved = -1;
+};
+
+// Runs the case repeat times, the check value the case returns can't be zero and has to match on every run
+template <typename Function>
+static bool Measure(const Settings& settings, const char* name, uint64_t items, uint64_t bytes, Function function)
+{
+    if (!settings.filter.empty() && std::string_view(name).find(settings.filter) == std::string_view::npos) return true;
+
+    std::vector<double> seconds;
+    uint64_t check = 0;
+    bool bStable = true;
+    for (int r = 0; r < settings.repeat; r++) {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t value = function();
+        seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        if (r > 0 && value != check) bStable = false;
+        check = value;
+    }
+    std::sort(seconds.begin(), seconds.end());
+    double best = seconds.front();
+    double median = seconds[seconds.size() / 2];
+    bool bSuccess = bStable && check != 0;
+
+    printf("{\"bench\":\"%s\",\"revision\":\"%s\",\"items\":%llu,\"bytes\":%llu,\"runs\":%d,\"best\":%.6f,\"median\":%.6f,"
+        "\"items_per_s\":%.0f,\"MBps\":%.2f,\"check\":%llu,\"ok\":%s}\n",
+        name, settings.revision.c_str(), static_cast<unsigned long long>(items), static_cast<unsigned long long>(bytes), settings.repeat,
+        best, median, (best > 0.0) ? static_cast<double>(items) / best : 0.0, (best > 0.0) ? static_cast<double>(bytes) / best / 1e6 : 0.0,
+        static_cast<unsigned long long>(check), bSuccess ? "true" : "false");
+    fflush(stdout);
+    return bSuccess;
+}
+
+static bool WriteFile(const std::filesystem::path& path, const std::vector<uint8_t>& data)
+{
+    FILE* file = fopen(path.string().c_str(), "wb");
+    if (!file) return false;
+    bool bWritten = fwrite(data.data(), 1, data.size(), file) == data.size();
+    return fclose(file) == 0 && bWritten;
+}
+
+// Every other texture a PNG, the rest raw RGBA
+static std::vector<uint8_t> MakeTextures(const Settings& settings)
+{
+    std::vector<SyntheticCorpus::Image> images;
+    for (unsigned int i = 0; i < settings.textures; i++) {
+        if (i % 2 == 0) images.push_back({ SyntheticCorpus::ImageFormatPng, SyntheticCorpus::MakePngTexture(settings.textureSize, settings.textureSize, i + 1) });
+        else images.push_back({ SyntheticCorpus::ImageFormatRaw, SyntheticCorpus::MakeRawTexture(settings.textureSize, settings.textureSize, i + 1) });
+    }
+    return SyntheticCorpus::MakeTextureFile(images, settings.textureSize, settings.textureSize);
+}
+
+// Reads the texture chunk begun last field by field the way TextureLoader does, without creating the texture
+static uint64_t LoadTexture(ChunkFile& file)
+{
+    char name[256];
+    std::vector<uint8_t> data;
+    uint64_t bytes = 0;
+    file.GetString(name);
+    for (int i = 0; i < 9; i++) file.GetU32();
+    while (file.ChunksRemaining()) {
+        if (file.BeginChunk() == SyntheticCorpus::ImageChunk) {
+            file.GetString(name);
+            for (int i = 0; i < 7; i++) file.GetU32();
+            while (file.ChunksRemaining()) {
+                if (file.BeginChunk() == SyntheticCorpus::ImageDataChunk) {
+                    uint32_t size = file.GetU32();
+                    data.resize(size);
+                    file.GetData(data.data(), size);
+                    bytes += size;
+                }
+                file.EndChunk();
+            }
+        }
+        file.EndChunk();
+    }
+    return bytes;
+}
+
+static uint64_t LoadTextures(ChunkFile& file)
+{
+    uint64_t bytes = 0;
+    while (file.ChunksRemaining()) {
+        if (file.BeginChunk() == SyntheticCorpus::TextureChunk) bytes += LoadTexture(file);
+        file.EndChunk();
+    }
+    return bytes;
+}
+
+// Visits every chunk below the current one, the way the loaders walk a file
+static uint64_t Traverse(ChunkFile& file)
+{
+    uint64_t count = 0;
+    while (file.ChunksRemaining()) {
+        file.BeginChunk();
+        count += 1 + Traverse(file);
+        file.EndChunk();
+    }
+    return count;
+}
+
+// Cement library cases, opened the way RCFHandler::LoadFile opens archives
+static bool RunLibrary(const Settings& settings)
+{
+    std::vector<std::string> paths = SyntheticCorpus::MakePaths(settings.entries, settings.depth);
+    std::filesystem::path libraryPath = settings.directory / "synthetic.rcf";
+    bool bWritten;
+    {
+        // The writer prints a summary, stdout is kept to the results
+        QuietStdout quiet;
+        bWritten = SyntheticCorpus::WriteLibrary(libraryPath.string(), paths, settings.entrySize);
+    }
+    if (!bWritten) {
+        fprintf(stderr, "Couldn't write %s\n", libraryPath.string().c_str());
+        return false;
+    }
+
+    FileView view;
+    if (!view.Open(libraryPath.string())) return false;
+    const std::string rootName = "synthetic.rcf";
+    bool bSuccess = true;
+
+    bSuccess &= Measure(settings, "rcf_open", paths.size(), view.Size(), [&]() {
+        RcfArchive archive;
+        return archive.Open(view) ? uint64_t(archive.GetEntryCount()) : 0;
+        });
+
+    RcfArchive archive;
+    if (!archive.Open(view)) return false;
+    bSuccess &= Measure(settings, "rcf_tree_build", paths.size(), view.Size(), [&]() {
+        RcfTree tree;
+        tree.Build(archive, rootName);
+        return uint64_t(tree.GetNodeCount());
+        });
+
+    // Handler load: archive and tree through the index cache, then the search index
+    auto load = [&]() {
+        RcfArchive loaded;
+        RcfTree tree;
+        if (!RcfIndexCache::Open(loaded, tree, view, rootName)) return uint64_t(0);
+        PathSearch search;
+        for (const auto& entry : loaded.GetEntries()) {
+            if (!entry.path.empty()) search.Add(entry.path);
+        }
+        return uint64_t(loaded.GetEntryCount() + tree.GetNodeCount());
+        };
+    std::filesystem::path cachePath = RcfIndexCache::GetCachePath(view);
+    bSuccess &= Measure(settings, "rcf_load_cold", paths.size(), view.Size(), [&]() {
+        std::error_code error;
+        std::filesystem::remove(cachePath, error);
+        return load();
+        });
+    bSuccess &= Measure(settings, "rcf_load_cached", paths.size(), view.Size(), load);
+    std::error_code error;
+    std::filesystem::remove(cachePath, error);
+
+    // Every path once in random order, then as many misses
+    std::vector<std::string> lookups = paths;
+    std::shuffle(lookups.begin(), lookups.end(), std::mt19937(7));
+    for (size_t i = 0; i < paths.size(); i++) lookups.push_back(paths[i] + ".missing");
+    bSuccess &= Measure(settings, "rcf_lookup", lookups.size(), 0, [&]() {
+        uint64_t found = 0;
+        for (const auto& path : lookups) found += archive.FindEntry(path) != nullptr;
+        return found;
+        });
+    return bSuccess;
+}
+
+// Library of RunLibrary with a folder over it replacing every hundredth path and the library mounted again
+// below the folder. The folder has to win its paths through its priority, the later library every other one
+// as the same priority goes to the later mount, and searches list each path once from the layer winning it
+static bool RunMount(const Settings& settings)
+{
+    std::vector<std::string> paths = SyntheticCorpus::MakePaths(settings.entries, settings.depth);
+    std::filesystem::path libraryPath = settings.directory / "synthetic.rcf";
+    std::filesystem::path overridePath = settings.directory / "override";
+    const std::vector<uint8_t> content(16, 0x5A);
+    size_t overridden = 0;
+    for (size_t i = 0; i < paths.size(); i += 100) {
+        std::string relative = paths[i];
+        std::replace(relative.begin(), relative.end(), '\\', '/');
+        std::filesystem::path filePath = overridePath / relative;
+        std::error_code error;
+        std::filesystem::create_directories(filePath.parent_path(), error);
+        if (error || !WriteFile(filePath, content)) {
+            fprintf(stderr, "Couldn't write %s\n", filePath.string().c_str());
+            return false;
+        }
+        overridden++;
+    }
+
+    std::string fileName = paths[0].substr(paths[0].rfind('\\') + 1);
+    bool bSuccess = Measure(settings, "vfs_mount", paths.size() * 2 + overridden, 0, [&]() {
+        RcfFileSystem fileSystem;
+        if (!fileSystem.MountArchive(libraryPath.string()) || !fileSystem.MountDirectory(overridePath.string(), 1) ||
+            !fileSystem.MountArchive(libraryPath.string())) return uint64_t(0);
+        if (fileSystem.GetFiles().size() != paths.size()) return uint64_t(0);
+
+        for (size_t i = 0; i < paths.size(); i++) {
+            const RcfFileSystem::File* file = fileSystem.Find(paths[i]);
+            if (!file || file->layer != ((i % 100 == 0) ? 1u : 2u)) return uint64_t(0);
+        }
+        std::vector<const RcfFileSystem::File*> results = fileSystem.Search(fileName);
+        if (results.size() != 1 || results[0]->layer != 1 || fileSystem.Open(*results[0]).Size() != content.size()) return uint64_t(0);
+        return uint64_t(fileSystem.GetFiles().size());
+        });
+
+    std::error_code error;
+    std::filesystem::remove_all(overridePath, error);
+    return bSuccess;
+}
+
+// P3D chunk parsing, through P3D::GetChunks and through ChunkFile over a file
+static bool RunChunks(const Settings& settings)
+{
+    std::vector<uint8_t> tree = SyntheticCorpus::MakeChunkTree(settings.chunkRoots, settings.chunkDepth, settings.chunkFanout, settings.chunkBody);
+    std::vector<uint8_t> textures = MakeTextures(settings);
+
+    bool bSuccess = true;
+    uint64_t treeChunks = 0;
+    for (auto* file : { &tree, &textures }) {
+        P3D p3d;
+        p3d.GetChunks(*file, sizeof(P3DHeader));
+        if (file == &tree) treeChunks = p3d.chunks.size();
+        const char* name = (file == &tree) ? "p3d_get_chunks" : "p3d_get_chunks_textures";
+        bSuccess &= Measure(settings, name, p3d.chunks.size(), file->size(), [&]() {
+            P3D parsed;
+            parsed.GetChunks(*file, sizeof(P3DHeader));
+            return uint64_t(parsed.chunks.size());
+            });
+    }
+
+    std::filesystem::path treePath = settings.directory / "synthetic.p3d";
+    if (!WriteFile(treePath, tree)) return false;
+    bSuccess &= Measure(settings, "chunkfile_traverse", treeChunks, tree.size(), [&]() {
+        QuietStdout quiet;
+        LoadStream stream(treePath.string().c_str());
+        if (!stream.IsOpen()) return uint64_t(0);
+        ChunkFile file(&stream);
+        return Traverse(file);
+        });
+    bSuccess &= Measure(settings, "chunkfile_traverse_memory", treeChunks, tree.size(), [&]() {
+        QuietStdout quiet;
+        LoadStream stream{ std::span<const uint8_t>(tree) };
+        ChunkFile file(&stream);
+        return Traverse(file);
+        });
+    return bSuccess;
+}
+
+// Loader reads through LoadStream, from a file and from memory
+static bool RunStreams(const Settings& settings)
+{
+    std::vector<uint8_t> textures = MakeTextures(settings);
+    std::vector<float> vertices = SyntheticCorpus::MakeVertexStream(settings.vertices);
+    std::vector<uint8_t> vertexBytes(reinterpret_cast<const uint8_t*>(vertices.data()), reinterpret_cast<const uint8_t*>(vertices.data() + vertices.size()));
+
+    std::filesystem::path texturePath = settings.directory / "textures.p3d";
+    std::filesystem::path vertexPath = settings.directory / "vertices.bin";
+    if (!WriteFile(texturePath, textures) || !WriteFile(vertexPath, vertexBytes)) return false;
+
+    bool bSuccess = true;
+    for (bool bMemory : { false, true }) {
+        auto open = [&](LoadStream& stream, const std::filesystem::path& path, const std::vector<uint8_t>& data) {
+            return bMemory ? stream.Open(data) : stream.OpenRead(path.string().c_str());
+            };
+
+        bSuccess &= Measure(settings, bMemory ? "texture_load_memory" : "texture_load_file", settings.textures, textures.size(), [&]() {
+            QuietStdout quiet;
+            LoadStream stream;
+            if (!open(stream, texturePath, textures)) return uint64_t(0);
+            ChunkFile file(&stream);
+            return LoadTextures(file);
+            });
+
+        bSuccess &= Measure(settings, bMemory ? "vertex_read_memory" : "vertex_read_file", vertices.size(), vertexBytes.size(), [&]() {
+            LoadStream stream;
+            if (!open(stream, vertexPath, vertexBytes)) return uint64_t(0);
+            double sum = 0.0;
+            for (size_t i = 0; i < vertices.size(); i++) sum += stream.GetFloat();
+            return stream.HasFailed() ? uint64_t(0) : static_cast<uint64_t>(sum * 1000.0) | 1;
+            });
+    }
+
+    // Selecting every texture in the P3D handler, its loader runs over the bytes of the chunk
+    P3D p3d;
+    p3d.GetChunks(textures, sizeof(P3DHeader));
+    bSuccess &= Measure(settings, "chunk_select", settings.textures, textures.size(), [&]() {
+        QuietStdout quiet;
+        uint64_t bytes = 0;
+        for (uint32_t index = p3d.GetFirstChunk(); index != P3D::npos; index = p3d.chunks[index].nextSibling) {
+            LoadStream stream(p3d.GetBytes(p3d.chunks[index]));
+            ChunkFile file(&stream, true);
+            bytes += LoadTexture(file);
+        }
+        return bytes;
+        });
+    return bSuccess;
+}
+
+static bool RunTextures(const Settings& settings)
+{
+    std::vector<std::vector<uint8_t>> pngs;
+    uint64_t pngBytes = 0;
+    for (unsigned int i = 0; i < settings.textures; i++) {
+        pngs.push_back(SyntheticCorpus::MakePngTexture(settings.textureSize, settings.textureSize, i + 1));
+        pngBytes += pngs.back().size();
+    }
+
+    return Measure(settings, "png_decode", pngs.size(), pngBytes, [&]() {
+        uint64_t decoded = 0;
+        for (const auto& png : pngs) {
+            unsigned char* image = nullptr;
+            unsigned int width = 0, height = 0;
+            if (lodepng_decode32(&image, &width, &height, png.data(), png.size()) == 0) decoded += uint64_t(width) * height;
+            free(image);
+        }
+        return decoded;
+        });
+}
+
+static bool RunHalves(const Settings& settings)
+{
+    std::vector<float> floats = SyntheticCorpus::MakeVertexStream(settings.vertices);
+    std::vector<uint16_t> halves = SyntheticCorpus::MakeHalfStream(settings.vertices);
+    std::vector<float> unpacked(halves.size());
+    std::vector<uint16_t> packed(floats.size());
+
+    bool bSuccess = Measure(settings, "half_to_float", halves.size(), halves.size() * sizeof(uint16_t), [&]() {
+        for (size_t i = 0; i < halves.size(); i++) {
+            HalfFloat half;
+            half.GetBits() = halves[i];
+            unpacked[i] = half;
+        }
+        return ContentHash::Hash(std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(unpacked.data()), unpacked.size() * sizeof(float)));
+        });
+    bSuccess &= Measure(settings, "float_to_half", floats.size(), floats.size() * sizeof(float), [&]() {
+        for (size_t i = 0; i < floats.size(); i++) packed[i] = HalfFloat(floats[i]).GetBits();
+        return ContentHash::Hash(std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(packed.data()), packed.size() * sizeof(uint16_t)));
+        });
+    return bSuccess;
+}
+
+int main(int argc, char** argv)
+{
+    Settings settings;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--entries" && hasValue) settings.entries = strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--depth" && hasValue) settings.depth = static_cast<unsigned int>(atoi(argv[++i]));
+        else if (arg == "--entry-size" && hasValue) settings.entrySize = static_cast<uint32_t>(atoi(argv[++i]));
+        else if (arg == "--chunk-roots" && hasValue) settings.chunkRoots = static_cast<unsigned int>(atoi(argv[++i]));
+        else if (arg == "--chunk-depth" && hasValue) settings.chunkDepth = static_cast<unsigned int>(atoi(argv[++i]));
+        else if (arg == "--chunk-fanout" && hasValue) settings.chunkFanout = static_cast<unsigned int>(atoi(argv[++i]));
+        else if (arg == "--textures" && hasValue) settings.textures = static_cast<unsigned int>(atoi(argv[++i]));
+        else if (arg == "--texture-size" && hasValue) settings.textureSize = static_cast<uint32_t>(atoi(argv[++i]));
+        else if (arg == "--vertices" && hasValue) settings.vertices = strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--repeat" && hasValue) settings.repeat = (std::max)(atoi(argv[++i]), 1);
+        else if (arg == "--filter" && hasValue) settings.filter = argv[++i];
+        else if (arg == "--revision" && hasValue) settings.revision = argv[++i];
+        else if (arg == "--dir" && hasValue) settings.directory = argv[++i];
+        else if (arg == "--quick") {
+            settings.entries = 2000;
+            settings.chunkRoots = 8;
+            settings.textures = 4;
+            settings.textureSize = 64;
+            settings.vertices = 1 << 14;
+            settings.repeat = 2;
+        }
+        else {
+            fprintf(stderr, "Usage: %s [--entries n] [--depth n] [--entry-size bytes] [--chunk-roots n] [--chunk-depth n] [--chunk-fanout n]\n"
+                "    [--textures n] [--texture-size pixels] [--vertices n] [--repeat n] [--filter name] [--revision name] [--dir path] [--quick]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // Generated files go to a scratch folder that is removed afterwards
+    bool bOwnDirectory = settings.directory.empty();
+    if (bOwnDirectory) settings.directory = std::filesystem::temp_directory_path() / ("FormatBench" + std::to_string(std::random_device()()));
+    std::error_code error;
+    std::filesystem::create_directories(settings.directory, error);
+    if (error) {
+        fprintf(stderr, "Couldn't create %s\n", settings.directory.string().c_str());
+        return 1;
+    }
+
+    bool bSuccess = RunLibrary(settings);
+    bSuccess &= RunMount(settings);
+    bSuccess &= RunChunks(settings);
+    bSuccess &= RunStreams(settings);
+    bSuccess &= RunTextures(settings);
+    bSuccess &= RunHalves(settings);
+
+    if (bOwnDirectory) std::filesystem::remove_all(settings.directory, error);
+    return bSuccess ? 0 : 1;
+}
@@ -0,0 +1,160 @@
+// Compares the bulk read backends on the same files. Archives are read entry by entry the way
+// the duplicate and diff scans read them, any other file is read whole. Every run prints one
+// JSON line with the throughput and the queue depth the backend kept up. With --verify the runs
+// at each depth have to read the same bytes, the exit code is 1 when they don't or a read failed
+//
+//   g++ -std=c++20 -O2 -pthread -I../ToolKit ReadBackends.cc -o ReadBackends
+//   ./ReadBackends --depth 1 --depth 32 --direct --cold archive.rcf ...
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <functional>
+
+#include "FileHandlers/io/BulkReader.hxx"
+#include "FileHandlers/io/ContentHash.hxx"
+#include "FileHandlers/rcf/RcfArchive.hxx"
+
+struct Range {
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct Corpus {
+    std::string path;
+    std::vector<Range> ranges;
+};
+
+// Entries of an archive, or the whole file when it isn't one
+static Corpus LoadCorpus(const std::string& path)
+{
+    Corpus corpus;
+    corpus.path = path;
+    RcfArchive archive;
+    if (path.size() > 4 && path.compare(path.size() - 4, 4, ".rcf") == 0 && archive.Open(path)) {
+        for (const auto& entry : archive.GetEntries()) corpus.ranges.push_back({ entry.dir->fl_offset, entry.dir->fl_size });
+        return corpus;
+    }
+
+    FileView view;
+    if (view.Open(path)) corpus.ranges.push_back({ 0, view.Size() });
+    return corpus;
+}
+
+// Drops the cached pages of the file so the next run reads from the device
+static void DropCache(const std::string& path)
+{
+#ifdef __linux__
+    int file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file < 0) return;
+    posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED);
+    close(file);
+#else
+    (void)path;
+#endif
+}
+
+int main(int argc, char** argv)
+{
+    // The thread pool gets one thread per read in flight unless told otherwise
+    BulkReader::Options options;
+    options.threadCount = 0;
+    std::vector<unsigned int> depths;
+    std::vector<std::string> paths;
+    bool bCold = false, bVerify = false;
+    int repeat = 1;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--depth" && hasValue) depths.push_back(static_cast<unsigned int>(atoi(argv[++i])));
+        else if (arg == "--block" && hasValue) options.blockSize = static_cast<uint32_t>(atoi(argv[++i])) * 1024;
+        else if (arg == "--threads" && hasValue) options.threadCount = static_cast<unsigned int>(atoi(argv[++i]));
+        else if (arg == "--repeat" && hasValue) repeat = atoi(argv[++i]);
+        else if (arg == "--direct") options.direct = true;
+        else if (arg == "--cold") bCold = true;
+        else if (arg == "--verify") bVerify = true;
+        else if (arg.rfind("--", 0) == 0) {
+            fprintf(stderr, "Usage: %s [--depth n]... [--block kb] [--threads n] [--repeat n] [--direct] [--cold] [--verify] files...\n", argv[0]);
+            return 1;
+        }
+        else paths.push_back(arg);
+    }
+    if (paths.empty()) {
+        fprintf(stderr, "No files given\n");
+        return 1;
+    }
+    if (depths.empty()) depths.push_back(options.queueDepth);
+
+    std::vector<Corpus> corpora;
+    for (const auto& path : paths) corpora.push_back(LoadCorpus(path));
+
+    const BulkReader::Backend backends[] = { BulkReader::Backend::IoUring, BulkReader::Backend::ThreadPool };
+    bool bFailed = false;
+    for (unsigned int depth : depths) {
+        std::vector<uint64_t> checksums;
+        for (BulkReader::Backend backend : backends) {
+            for (int r = 0; r < repeat; r++) {
+                BulkReader::Options runOptions = options;
+                runOptions.backend = backend;
+                runOptions.queueDepth = depth;
+                runOptions.threadCount = (options.threadCount > 0) ? (std::min)(options.threadCount, depth) : depth;
+
+                // Stats of every file summed up, the queue depth weighted by the reads
+                BulkReader::Stats total;
+                double depthSum = 0.0;
+                std::atomic<uint64_t> checksum = 0;
+                bool bSuccess = true;
+                const char* backendName = nullptr;
+                bool bDirect = options.direct;
+                for (size_t c = 0; c < corpora.size(); c++) {
+                    const Corpus& corpus = corpora[c];
+                    if (bCold) DropCache(corpus.path);
+
+                    BulkReader reader;
+                    if (!reader.Open(corpus.path, runOptions)) {
+                        bSuccess = false;
+                        continue;
+                    }
+                    backendName = BulkReader::GetBackendName(reader.GetBackend());
+                    bDirect &= reader.IsDirect();
+                    for (size_t i = 0; i < corpus.ranges.size(); i++) reader.Submit(corpus.ranges[i].offset, corpus.ranges[i].size, i);
+
+                    bSuccess &= reader.Run([&](uint64_t tag, uint64_t position, std::span<const uint8_t> data) {
+                        if (bVerify) checksum ^= ContentHash::Hash(data, (c << 48) + tag * 0x9E3779B97F4A7C15ull + position);
+                        });
+
+                    const auto& stats = reader.GetStats();
+                    total.requests += stats.requests;
+                    total.reads += stats.reads;
+                    total.bytesRequested += stats.bytesRequested;
+                    total.bytesRead += stats.bytesRead;
+                    total.seconds += stats.seconds;
+                    total.maxQueueDepth = (std::max)(total.maxQueueDepth, stats.maxQueueDepth);
+                    depthSum += stats.averageQueueDepth * static_cast<double>(stats.reads);
+                }
+
+                double gbps = (total.seconds > 0.0) ? static_cast<double>(total.bytesRead) / total.seconds / 1e9 : 0.0;
+                printf("{\"bench\":\"read_backends\",\"backend\":\"%s\",\"requested\":\"%s\",\"direct\":%s,\"cold\":%s,\"depth\":%u,\"block\":%u,"
+                    "\"requests\":%zu,\"reads\":%zu,\"bytes\":%llu,\"seconds\":%.6f,\"GBps\":%.3f,\"avg_qd\":%.2f,\"max_qd\":%u,\"checksum\":\"%016llx\",\"ok\":%s}\n",
+                    backendName ? backendName : "none", BulkReader::GetBackendName(backend), bDirect ? "true" : "false", bCold ? "true" : "false",
+                    depth, runOptions.blockSize, total.requests, total.reads, static_cast<unsigned long long>(total.bytesRead), total.seconds, gbps,
+                    (total.reads > 0) ? depthSum / static_cast<double>(total.reads) : 0.0, total.maxQueueDepth,
+                    static_cast<unsigned long long>(checksum.load()), bSuccess ? "true" : "false");
+                fflush(stdout);
+                bFailed |= !bSuccess;
+                checksums.push_back(checksum.load());
+            }
+        }
+
+        if (bVerify && std::adjacent_find(checksums.begin(), checksums.end(), std::not_equal_to<uint64_t>()) != checksums.end()) {
+            fprintf(stderr, "Backends read different bytes at queue depth %u\n", depth);
+            bFailed = true;
+        }
+    }
+    return bFailed ? 1 : 0;
+}
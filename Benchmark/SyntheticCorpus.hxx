@@ -0,0 +1,255 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <span>
+#include <random>
+#include <algorithm>
+#include <map>
+#include <ios>
+
+#include "FileHandlers/rcf/RcfWriter.hxx"
+#include "FileHandlers/p3d/pure3d/LoadManager.hxx"
+#include "FileHandlers/p3d/P3D.h"
+#include "FileHandlers/p3d/pure3d/lodepng/lodepng.h"
+#include "3rdParty/umHalf.h"
+
+// Writes P3D chunks, the size fields are patched in when a chunk ends. Data written after
+// the first child of a chunk belongs to the children, as in the files the game ships
+class ChunkWriter
+{
+public:
+    void Begin(uint32_t type)
+    {
+        if (!m_Stack.empty()) CloseBody(m_Stack.back());
+        m_Stack.push_back({ m_Data.size(), 0 });
+        P3DChunkHeader header = { type, 0, 0 };
+        Write(&header, sizeof(header));
+    }
+
+    void End()
+    {
+        Open& open = m_Stack.back();
+        CloseBody(open);
+        uint32_t total = static_cast<uint32_t>(m_Data.size() - open.start);
+        memcpy(m_Data.data() + open.start + offsetof(P3DChunkHeader, sub_chunks_size), &total, sizeof(total));
+        m_Stack.pop_back();
+    }
+
+    void Write(const void* data, size_t size)
+    {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        m_Data.insert(m_Data.end(), bytes, bytes + size);
+    }
+
+    template <typename T>
+    void Write(const T& value) { Write(&value, sizeof(T)); }
+
+    // Length prefixed string, the way ChunkFile::GetString reads it
+    void WriteString(const std::string& text)
+    {
+        Write(static_cast<uint8_t>(text.size()));
+        Write(text.data(), text.size());
+    }
+
+    // Whole file with the P3D header in front of the chunks written so far
+    std::vector<uint8_t> GetFile() const
+    {
+        std::vector<uint8_t> file(sizeof(P3DHeader) + m_Data.size());
+        P3DHeader header = { { 'P', '3', 'D' }, char(0xFF), sizeof(P3DHeader), static_cast<uint32_t>(file.size()) };
+        memcpy(file.data(), &header, sizeof(header));
+        std::copy(m_Data.begin(), m_Data.end(), file.begin() + sizeof(header));
+        return file;
+    }
+
+private:
+    struct Open {
+        size_t start;
+        uint32_t bodySize;
+    };
+
+    std::vector<uint8_t> m_Data;
+    std::vector<Open> m_Stack;
+
+    void CloseBody(Open& open)
+    {
+        if (open.bodySize != 0) return;
+        open.bodySize = static_cast<uint32_t>(m_Data.size() - open.start);
+        memcpy(m_Data.data() + open.start + offsetof(P3DChunkHeader, chunk_size), &open.bodySize, sizeof(open.bodySize));
+    }
+};
+
+// Generators for the benchmark inputs. Everything is seeded, the same arguments give the
+// same bytes on every run so results of different commits compare
+class SyntheticCorpus
+{
+public:
+    static constexpr uint32_t TextureChunk = 0x19000;
+    static constexpr uint32_t ImageChunk = 0x19001;
+    static constexpr uint32_t ImageDataChunk = 0x19002;
+    static constexpr uint32_t ImageFormatRaw = 0;
+    static constexpr uint32_t ImageFormatPng = 1;
+
+    struct Image {
+        uint32_t format;
+        std::vector<uint8_t> data;
+    };
+
+    // Archive paths of a library, entryCount files below depth levels of directories
+    static std::vector<std::string> MakePaths(size_t entryCount, unsigned int depth, uint32_t seed = 1)
+    {
+        static const char* extensions[] = { "p3d", "png", "rsd", "spt", "cho", "rmv" };
+
+        // About sixteen files in every directory, the directories fan out evenly over the levels
+        depth = (std::max)(depth, 1u);
+        size_t directories = (std::max)(entryCount / 16, size_t(1));
+        size_t fanout = 2;
+        while (Power(fanout, depth) < directories) fanout++;
+
+        std::mt19937 random(seed);
+        std::vector<std::string> paths;
+        paths.reserve(entryCount);
+        for (size_t i = 0; i < entryCount; i++) {
+            std::string path;
+            size_t directory = i % directories;
+            for (unsigned int level = 0; level < depth; level++) {
+                path += "level" + std::to_string(level) + "_dir" + std::to_string(directory % fanout) + "\\";
+                directory /= fanout;
+            }
+            path += "file" + std::to_string(i) + "_" + std::to_string(random() % 100000) + "." + extensions[i % std::size(extensions)];
+            paths.push_back(std::move(path));
+        }
+        return paths;
+    }
+
+    // Writes a cement library holding the paths, entry sizes vary around entrySize
+    static bool WriteLibrary(const std::string& filePath, const std::vector<std::string>& paths, uint32_t entrySize, uint32_t seed = 1)
+    {
+        std::mt19937 random(seed);
+        std::vector<uint8_t> pool = MakeNoise(size_t(entrySize) * 4 + 4096, seed);
+
+        RcfWriter writer;
+        writer.SetDeduplicate(false);
+        for (const auto& path : paths) {
+            uint32_t size = entrySize / 2 + random() % (entrySize + 1);
+            uint32_t offset = random() % static_cast<uint32_t>(pool.size() - size);
+            writer.AddData(path, std::span<const uint8_t>(pool.data() + offset, size));
+        }
+        return writer.Write(filePath);
+    }
+
+    // P3D file of chunk trees depth levels deep, every chunk above the leaves holds fanout children
+    static std::vector<uint8_t> MakeChunkTree(unsigned int rootCount, unsigned int depth, unsigned int fanout, uint32_t bodySize, uint32_t seed = 1)
+    {
+        std::vector<uint8_t> body = MakeNoise(bodySize, seed);
+        ChunkWriter writer;
+        for (unsigned int i = 0; i < rootCount; i++) WriteChunk(writer, depth, fanout, body);
+        return writer.GetFile();
+    }
+
+    // P3D file of texture chunks with one image each, PNG or raw RGBA
+    static std::vector<uint8_t> MakeTextureFile(const std::vector<Image>& images, uint32_t width, uint32_t height)
+    {
+        ChunkWriter writer;
+        for (size_t i = 0; i < images.size(); i++) {
+            std::string name = "texture" + std::to_string(i);
+            writer.Begin(TextureChunk);
+            writer.WriteString(name);
+            for (uint32_t value : { 14000u, width, height, 32u, 8u, 0u, 1u, 0u, 1u }) writer.Write(value);
+
+            writer.Begin(ImageChunk);
+            writer.WriteString(name);
+            for (uint32_t value : { 14000u, width, height, 32u, 0u, 1u, images[i].format }) writer.Write(value);
+
+            writer.Begin(ImageDataChunk);
+            writer.Write(static_cast<uint32_t>(images[i].data.size()));
+            writer.Write(images[i].data.data(), images[i].data.size());
+            writer.End();
+
+            writer.End();
+            writer.End();
+        }
+        return writer.GetFile();
+    }
+
+    // RGBA pixels of a noisy gradient, noise keeps the deflate ratio near real art
+    static std::vector<uint8_t> MakeRawTexture(uint32_t width, uint32_t height, uint32_t seed = 1)
+    {
+        std::mt19937 random(seed);
+        std::vector<uint8_t> pixels(size_t(width) * height * 4);
+        for (uint32_t y = 0; y < height; y++) {
+            for (uint32_t x = 0; x < width; x++) {
+                uint8_t* pixel = &pixels[(size_t(y) * width + x) * 4];
+                pixel[0] = static_cast<uint8_t>(x * 255 / (std::max)(width, 1u) + random() % 16);
+                pixel[1] = static_cast<uint8_t>(y * 255 / (std::max)(height, 1u) + random() % 16);
+                pixel[2] = static_cast<uint8_t>((x ^ y) + random() % 16);
+                pixel[3] = 255;
+            }
+        }
+        return pixels;
+    }
+
+    // The raw texture encoded as PNG, empty when lodepng fails
+    static std::vector<uint8_t> MakePngTexture(uint32_t width, uint32_t height, uint32_t seed = 1)
+    {
+        std::vector<uint8_t> pixels = MakeRawTexture(width, height, seed);
+        unsigned char* png = nullptr;
+        size_t pngSize = 0;
+        if (lodepng_encode32(&png, &pngSize, pixels.data(), width, height) != 0) {
+            free(png);
+            return {};
+        }
+        std::vector<uint8_t> result(png, png + pngSize);
+        free(png);
+        return result;
+    }
+
+    // Vertex positions as floats, within the range levels are built in
+    static std::vector<float> MakeVertexStream(size_t vertexCount, uint32_t seed = 1)
+    {
+        std::mt19937 random(seed);
+        std::uniform_real_distribution<float> distribution(-1000.0f, 1000.0f);
+        std::vector<float> values(vertexCount * 3);
+        for (float& value : values) value = distribution(random);
+        return values;
+    }
+
+    // The vertex stream as half floats
+    static std::vector<uint16_t> MakeHalfStream(size_t vertexCount, uint32_t seed = 1)
+    {
+        std::vector<float> values = MakeVertexStream(vertexCount, seed);
+        std::vector<uint16_t> halves(values.size());
+        for (size_t i = 0; i < values.size(); i++) halves[i] = HalfFloat(values[i]).GetBits();
+        return halves;
+    }
+
+    static std::vector<uint8_t> MakeNoise(size_t size, uint32_t seed = 1)
+    {
+        std::mt19937 random(seed);
+        std::vector<uint8_t> data(size);
+        for (auto& value : data) value = static_cast<uint8_t>(random());
+        return data;
+    }
+
+private:
+    static size_t Power(size_t base, unsigned int exponent)
+    {
+        size_t result = 1;
+        while (exponent--) result *= base;
+        return result;
+    }
+
+    static void WriteChunk(ChunkWriter& writer, unsigned int depth, unsigned int fanout, const std::vector<uint8_t>& body)
+    {
+        writer.Begin(0x10000 + depth);
+        writer.Write(body.data(), body.size());
+        if (depth > 1) {
+            for (unsigned int i = 0; i < fanout; i++) WriteChunk(writer, depth - 1, fanout, body);
+        }
+        writer.End();
+    }
+};
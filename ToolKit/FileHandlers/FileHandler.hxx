@@ -6,6 +6,10 @@
 #include <sstream>
 #include <iomanip>
 #include <cerrno>
+#include <span>
+
+#include "io/FileView.hxx"
+#include "io/EntryCache.hxx"
 
 class FileHandler {
 public:
@@ -38,13 +42,17 @@ public:
     // Selected file from the Tree nodes
     std::string m_selectedFilePath;
 
-    // Binary content of the selected file
-    std::vector<uint8_t> m_selectedfileContent;
-    int m_selectedFileSize;
+    uint64_t m_selectedFileSize = 0;
+
+    // Read-only view of the selected file or chunk, into the mapping of the loaded file or the entry cache
+    std::span<const uint8_t> m_selectedFileView;
 
-    std::string m_savedFilePath;
+    // Handlers are owned through g_FileHandler, theirs may hold workers to stop
+    virtual ~FileHandler() {}
 
-    virtual void LoadFile(std::string& filePath, int offset = -1) = 0;
+    // Loads the file seen through the view, either a whole file from disc or a window into the
+    // archive holding it. Only used for naming, filePath is the entry path for embedded files
+    virtual void LoadFile(std::string& filePath, const FileView& view) = 0;
 
     virtual void Render() = 0;
 
@@ -52,6 +60,7 @@ public:
     eFileType GetFileTypeFromExtension(std::string extension) {
         static std::unordered_map<std::string, eFileType> extensionMap = {
             {"rcf", RCF_FILE},
+            {"rcfz", RCF_FILE},
             {"p3d", P3D_FILE},
             {"rsd", RSD_FILE},
             {"cso", CSO_FILE},
@@ -142,69 +151,61 @@ public:
         }
     }
 
-    // Extract file extension from string path
-    std::string GetFileExtension(std::string& filePath) {
-        size_t dotPos = filePath.find_last_of(L'.');
-        if (dotPos != std::string::npos) {
-            return filePath.substr(dotPos + 1);
-        }
-        return "";
-    }
-
-    // Save binary data file into a temp file
-    void SaveToTempFile(std::string fileName, int size)
+    // Function to open a save file dialog and return the chosen file path
+    std::string SaveFileDlg()
     {
-        if (m_selectedfileContent.empty()) return;
+        OPENFILENAMEA m_SaveFileName = { 0 };
+        char szFileName[MAX_PATH] = { 0 };
 
-        std::filesystem::path tempDir = std::filesystem::temp_directory_path();
-        std::filesystem::path tempFilePath = tempDir / fileName;
+        m_SaveFileName.lStructSize = sizeof(OPENFILENAMEA);
+        m_SaveFileName.lpstrFilter = "All Files\0*.*\0";
+        m_SaveFileName.lpstrFile = szFileName;
+        m_SaveFileName.nMaxFile = MAX_PATH;
+        m_SaveFileName.Flags = OFN_EXPLORER | OFN_OVERWRITEPROMPT | OFN_HIDEREADONLY;
 
-        FILE* tempFile = nullptr;
-        errno_t err = fopen_s(&tempFile, tempFilePath.string().c_str(), "wb");
-        if (err != 0 || tempFile == nullptr) {
-            // Print detailed error message using errno and strerror
-            std::cerr << "Failed to create temporary file: " << strerror(errno) << std::endl;
-            return;
+        // Display the file dialog
+        if (GetSaveFileNameA(&m_SaveFileName)) {
+            return std::string(szFileName);
+        }
+        else {
+            return "";
         }
-
-        // Write the content to the temporary file
-        fwrite(m_selectedfileContent.data(), size, 1, tempFile);
-
-        // Close the temporary file
-        fclose(tempFile);
-
-        m_savedFilePath = tempFilePath.string().c_str(); // Assign the correct path
     }
 
-    // Gets from disc file using its path, offset and size the binary content of the file
-    void GetFileContent(std::string filePath, int offset, int size)
+    // Function to open a folder dialog and return the selected folder path
+    std::string OpenFolderDlg()
     {
-        // Read the content from the specified offset and size
-        FILE* m_File = nullptr;
-        errno_t err = fopen_s(&m_File, filePath.c_str(), "rb");
-        if (err != 0 || m_File == nullptr) {
-            std::cerr << "Failed to open file!" << std::endl;
-            return;
-        }
+        char szFolderName[MAX_PATH] = { 0 };
 
-        // Seek to the provided offset if provided
-        if (fseek(m_File, offset, SEEK_SET) != 0) {
-            std::wcerr << L"Error seeking to offset: " << offset << std::endl;
-            fclose(m_File);
-            return;
-        }
+        BROWSEINFOA m_BrowseInfo = { 0 };
+        m_BrowseInfo.hwndOwner = g_Window;
+        m_BrowseInfo.pszDisplayName = szFolderName;
+        m_BrowseInfo.lpszTitle = "Select output folder";
+        m_BrowseInfo.ulFlags = BIF_RETURNONLYFSDIRS | BIF_NEWDIALOGSTYLE;
 
-        // Read
-        m_selectedfileContent.resize(size);
-        fread(m_selectedfileContent.data(), size, 1, m_File);
-        m_selectedFileSize = size;
+        // Display the folder dialog
+        PIDLIST_ABSOLUTE m_ItemList = SHBrowseForFolderA(&m_BrowseInfo);
+        if (m_ItemList == nullptr) return "";
 
-        // Close
-        fclose(m_File);
+        bool m_bFound = SHGetPathFromIDListA(m_ItemList, szFolderName);
+        CoTaskMemFree(m_ItemList);
+        return m_bFound ? std::string(szFolderName) : "";
+    }
+
+    // Extract file extension from string path
+    std::string GetFileExtension(std::string& filePath) {
+        size_t dotPos = filePath.find_last_of(L'.');
+        if (dotPos != std::string::npos) {
+            return filePath.substr(dotPos + 1);
+        }
+        return "";
     }
 
-    // Default function used for each different handler
-    void ProcessFile(std::string filePath, int offset = -1);
+    // Default function used for each different handler, an open view loads a file embedded in the loaded one
+    void ProcessFile(std::string filePath, FileView view = {});
+
+    // Opens a file embedded in the loaded one once the frame is done, since it replaces the current handler
+    void OpenEmbeddedFile(std::string filePath, FileView view);
 
     bool ImGui_ToolTipHover()
     {
@@ -214,16 +215,29 @@ public:
 
 std::unique_ptr<FileHandler> g_FileHandler;
 
+// Copies of the entries selected and prefetched, shared by every handler
+EntryCache g_EntryCache;
+
+// Embedded file waiting to be opened at the end of the frame
+std::string g_PendingFilePath;
+FileView g_PendingFileView;
+
 #include "rcf/RCFHandler.hxx"
 #include "p3d/P3DHandler.hxx"
 
-void FileHandler::ProcessFile(std::string filePath, int offset)
+void FileHandler::ProcessFile(std::string filePath, FileView view)
 {
     std::string extension = "";
-    std::string m_selectedFilePath = (offset != -1) ? m_selectedFilePath : "";
+    bool m_bEmbedded = view.IsOpen();
     extension = GetFileExtension(filePath);
     eFileType type = GetFileTypeFromExtension(extension);
 
+    // Files from disc get mapped whole, embedded ones come as a window into their archive
+    if (!m_bEmbedded && !view.Open(filePath)) {
+        std::cerr << "Failed to open file!" << std::endl;
+        return;
+    }
+
     switch (type)
     {
         case eFileType::RCF_FILE: 
@@ -237,9 +251,18 @@ void FileHandler::ProcessFile(std::string filePath, int offset)
 
     if (g_FileHandler) {
         g_FileHandler->m_LoadedFileType = type;
-        g_FileHandler->m_selectedFilePath = m_selectedFilePath;
-        g_FileHandler->LoadFile(filePath, offset);
+        g_FileHandler->m_LoadedFilePath = view.GetFilePath();
+        g_FileHandler->m_selectedFilePath = m_bEmbedded ? filePath : "";
+        g_FileHandler->LoadFile(filePath, view);
     }
 }
 
+void FileHandler::OpenEmbeddedFile(std::string filePath, FileView view)
+{
+    if (!view.IsOpen()) return;
+
+    g_PendingFilePath = filePath;
+    g_PendingFileView = view;
+}
+
 #endif // FILE_HANDLER_H
\ No newline at end of file
@@ -0,0 +1,450 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <span>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+
+#include "FileView.hxx"
+#include "ContentHash.hxx"
+#include "../p3d/pure3d/lodepng/lodepng.h"
+
+// LZ4 and zstd are opt in, the build that links a library defines TOOLKIT_WITH_LZ4 or TOOLKIT_WITH_ZSTD
+#if defined(TOOLKIT_WITH_LZ4) && __has_include(<lz4.h>)
+#include <lz4.h>
+#define TOOLKIT_HAS_LZ4 1
+#endif
+
+#if defined(TOOLKIT_WITH_ZSTD) && __has_include(<zstd.h>)
+#include <zstd.h>
+#define TOOLKIT_HAS_ZSTD 1
+#endif
+
+// Seekable compressed copy of a file. The bytes are cut into blocks compressed on their own
+// and listed in an index at the end, so any range is read back by unpacking only the blocks
+// holding it. Ranges given when packing never straddle two blocks unless they are larger than
+// a block, reading one of them back costs a single block. An opened pack is unpacked into
+// memory the size of the original file as ranges are asked for, views over that memory are
+// handed out in place of views over the original
+class BlockPack
+{
+public:
+    enum class Codec : uint32_t {
+        Store,
+        Deflate,
+        Lz4,
+        Zstd
+    };
+
+    // Range kept whole in one block, preloaded ones are unpacked as soon as the pack is opened
+    struct Range {
+        uint64_t offset;
+        uint64_t size;
+        bool preload;
+    };
+
+    struct Stats {
+        size_t blocks = 0;
+        uint64_t rawBytes = 0;
+        uint64_t packedBytes = 0;
+        double seconds = 0.0;
+    };
+
+    static constexpr uint32_t DefaultBlockSize = 256 * 1024;
+
+    BlockPack() {}
+
+    BlockPack(const BlockPack&) = delete;
+    BlockPack& operator=(const BlockPack&) = delete;
+
+    static bool IsAvailable(Codec codec)
+    {
+        switch (codec) {
+        case Codec::Store:
+        case Codec::Deflate: return true;
+#ifdef TOOLKIT_HAS_LZ4
+        case Codec::Lz4: return true;
+#endif
+#ifdef TOOLKIT_HAS_ZSTD
+        case Codec::Zstd: return true;
+#endif
+        default: return false;
+        }
+    }
+
+    // Fastest codec built in, LZ4 when it is there
+    static Codec GetFastCodec() { return IsAvailable(Codec::Lz4) ? Codec::Lz4 : Codec::Deflate; }
+
+    // Codec packing the smallest, zstd when it is there
+    static Codec GetSmallCodec() { return IsAvailable(Codec::Zstd) ? Codec::Zstd : Codec::Deflate; }
+
+    static const char* GetCodecName(Codec codec)
+    {
+        switch (codec) {
+        case Codec::Store: return "store";
+        case Codec::Deflate: return "deflate";
+        case Codec::Lz4: return "lz4";
+        case Codec::Zstd: return "zstd";
+        default: return "unknown";
+        }
+    }
+
+    static bool IsPack(const FileView& view)
+    {
+        return view.Size() >= sizeof(PackHeader) && memcmp(view.Data(), Magic, sizeof(Magic)) == 0;
+    }
+
+    // Packs the data into a new file with the ranges kept whole. Blocks that don't get smaller are stored as they are
+    static bool Create(std::span<const uint8_t> data, std::vector<Range> ranges, const std::string& outputPath, Codec codec,
+        uint32_t blockSize = DefaultBlockSize, unsigned int threadCount = std::thread::hardware_concurrency(), Stats* outStats = nullptr)
+    {
+        auto start = std::chrono::steady_clock::now();
+        if (threadCount == 0) threadCount = 1;
+        if (blockSize == 0) blockSize = DefaultBlockSize;
+        if (!IsAvailable(codec)) {
+            std::cerr << "Codec " << GetCodecName(codec) << " isn't built in" << std::endl;
+            return false;
+        }
+
+        std::vector<Block> blocks = GetBlocks(data.size(), std::move(ranges), blockSize);
+
+        std::filesystem::path tempPath = outputPath;
+        tempPath += ".tmp";
+        FILE* file = fopen(tempPath.string().c_str(), "wb");
+        if (file == nullptr) {
+            std::cerr << "Failed to open " << outputPath << " for writing" << std::endl;
+            return false;
+        }
+
+        PackHeader header;
+        memcpy(header.magic, Magic, sizeof(Magic));
+        header.blockSize = blockSize;
+        header.codec = static_cast<uint32_t>(codec);
+        header.rawSize = data.size();
+        header.blockCount = static_cast<uint32_t>(blocks.size());
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+        // Blocks are compressed a batch at a time by the workers and written in order
+        uint64_t position = sizeof(PackHeader);
+        size_t batchSize = size_t(threadCount) * 8;
+        std::vector<std::vector<uint8_t>> packed(batchSize);
+        for (size_t first = 0; first < blocks.size() && ok; first += batchSize) {
+            size_t last = (std::min)(first + batchSize, blocks.size());
+            std::atomic<size_t> next = first;
+            auto worker = [&]() {
+                for (size_t i = next++; i < last; i = next++) {
+                    Block& block = blocks[i];
+                    auto raw = data.subspan(static_cast<size_t>(block.rawOffset), block.rawSize);
+                    block.hash = ContentHash::Hash(raw);
+                    block.codec = static_cast<uint32_t>(codec);
+                    if (!Compress(codec, raw, packed[i - first]) || packed[i - first].size() >= raw.size()) {
+                        block.codec = static_cast<uint32_t>(Codec::Store);
+                        packed[i - first].assign(raw.begin(), raw.end());
+                    }
+                    block.packedSize = static_cast<uint32_t>(packed[i - first].size());
+                }
+            };
+
+            std::vector<std::thread> workers;
+            for (unsigned int t = 1; t < threadCount && t < last - first; t++) workers.emplace_back(worker);
+            worker();
+            for (auto& thread : workers) thread.join();
+
+            for (size_t i = first; i < last && ok; i++) {
+                blocks[i].packedOffset = position;
+                ok = fwrite(packed[i - first].data(), 1, packed[i - first].size(), file) == packed[i - first].size();
+                position += blocks[i].packedSize;
+            }
+        }
+
+        // Index goes last, its position is patched into the header once known
+        header.indexOffset = position;
+        header.indexHash = ContentHash::Hash({ reinterpret_cast<const uint8_t*>(blocks.data()), blocks.size() * sizeof(Block) });
+        ok = ok && fwrite(blocks.data(), sizeof(Block), blocks.size(), file) == blocks.size();
+        ok = ok && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+        ok = (fclose(file) == 0) && ok;
+
+        std::error_code error;
+        if (ok) std::filesystem::rename(tempPath, outputPath, error);
+        if (!ok || error) {
+            std::filesystem::remove(tempPath, error);
+            std::cerr << "Failed to write " << outputPath << std::endl;
+            return false;
+        }
+
+        Stats stats;
+        stats.blocks = blocks.size();
+        stats.rawBytes = data.size();
+        stats.packedBytes = position + blocks.size() * sizeof(Block);
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("Packed %s with %s: %zu blocks, %.1f MB to %.1f MB (%.1f%%) in %.2f s\n", outputPath.c_str(), GetCodecName(codec), stats.blocks,
+            stats.rawBytes / (1024.0 * 1024.0), stats.packedBytes / (1024.0 * 1024.0), stats.rawBytes ? 100.0 * stats.packedBytes / stats.rawBytes : 0.0, stats.seconds);
+        if (outStats) *outStats = stats;
+        return true;
+    }
+
+    // Reads the index of the pack seen through the view and unpacks the preloaded blocks
+    bool Open(const FileView& view)
+    {
+        Close();
+        if (!IsPack(view)) {
+            std::cerr << "Error: Not a block pack." << std::endl;
+            return false;
+        }
+
+        PackHeader header;
+        memcpy(&header, view.Data(), sizeof(header));
+        auto index = view.GetSpan(header.indexOffset, uint64_t(header.blockCount) * sizeof(Block));
+        if (header.version != Version || index.size() != uint64_t(header.blockCount) * sizeof(Block) || ContentHash::Hash(index) != header.indexHash) {
+            std::cerr << "Error: Block pack index is damaged." << std::endl;
+            return false;
+        }
+
+        // Blocks have to follow each other over the whole file, each packed inside the pack
+        m_Blocks.resize(header.blockCount);
+        memcpy(m_Blocks.data(), index.data(), index.size());
+        uint64_t rawOffset = 0;
+        for (auto& block : m_Blocks) {
+            if (block.rawOffset != rawOffset || view.GetSpan(block.packedOffset, block.packedSize).size() != block.packedSize) {
+                std::cerr << "Error: Block pack index is damaged." << std::endl;
+                m_Blocks.clear();
+                return false;
+            }
+            rawOffset += block.rawSize;
+        }
+
+        auto image = std::make_shared<MappedFile>();
+        if (rawOffset != header.rawSize || !image->Allocate(header.rawSize, view.GetFilePath())) {
+            std::cerr << "Error: Failed to unpack " << view.GetFilePath() << std::endl;
+            m_Blocks.clear();
+            return false;
+        }
+
+        m_Packed = view;
+        m_Image = image;
+        m_ImageView.Open(std::shared_ptr<const MappedFile>(m_Image));
+        m_Loaded.reset(new std::atomic<bool>[m_Blocks.size()]);
+        for (size_t i = 0; i < m_Blocks.size(); i++) m_Loaded[i] = false;
+        m_Locks.reset(new std::mutex[m_Blocks.size()]);
+
+        for (size_t i = 0; i < m_Blocks.size(); i++) {
+            if ((m_Blocks[i].flags & Preload) && !LoadBlock(i)) {
+                Close();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void Close()
+    {
+        m_ImageView.Close();
+        m_Image.reset();
+        m_Packed.Close();
+        m_Blocks.clear();
+        m_Loaded.reset();
+        m_Locks.reset();
+    }
+
+    bool IsOpen() const { return m_ImageView.IsOpen(); }
+
+    // Unpacked file, ranges that weren't loaded read as zeros
+    const FileView& GetView() const { return m_ImageView; }
+
+    // Pack the blocks are read from
+    const FileView& GetPackedView() const { return m_Packed; }
+
+    size_t GetBlockCount() const { return m_Blocks.size(); }
+
+    size_t GetLoadedCount() const
+    {
+        size_t count = 0;
+        for (size_t i = 0; i < m_Blocks.size(); i++) count += m_Loaded[i] ? 1 : 0;
+        return count;
+    }
+
+    // Unpacks the blocks holding the range unless they are in already, safe to call from several threads
+    bool Load(uint64_t offset, uint64_t size) const
+    {
+        if (m_Blocks.empty() || offset >= m_ImageView.Size()) return size == 0;
+
+        auto it = std::upper_bound(m_Blocks.begin(), m_Blocks.end(), offset, [](uint64_t value, const Block& block) { return value < block.rawOffset; });
+        bool ok = true;
+        for (size_t i = (it - m_Blocks.begin()) - 1; i < m_Blocks.size() && m_Blocks[i].rawOffset < offset + (std::max)(size, uint64_t(1)); i++) {
+            if (!m_Loaded[i].load(std::memory_order_acquire)) ok = LoadBlock(i) && ok;
+        }
+        return ok;
+    }
+
+    bool LoadAll() const { return Load(0, m_ImageView.Size()); }
+
+private:
+    static constexpr char Magic[8] = { 'T', 'K', 'B', 'L', 'K', 'P', 'A', 'K' };
+    static constexpr uint32_t Version = 1;
+
+    enum BlockFlags : uint32_t {
+        Preload = 1
+    };
+
+    struct PackHeader {
+        char magic[8];
+        uint32_t version = Version;
+        uint32_t blockSize = 0;
+        uint64_t rawSize = 0;
+        uint64_t indexOffset = 0;
+        uint32_t blockCount = 0;
+        uint32_t codec = 0;
+        uint64_t indexHash = 0;
+    };
+
+    // Index entry, content hash of the unpacked bytes is checked on every unpack
+    struct Block {
+        uint64_t rawOffset;
+        uint64_t packedOffset;
+        uint32_t rawSize;
+        uint32_t packedSize;
+        uint32_t codec;
+        uint32_t flags;
+        uint64_t hash;
+    };
+
+    FileView m_Packed;
+    std::shared_ptr<MappedFile> m_Image;
+    FileView m_ImageView;
+    std::vector<Block> m_Blocks;
+    std::unique_ptr<std::atomic<bool>[]> m_Loaded;
+    std::unique_ptr<std::mutex[]> m_Locks;
+
+    // Unpacks a block into the image once. Each block has a lock of its own, so readers only wait
+    // for the blocks they need and different blocks unpack at the same time
+    bool LoadBlock(size_t index) const
+    {
+        std::lock_guard<std::mutex> lock(m_Locks[index]);
+        if (m_Loaded[index]) return true;
+
+        const Block& block = m_Blocks[index];
+        uint8_t* output = m_Image->GetMutableData() + block.rawOffset;
+        auto packed = m_Packed.GetSpan(block.packedOffset, block.packedSize);
+        if (!Decompress(static_cast<Codec>(block.codec), packed, output, block.rawSize) || ContentHash::Hash({ output, block.rawSize }) != block.hash) {
+            std::cerr << "Error: Block at " << block.rawOffset << " of " << m_Packed.GetFilePath() << " is damaged." << std::endl;
+            memset(output, 0, block.rawSize);
+            return false;
+        }
+        m_Loaded[index].store(true, std::memory_order_release);
+        return true;
+    }
+
+    // Lays out the blocks over the whole data. Overlapping ranges are merged and kept whole, the bytes
+    // between them fill up the blocks. Anything larger than a block is cut into blocks of its own
+    static std::vector<Block> GetBlocks(uint64_t size, std::vector<Range> ranges, uint32_t blockSize)
+    {
+        std::sort(ranges.begin(), ranges.end(), [](const Range& a, const Range& b) { return a.offset < b.offset; });
+        std::vector<Range> units;
+        uint64_t covered = 0;
+        for (auto& range : ranges) {
+            if (range.size == 0 || range.offset >= size) continue;
+            uint64_t end = range.offset + (std::min)(range.size, size - range.offset);
+            if (!units.empty() && range.offset < covered) {
+                units.back().size = (std::max)(covered, end) - units.back().offset;
+                units.back().preload |= range.preload;
+            }
+            else {
+                if (range.offset > covered) units.push_back({ covered, range.offset - covered, false });
+                units.push_back({ range.offset, end - range.offset, range.preload });
+            }
+            covered = units.back().offset + units.back().size;
+        }
+        if (covered < size) units.push_back({ covered, size - covered, false });
+
+        std::vector<Block> blocks;
+        auto add = [&blocks](uint64_t offset, uint64_t length, bool preload) {
+            blocks.push_back({ offset, 0, static_cast<uint32_t>(length), 0, 0, preload ? uint32_t(Preload) : 0u, 0 });
+        };
+        for (auto& unit : units) {
+            bool fits = !blocks.empty() && blocks.back().rawSize + unit.size <= blockSize;
+            if (fits) {
+                blocks.back().rawSize += static_cast<uint32_t>(unit.size);
+                if (unit.preload) blocks.back().flags |= Preload;
+                continue;
+            }
+            for (uint64_t done = 0; done < unit.size; done += blockSize) add(unit.offset + done, (std::min)(uint64_t(blockSize), unit.size - done), unit.preload);
+        }
+        return blocks;
+    }
+
+    static bool Compress(Codec codec, std::span<const uint8_t> raw, std::vector<uint8_t>& packed)
+    {
+        switch (codec) {
+        case Codec::Store:
+            packed.assign(raw.begin(), raw.end());
+            return true;
+        case Codec::Deflate: {
+            unsigned char* output = nullptr;
+            size_t outputSize = 0;
+            unsigned error = lodepng_deflate(&output, &outputSize, raw.data(), raw.size(), &lodepng_default_compress_settings);
+            if (!error) packed.assign(output, output + outputSize);
+            free(output);
+            return !error;
+        }
+#ifdef TOOLKIT_HAS_LZ4
+        case Codec::Lz4: {
+            packed.resize(LZ4_compressBound(static_cast<int>(raw.size())));
+            int packedSize = LZ4_compress_default(reinterpret_cast<const char*>(raw.data()), reinterpret_cast<char*>(packed.data()), static_cast<int>(raw.size()), static_cast<int>(packed.size()));
+            packed.resize((packedSize > 0) ? packedSize : 0);
+            return packedSize > 0;
+        }
+#endif
+#ifdef TOOLKIT_HAS_ZSTD
+        case Codec::Zstd: {
+            packed.resize(ZSTD_compressBound(raw.size()));
+            size_t packedSize = ZSTD_compress(packed.data(), packed.size(), raw.data(), raw.size(), 3);
+            if (ZSTD_isError(packedSize)) return false;
+            packed.resize(packedSize);
+            return true;
+        }
+#endif
+        default:
+            return false;
+        }
+    }
+
+    static bool Decompress(Codec codec, std::span<const uint8_t> packed, uint8_t* output, size_t rawSize)
+    {
+        switch (codec) {
+        case Codec::Store:
+            if (packed.size() != rawSize) return false;
+            memcpy(output, packed.data(), rawSize);
+            return true;
+        case Codec::Deflate: {
+            unsigned char* inflated = nullptr;
+            size_t inflatedSize = 0;
+            unsigned error = lodepng_inflate(&inflated, &inflatedSize, packed.data(), packed.size(), &lodepng_default_decompress_settings);
+            bool ok = !error && inflatedSize == rawSize;
+            if (ok) memcpy(output, inflated, rawSize);
+            free(inflated);
+            return ok;
+        }
+#ifdef TOOLKIT_HAS_LZ4
+        case Codec::Lz4:
+            return LZ4_decompress_safe(reinterpret_cast<const char*>(packed.data()), reinterpret_cast<char*>(output), static_cast<int>(packed.size()), static_cast<int>(rawSize)) == static_cast<int>(rawSize);
+#endif
+#ifdef TOOLKIT_HAS_ZSTD
+        case Codec::Zstd:
+            return ZSTD_decompress(output, rawSize, packed.data(), packed.size()) == rawSize;
+#endif
+        default:
+            return false;
+        }
+    }
+};
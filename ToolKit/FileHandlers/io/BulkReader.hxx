@@ -0,0 +1,453 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <span>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "IoUring.hxx"
+
+// Reads many ranges of one file from disc as fast as the device allows, for scans over whole
+// archives. On Linux the reads are queued to the kernel through io_uring into buffers registered
+// once, so a single thread keeps the device busy at the given queue depth. Everywhere else, or
+// when io_uring isn't available, a pool of threads issues positional reads. With direct reads
+// the page cache is bypassed and every read is aligned to the sector size
+class BulkReader
+{
+public:
+    enum class Backend {
+        Auto,
+        IoUring,
+        ThreadPool
+    };
+
+    struct Options {
+        Backend backend = Backend::Auto;
+        unsigned int queueDepth = 32;
+        uint32_t blockSize = 1024 * 1024;
+        bool direct = false;
+        unsigned int threadCount = std::thread::hardware_concurrency();
+    };
+
+    struct Stats {
+        Backend backend = Backend::Auto;
+        size_t requests = 0;
+        size_t reads = 0;
+        uint64_t bytesRequested = 0;
+        uint64_t bytesRead = 0;
+        double seconds = 0.0;
+        double averageQueueDepth = 0.0;
+        unsigned int maxQueueDepth = 0;
+    };
+
+    static constexpr uint64_t Alignment = 4096;
+
+    BulkReader() {}
+    ~BulkReader() { Close(); }
+
+    BulkReader(const BulkReader&) = delete;
+    BulkReader& operator=(const BulkReader&) = delete;
+
+    static const char* GetBackendName(Backend backend)
+    {
+        switch (backend) {
+        case Backend::IoUring: return "io_uring";
+        case Backend::ThreadPool: return "threads";
+        default: return "auto";
+        }
+    }
+
+    bool Open(const std::string& filePath) { return Open(filePath, Options()); }
+
+    // Opens the file with its own handle, the backend asked for is settled here
+    bool Open(const std::string& filePath, const Options& options)
+    {
+        Close();
+        m_Options = options;
+        m_Options.queueDepth = (std::max)(m_Options.queueDepth, 1u);
+        m_Options.blockSize = static_cast<uint32_t>((std::max)(uint64_t(m_Options.blockSize), Alignment));
+        m_Options.threadCount = (std::max)(m_Options.threadCount, 1u);
+
+#ifdef _WIN32
+        DWORD flags = FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN | (m_Options.direct ? FILE_FLAG_NO_BUFFERING : 0);
+        m_File = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, flags, nullptr);
+        if (m_File == INVALID_HANDLE_VALUE) {
+            std::cerr << "Failed to open " << filePath << std::endl;
+            return false;
+        }
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(m_File, &fileSize)) {
+            Close();
+            return false;
+        }
+        m_Size = static_cast<uint64_t>(fileSize.QuadPart);
+#else
+        m_File = open(filePath.c_str(), O_RDONLY | O_CLOEXEC | (m_Options.direct ? O_DIRECT : 0));
+        if (m_File < 0 && m_Options.direct && errno == EINVAL) {
+            // File systems like tmpfs refuse direct reads, the page cache is used for them
+            std::cerr << "Direct reads not supported for " << filePath << ", reading through the page cache" << std::endl;
+            m_Options.direct = false;
+            m_File = open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+        }
+        if (m_File < 0) {
+            std::cerr << "Failed to open " << filePath << std::endl;
+            return false;
+        }
+
+        struct stat fileStat;
+        if (fstat(m_File, &fileStat) != 0) {
+            Close();
+            return false;
+        }
+        m_Size = static_cast<uint64_t>(fileStat.st_size);
+        posix_fadvise(m_File, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+        m_Backend = m_Options.backend;
+#ifdef TOOLKIT_HAS_IO_URING
+        if (m_Backend != Backend::ThreadPool) {
+            if (m_Ring.Init(m_Options.queueDepth)) m_Backend = Backend::IoUring;
+            else {
+                if (m_Backend == Backend::IoUring) std::cerr << "io_uring not available, reading with threads" << std::endl;
+                m_Backend = Backend::ThreadPool;
+            }
+        }
+#else
+        if (m_Backend == Backend::IoUring) std::cerr << "io_uring not available, reading with threads" << std::endl;
+        m_Backend = Backend::ThreadPool;
+#endif
+        return true;
+    }
+
+    void Close()
+    {
+#ifdef TOOLKIT_HAS_IO_URING
+        m_Ring.Close();
+#endif
+#ifdef _WIN32
+        if (m_File != INVALID_HANDLE_VALUE) CloseHandle(m_File);
+        m_File = INVALID_HANDLE_VALUE;
+#else
+        if (m_File >= 0) close(m_File);
+        m_File = -1;
+#endif
+        m_Pieces.clear();
+        m_Outside.clear();
+        m_Requests = 0;
+        m_BytesRequested = 0;
+        m_Size = 0;
+    }
+
+#ifdef _WIN32
+    bool IsOpen() const { return m_File != INVALID_HANDLE_VALUE; }
+#else
+    bool IsOpen() const { return m_File >= 0; }
+#endif
+
+    uint64_t GetFileSize() const { return m_Size; }
+
+    // Backend the reads go through, never Auto once open
+    Backend GetBackend() const { return m_Backend; }
+
+    bool IsDirect() const { return m_Options.direct; }
+
+    // Queues a range of the file, ranges larger than the block size are read and handed over in blocks
+    void Submit(uint64_t offset, uint64_t size, uint64_t tag)
+    {
+        if (offset > m_Size || size > m_Size - offset) {
+            m_Outside.push_back(tag);
+            return;
+        }
+        m_BytesRequested += size;
+        m_Requests++;
+        uint64_t done = 0;
+        do {
+            m_Pieces.push_back({ offset + done, (std::min)(uint64_t(m_Options.blockSize), size - done), tag, done });
+            done += m_Options.blockSize;
+        } while (done < size);
+    }
+
+    size_t GetPendingCount() const { return m_Requests + m_Outside.size(); }
+
+    // Reads every queued range and calls complete(tag, position in the range, data) once per block.
+    // io_uring hands the blocks over on the calling thread, the thread pool from its workers at the same
+    // time. Ranges out of the file come last with empty data. False when a read failed
+    template <typename Complete>
+    bool Run(Complete complete)
+    {
+        auto start = std::chrono::steady_clock::now();
+        Backend backend = m_Backend;
+        m_Stats = {};
+        m_Stats.backend = backend;
+        m_Stats.requests = m_Requests;
+        m_Stats.bytesRequested = m_BytesRequested;
+
+        bool bSuccess = true;
+        if (!IsOpen()) bSuccess = m_Pieces.empty();
+#ifdef TOOLKIT_HAS_IO_URING
+        else if (backend == Backend::IoUring) bSuccess = RunRing(complete);
+#endif
+        else bSuccess = RunThreads(complete);
+
+        for (uint64_t tag : m_Outside) complete(tag, uint64_t(0), std::span<const uint8_t>());
+
+        m_Pieces.clear();
+        m_Outside.clear();
+        m_Requests = 0;
+        m_BytesRequested = 0;
+        m_Stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return bSuccess;
+    }
+
+    // Stats of the last run
+    const Stats& GetStats() const { return m_Stats; }
+
+private:
+    // Part of a queued range read with one request
+    struct Piece {
+        uint64_t offset;
+        uint64_t size;
+        uint64_t tag;
+        uint64_t position;
+    };
+
+    // Buffer aligned for direct reads, a block plus the alignment on both ends
+    struct AlignedBuffers {
+        std::unique_ptr<uint8_t[]> storage;
+        uint8_t* data = nullptr;
+        size_t stride = 0;
+
+        void Allocate(size_t count, size_t blockSize)
+        {
+            stride = blockSize + 2 * Alignment;
+            storage.reset(new uint8_t[count * stride + Alignment]);
+            data = reinterpret_cast<uint8_t*>((reinterpret_cast<uintptr_t>(storage.get()) + Alignment - 1) & ~uintptr_t(Alignment - 1));
+        }
+
+        uint8_t* Get(size_t index) const { return data + index * stride; }
+    };
+
+    Options m_Options;
+    Backend m_Backend = Backend::ThreadPool;
+    uint64_t m_Size = 0;
+    std::vector<Piece> m_Pieces;
+    std::vector<uint64_t> m_Outside;
+    size_t m_Requests = 0;
+    uint64_t m_BytesRequested = 0;
+    Stats m_Stats;
+
+#ifdef _WIN32
+    HANDLE m_File = INVALID_HANDLE_VALUE;
+#else
+    int m_File = -1;
+#endif
+
+#ifdef TOOLKIT_HAS_IO_URING
+    IoUring m_Ring;
+#endif
+
+    // Start of the read for the piece, direct reads begin on an aligned offset before it
+    uint64_t GetReadOffset(const Piece& piece) const
+    {
+        return m_Options.direct ? piece.offset & ~(Alignment - 1) : piece.offset;
+    }
+
+    // Bytes read for the piece, direct reads round the end up to the alignment
+    uint64_t GetReadSize(const Piece& piece) const
+    {
+        if (!m_Options.direct) return piece.size;
+        uint64_t end = (piece.offset + piece.size + Alignment - 1) & ~(Alignment - 1);
+        return end - GetReadOffset(piece);
+    }
+
+    // Positional read of up to size bytes, returns the bytes read or -1
+    int64_t ReadAt(uint64_t offset, uint8_t* buffer, uint64_t size) const
+    {
+#ifdef _WIN32
+        OVERLAPPED overlapped = {};
+        overlapped.Offset = static_cast<DWORD>(offset);
+        overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD count = 0;
+        if (!ReadFile(m_File, buffer, static_cast<DWORD>(size), &count, &overlapped))
+            return (GetLastError() == ERROR_HANDLE_EOF) ? 0 : -1;
+        return count;
+#else
+        ssize_t count;
+        do {
+            count = pread(m_File, buffer, static_cast<size_t>(size), static_cast<off_t>(offset));
+        } while (count < 0 && errno == EINTR);
+        return count;
+#endif
+    }
+
+    // Keeps the queue depth seen by every read issued, the average is taken at the end
+    void AddQueueDepth(unsigned int depth, uint64_t& sum)
+    {
+        sum += depth;
+        m_Stats.maxQueueDepth = (std::max)(m_Stats.maxQueueDepth, depth);
+    }
+
+    template <typename Complete>
+    bool RunThreads(Complete& complete)
+    {
+        unsigned int threadCount = (std::min)(m_Options.threadCount, m_Options.queueDepth);
+        std::atomic<size_t> next = 0, reads = 0;
+        std::atomic<uint64_t> bytesRead = 0, depthSum = 0;
+        std::atomic<unsigned int> inFlight = 0, maxDepth = 0;
+        std::atomic<bool> failed = false;
+
+        auto worker = [&]() {
+            AlignedBuffers buffer;
+            buffer.Allocate(1, m_Options.blockSize);
+            for (size_t p = next++; p < m_Pieces.size() && !failed; p = next++) {
+                const Piece& piece = m_Pieces[p];
+                uint64_t readOffset = GetReadOffset(piece), readSize = GetReadSize(piece);
+                uint64_t head = piece.offset - readOffset;
+
+                // Short reads are carried on from where they stopped, direct reads may stop short at the end of the file
+                uint64_t done = 0;
+                while (done < head + piece.size) {
+                    unsigned int depth = ++inFlight;
+                    depthSum += depth;
+                    for (unsigned int seen = maxDepth; depth > seen && !maxDepth.compare_exchange_weak(seen, depth);) {}
+                    int64_t count = ReadAt(readOffset + done, buffer.Get(0) + done, readSize - done);
+                    inFlight--;
+                    if (count <= 0) break;
+
+                    done += static_cast<uint64_t>(count);
+                    reads++;
+                    bytesRead += static_cast<uint64_t>(count);
+                }
+
+                if (done < head + piece.size) {
+                    failed = true;
+                    break;
+                }
+                complete(piece.tag, piece.position, std::span<const uint8_t>(buffer.Get(0) + head, static_cast<size_t>(piece.size)));
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (unsigned int t = 1; t < threadCount && t < m_Pieces.size(); t++) workers.emplace_back(worker);
+        worker();
+        for (auto& thread : workers) thread.join();
+
+        m_Stats.reads = reads;
+        m_Stats.bytesRead = bytesRead;
+        m_Stats.maxQueueDepth = maxDepth;
+        m_Stats.averageQueueDepth = (reads > 0) ? double(depthSum) / double(reads) : 0.0;
+        if (failed) std::cerr << "Read failed" << std::endl;
+        return !failed;
+    }
+
+#ifdef TOOLKIT_HAS_IO_URING
+    template <typename Complete>
+    bool RunRing(Complete& complete)
+    {
+        // One slot per read in flight, each with its own registered buffer
+        size_t slotCount = (std::min)(size_t((std::min)(m_Options.queueDepth, m_Ring.GetEntryCount())), (std::max)(m_Pieces.size(), size_t(1)));
+        AlignedBuffers buffers;
+        buffers.Allocate(slotCount, m_Options.blockSize);
+
+        std::vector<iovec> vectors(slotCount);
+        for (size_t s = 0; s < slotCount; s++) vectors[s] = { buffers.Get(s), buffers.stride };
+        bool bRegistered = m_Ring.RegisterBuffers(vectors);
+
+        struct Slot {
+            size_t piece;
+            uint64_t done;
+        };
+        std::vector<Slot> slots(slotCount);
+        std::vector<size_t> freeSlots;
+        for (size_t s = slotCount; s > 0; s--) freeSlots.push_back(s - 1);
+
+        // Queues the rest of the piece held by the slot
+        auto push = [&](size_t s) {
+            const Piece& piece = m_Pieces[slots[s].piece];
+            uint64_t done = slots[s].done;
+            m_Ring.PushRead(m_File, buffers.Get(s) + done, static_cast<uint32_t>(GetReadSize(piece) - done), GetReadOffset(piece) + done, s, bRegistered ? static_cast<int>(s) : -1);
+        };
+
+        size_t next = 0;
+        unsigned int inFlight = 0;
+        uint64_t depthSum = 0;
+        bool failed = false;
+        while ((next < m_Pieces.size() && !failed) || inFlight > 0) {
+            unsigned int queued = 0;
+            while (!failed && next < m_Pieces.size() && !freeSlots.empty()) {
+                size_t s = freeSlots.back();
+                freeSlots.pop_back();
+                slots[s] = { next++, 0 };
+                push(s);
+                queued++;
+            }
+            for (unsigned int q = 0; q < queued; q++) AddQueueDepth(inFlight + q + 1, depthSum);
+            inFlight += queued;
+            m_Stats.reads += queued;
+
+            if (!m_Ring.Submit(1)) {
+                std::cerr << "io_uring submit failed" << std::endl;
+                if (bRegistered) m_Ring.UnregisterBuffers();
+                return false;
+            }
+
+            uint64_t userData;
+            int result;
+            while (m_Ring.PopCompletion(userData, result)) {
+                size_t s = static_cast<size_t>(userData);
+                Slot& slot = slots[s];
+                const Piece& piece = m_Pieces[slot.piece];
+                uint64_t head = piece.offset - GetReadOffset(piece);
+                inFlight--;
+
+                if (result == -EAGAIN || result == -EINTR) {
+                    push(s);
+                    AddQueueDepth(++inFlight, depthSum);
+                    m_Stats.reads++;
+                    continue;
+                }
+                if (result > 0) {
+                    slot.done += static_cast<uint64_t>(result);
+                    m_Stats.bytesRead += static_cast<uint64_t>(result);
+                }
+
+                if (slot.done >= head + piece.size) {
+                    complete(piece.tag, piece.position, std::span<const uint8_t>(buffers.Get(s) + head, static_cast<size_t>(piece.size)));
+                    freeSlots.push_back(s);
+                }
+                else if (result > 0 && !failed) {
+                    // Short read, the rest goes back in the queue
+                    push(s);
+                    AddQueueDepth(++inFlight, depthSum);
+                    m_Stats.reads++;
+                }
+                else {
+                    failed = true;
+                    freeSlots.push_back(s);
+                }
+            }
+        }
+
+        if (bRegistered) m_Ring.UnregisterBuffers();
+        m_Stats.averageQueueDepth = (m_Stats.reads > 0) ? double(depthSum) / double(m_Stats.reads) : 0.0;
+        if (failed) std::cerr << "Read failed" << std::endl;
+        return !failed;
+    }
+#endif
+};
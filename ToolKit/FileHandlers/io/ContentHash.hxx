@@ -0,0 +1,164 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+// 64 bit content hash, the XXH64 algorithm. Input is consumed 32 bytes at a time by
+// four independent lanes, so the multiply chains overlap and the loop runs near
+// memory speed over mapped data
+class ContentHash
+{
+public:
+    static uint64_t Hash(std::span<const uint8_t> data, uint64_t seed = 0)
+    {
+        const uint8_t* p = data.data();
+        const uint8_t* end = p + data.size();
+        uint64_t hash;
+
+        if (data.size() >= 32) {
+            uint64_t lanes[4];
+            InitLanes(lanes, seed);
+
+            const uint8_t* limit = end - 32;
+            do {
+                Consume(lanes, p);
+                p += 32;
+            } while (p <= limit);
+            hash = Converge(lanes);
+        }
+        else {
+            hash = seed + Prime5;
+        }
+
+        return Finish(hash + data.size(), p, end);
+    }
+
+    // Same hash over data arriving in pieces, so large files never have to be in memory at once
+    class Stream
+    {
+    public:
+        explicit Stream(uint64_t seed = 0) : m_Seed(seed) { InitLanes(m_Lanes, seed); }
+
+        void Update(std::span<const uint8_t> data)
+        {
+            const uint8_t* p = data.data();
+            const uint8_t* end = p + data.size();
+            m_Total += data.size();
+
+            if (m_BufferSize + data.size() < 32) {
+                memcpy(m_Buffer + m_BufferSize, p, data.size());
+                m_BufferSize += data.size();
+                return;
+            }
+            if (m_BufferSize > 0) {
+                size_t fill = 32 - m_BufferSize;
+                memcpy(m_Buffer + m_BufferSize, p, fill);
+                Consume(m_Lanes, m_Buffer);
+                p += fill;
+                m_BufferSize = 0;
+            }
+            for (; end - p >= 32; p += 32) Consume(m_Lanes, p);
+
+            m_BufferSize = static_cast<size_t>(end - p);
+            memcpy(m_Buffer, p, m_BufferSize);
+        }
+
+        uint64_t Digest() const
+        {
+            uint64_t hash = (m_Total >= 32) ? Converge(m_Lanes) : m_Seed + Prime5;
+            return Finish(hash + m_Total, m_Buffer, m_Buffer + m_BufferSize);
+        }
+
+    private:
+        uint64_t m_Seed;
+        uint64_t m_Lanes[4];
+        uint64_t m_Total = 0;
+        uint8_t m_Buffer[32] = {};
+        size_t m_BufferSize = 0;
+    };
+
+private:
+    static constexpr uint64_t Prime1 = 0x9E3779B185EBCA87ull;
+    static constexpr uint64_t Prime2 = 0xC2B2AE3D27D4EB4Full;
+    static constexpr uint64_t Prime3 = 0x165667B19E3779F9ull;
+    static constexpr uint64_t Prime4 = 0x85EBCA77C2B2AE63ull;
+    static constexpr uint64_t Prime5 = 0x27D4EB2F165667C5ull;
+
+    static uint64_t Rotate(uint64_t value, int bits) { return (value << bits) | (value >> (64 - bits)); }
+
+    static uint64_t Read64(const uint8_t* p)
+    {
+        uint64_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    static uint32_t Read32(const uint8_t* p)
+    {
+        uint32_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    static uint64_t Round(uint64_t lane, uint64_t input)
+    {
+        lane += input * Prime2;
+        lane = Rotate(lane, 31);
+        return lane * Prime1;
+    }
+
+    static uint64_t Merge(uint64_t hash, uint64_t lane)
+    {
+        hash ^= Round(0, lane);
+        return hash * Prime1 + Prime4;
+    }
+
+    static void InitLanes(uint64_t lanes[4], uint64_t seed)
+    {
+        lanes[0] = seed + Prime1 + Prime2;
+        lanes[1] = seed + Prime2;
+        lanes[2] = seed;
+        lanes[3] = seed - Prime1;
+    }
+
+    static void Consume(uint64_t lanes[4], const uint8_t* p)
+    {
+        lanes[0] = Round(lanes[0], Read64(p));
+        lanes[1] = Round(lanes[1], Read64(p + 8));
+        lanes[2] = Round(lanes[2], Read64(p + 16));
+        lanes[3] = Round(lanes[3], Read64(p + 24));
+    }
+
+    static uint64_t Converge(const uint64_t lanes[4])
+    {
+        uint64_t hash = Rotate(lanes[0], 1) + Rotate(lanes[1], 7) + Rotate(lanes[2], 12) + Rotate(lanes[3], 18);
+        for (int i = 0; i < 4; i++) hash = Merge(hash, lanes[i]);
+        return hash;
+    }
+
+    // Mixes in the bytes left over from the lanes and avalanches the result
+    static uint64_t Finish(uint64_t hash, const uint8_t* p, const uint8_t* end)
+    {
+        for (; p + 8 <= end; p += 8) {
+            hash ^= Round(0, Read64(p));
+            hash = Rotate(hash, 27) * Prime1 + Prime4;
+        }
+        if (p + 4 <= end) {
+            hash ^= uint64_t(Read32(p)) * Prime1;
+            hash = Rotate(hash, 23) * Prime2 + Prime3;
+            p += 4;
+        }
+        for (; p < end; p++) {
+            hash ^= uint64_t(*p) * Prime5;
+            hash = Rotate(hash, 11) * Prime1;
+        }
+
+        hash ^= hash >> 33;
+        hash *= Prime2;
+        hash ^= hash >> 29;
+        hash *= Prime3;
+        hash ^= hash >> 32;
+        return hash;
+    }
+};
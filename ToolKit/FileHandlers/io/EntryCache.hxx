@@ -0,0 +1,248 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <list>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "FileView.hxx"
+
+// Copies of file views kept under a byte budget, the least recently used go first. Views
+// can be prefetched by background workers, so the pages get read from disc off the UI
+// thread and the copy is ready once the view is asked for. Copies are tied to the mapping
+// they came from and are dropped once it is closed
+class EntryCache
+{
+public:
+    using Bytes = std::shared_ptr<const std::vector<uint8_t>>;
+
+    // Run by the worker before a view is read, for views over memory filled on demand
+    using Prepare = std::function<void(const FileView&)>;
+
+    struct Stats {
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t prefetched = 0;
+        size_t evicted = 0;
+    };
+
+    explicit EntryCache(uint64_t budget = 256 * 1024 * 1024, unsigned int threadCount = 1)
+        : m_Budget(budget), m_ThreadCount((threadCount > 0) ? threadCount : 1) {}
+
+    ~EntryCache()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_bStop = true;
+            m_Pending.clear();
+        }
+        m_PendingChanged.notify_all();
+        for (auto& thread : m_Workers) thread.join();
+    }
+
+    EntryCache(const EntryCache&) = delete;
+    EntryCache& operator=(const EntryCache&) = delete;
+
+    // Bytes kept at most, a view larger than an eighth of it is never copied
+    void SetBudget(uint64_t budget)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Budget = budget;
+        Trim();
+    }
+
+    uint64_t GetBudget() const { return m_Budget; }
+
+    uint64_t GetUsage() const
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return m_Usage;
+    }
+
+    Stats GetStats() const
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return m_Stats;
+    }
+
+    // Copy of the view, read now unless cached. Null for views too large to keep, which are
+    // meant to be used straight from the mapping
+    Bytes Load(const FileView& view)
+    {
+        if (!view.IsOpen() || !IsCacheable(view.Size())) return nullptr;
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            Bytes bytes = Find(view);
+            if (bytes) {
+                m_Stats.hits++;
+                return bytes;
+            }
+            m_Stats.misses++;
+        }
+
+        Bytes bytes = Read(view);
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        Insert(view, bytes);
+        return bytes;
+    }
+
+    // Reads the views in the background in the given order, replacing the views still waiting.
+    // Views of a packed archive come with the loader unpacking them, so that happens on the workers too
+    void Prefetch(std::vector<FileView> views, Prepare prepare = nullptr)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_Pending.assign(std::make_move_iterator(views.begin()), std::make_move_iterator(views.end()));
+            m_Prepare = std::move(prepare);
+            while (m_Workers.size() < m_ThreadCount) m_Workers.emplace_back(&EntryCache::Worker, this);
+        }
+        m_PendingChanged.notify_all();
+    }
+
+    // Drops every copy and the views waiting to be prefetched. Waits for the reads in progress, so
+    // no worker holds on to a mapping once it returns and the files can be written to
+    void Clear()
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        m_Pending.clear();
+        m_Prepare = nullptr;
+        m_Generation++;
+        m_Idle.wait(lock, [this]() { return m_InFlight == 0; });
+        m_Entries.clear();
+        m_Order.clear();
+        m_Usage = 0;
+    }
+
+private:
+    // Views are told apart by their mapping and range in it
+    struct Key {
+        const MappedFile* file;
+        uint64_t offset;
+        uint64_t size;
+
+        bool operator==(const Key& other) const { return file == other.file && offset == other.offset && size == other.size; }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const
+        {
+            uint64_t hash = reinterpret_cast<uintptr_t>(key.file) * 0x9E3779B97F4A7C15ull;
+            hash ^= (key.offset + 0x9E3779B97F4A7C15ull + (hash << 6) + (hash >> 2));
+            hash ^= (key.size + 0x9E3779B97F4A7C15ull + (hash << 6) + (hash >> 2));
+            return static_cast<size_t>(hash);
+        }
+    };
+
+    // A new mapping may reuse the address of a closed one, the weak pointer tells them apart
+    struct Entry {
+        std::weak_ptr<const MappedFile> file;
+        Bytes bytes;
+        std::list<Key>::iterator order;
+    };
+
+    mutable std::mutex m_Mutex;
+    std::condition_variable m_PendingChanged;
+    std::condition_variable m_Idle;
+    std::unordered_map<Key, Entry, KeyHash> m_Entries;
+    std::list<Key> m_Order;
+    std::deque<FileView> m_Pending;
+    Prepare m_Prepare;
+    std::vector<std::thread> m_Workers;
+    uint64_t m_Budget;
+    uint64_t m_Usage = 0;
+    unsigned int m_ThreadCount;
+    unsigned int m_InFlight = 0;
+    uint64_t m_Generation = 0;
+    bool m_bStop = false;
+    Stats m_Stats;
+
+    static Key GetKey(const FileView& view) { return { &view.GetFile(), view.GetFileOffset(), view.Size() }; }
+
+    bool IsCacheable(uint64_t size) const { return size <= m_Budget / 8; }
+
+    static Bytes Read(const FileView& view)
+    {
+        view.Prefetch();
+        return std::make_shared<const std::vector<uint8_t>>(view.GetSpan().begin(), view.GetSpan().end());
+    }
+
+    // Cached copy made most recently used, stale copies of a closed mapping are dropped on the way
+    Bytes Find(const FileView& view)
+    {
+        auto it = m_Entries.find(GetKey(view));
+        if (it == m_Entries.end()) return nullptr;
+        if (it->second.file.lock() != view.GetSharedFile()) {
+            Erase(it);
+            return nullptr;
+        }
+        m_Order.splice(m_Order.begin(), m_Order, it->second.order);
+        return it->second.bytes;
+    }
+
+    void Insert(const FileView& view, const Bytes& bytes)
+    {
+        Key key = GetKey(view);
+        auto it = m_Entries.find(key);
+        if (it != m_Entries.end()) Erase(it);
+
+        m_Order.push_front(key);
+        m_Entries.emplace(key, Entry{ view.GetSharedFile(), bytes, m_Order.begin() });
+        m_Usage += bytes->size();
+        Trim();
+    }
+
+    void Erase(std::unordered_map<Key, Entry, KeyHash>::iterator it)
+    {
+        m_Usage -= it->second.bytes->size();
+        m_Order.erase(it->second.order);
+        m_Entries.erase(it);
+    }
+
+    // Evicts from the least recently used end until the copies fit the budget
+    void Trim()
+    {
+        while (m_Usage > m_Budget && !m_Order.empty()) {
+            Erase(m_Entries.find(m_Order.back()));
+            m_Stats.evicted++;
+        }
+    }
+
+    void Worker()
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        while (true) {
+            m_PendingChanged.wait(lock, [this]() { return m_bStop || !m_Pending.empty(); });
+            if (m_bStop) return;
+
+            FileView view = std::move(m_Pending.front());
+            m_Pending.pop_front();
+            if (!view.IsOpen() || Find(view)) continue;
+
+            // Views too large to keep are only read ahead into the page cache. Copies read while the
+            // cache got cleared are dropped, the view goes before Clear is let go
+            bool cacheable = IsCacheable(view.Size());
+            uint64_t generation = m_Generation;
+            Prepare prepare = m_Prepare;
+            m_InFlight++;
+            lock.unlock();
+            if (prepare) prepare(view);
+            Bytes bytes;
+            if (cacheable) bytes = Read(view);
+            else view.Prefetch();
+            lock.lock();
+
+            if (bytes && generation == m_Generation) Insert(view, bytes);
+            m_Stats.prefetched++;
+            view.Close();
+            prepare = nullptr;
+            if (--m_InFlight == 0) m_Idle.notify_all();
+        }
+    }
+};
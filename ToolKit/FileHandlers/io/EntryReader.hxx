@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <algorithm>
+
+#include "FileView.hxx"
+#include "ContentHash.hxx"
+
+// Sequential reader over a view of any size with 64 bit positions. Data is handed out in
+// chunks of a fixed size straight from the mapping, the chunk after the current one is read
+// ahead and the pages of the ones consumed are dropped again, so walking a file of several
+// gigabytes keeps the memory of the process at a couple of chunks
+class EntryReader
+{
+public:
+    static constexpr uint32_t DefaultChunkSize = 1024 * 1024;
+
+    explicit EntryReader(const FileView& view, uint32_t chunkSize = DefaultChunkSize)
+        : m_File(view.GetSharedFile()), m_FileOffset(view.GetFileOffset()), m_Data(view.GetSpan()), m_ChunkSize((chunkSize > 0) ? chunkSize : 1) {}
+
+    // Reads bytes already in memory, nothing to read ahead or drop
+    explicit EntryReader(std::span<const uint8_t> data, uint32_t chunkSize = DefaultChunkSize)
+        : m_Data(data), m_ChunkSize((chunkSize > 0) ? chunkSize : 1) {}
+
+    uint64_t GetSize() const { return m_Data.size(); }
+
+    uint64_t GetPosition() const { return m_Position; }
+
+    bool IsEnd() const { return m_Position >= m_Data.size(); }
+
+    // Moves to the position, false when it is past the end
+    bool Seek(uint64_t position)
+    {
+        if (position > m_Data.size()) return false;
+        m_Position = position;
+        m_Released = position / m_ChunkSize * m_ChunkSize;
+        return true;
+    }
+
+    // Copies up to size bytes from the position and moves past them, returns the bytes copied
+    size_t Read(void* buffer, size_t size)
+    {
+        size_t copied = 0;
+        while (copied < size && !IsEnd()) {
+            auto chunk = Next(size - copied);
+            memcpy(static_cast<uint8_t*>(buffer) + copied, chunk.data(), chunk.size());
+            copied += chunk.size();
+        }
+        return copied;
+    }
+
+    // Data from the position up to the next chunk boundary or the limit and moves past it, empty at the end
+    std::span<const uint8_t> Next(uint64_t limit = UINT64_MAX)
+    {
+        if (IsEnd()) return {};
+        uint64_t end = (std::min)((m_Position / m_ChunkSize + 1) * m_ChunkSize, m_Position + (std::min)(limit, m_Data.size() - m_Position));
+        auto chunk = m_Data.subspan(static_cast<size_t>(m_Position), static_cast<size_t>(end - m_Position));
+
+        // The following chunk is asked for while this one gets used, chunks left behind are dropped
+        if (m_File) {
+            if (end % m_ChunkSize == 0 && end < m_Data.size()) m_File->Prefetch(m_FileOffset + end, m_ChunkSize);
+            uint64_t consumed = m_Position / m_ChunkSize * m_ChunkSize;
+            if (consumed > m_Released) {
+                m_File->Release(m_FileOffset + m_Released, consumed - m_Released);
+                m_Released = consumed;
+            }
+        }
+
+        m_Position = end;
+        return chunk;
+    }
+
+    // Hands every chunk from the position on to the consumer with its position, until the consumer
+    // returns false. Returns false when it stopped early
+    template <typename Consumer>
+    bool ForEachChunk(Consumer consumer)
+    {
+        while (!IsEnd()) {
+            uint64_t position = m_Position;
+            if (!consumer(Next(), position)) return false;
+        }
+        return true;
+    }
+
+    // Content hash of the data from the position on, the same as hashing it in one piece
+    uint64_t Hash(uint64_t seed = 0)
+    {
+        ContentHash::Stream stream(seed);
+        ForEachChunk([&stream](std::span<const uint8_t> chunk, uint64_t) {
+            stream.Update(chunk);
+            return true;
+            });
+        return stream.Digest();
+    }
+
+private:
+    std::shared_ptr<const MappedFile> m_File;
+    uint64_t m_FileOffset = 0;
+    std::span<const uint8_t> m_Data;
+    uint64_t m_Position = 0;
+    uint64_t m_Released = 0;
+    uint32_t m_ChunkSize;
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <span>
+
+#include "MappedFile.hxx"
+
+// Bounded window over a file mapped from disc. Files embedded in an archive are opened
+// as sub views of the archive view, all of them share the one mapping however deep they
+// are nested. Offsets given to a view are always relative to the start of that view
+class FileView
+{
+public:
+    FileView() {}
+
+    // Maps the whole file at the given path
+    bool Open(const std::string& filePath)
+    {
+        Close();
+
+        auto file = std::make_shared<MappedFile>();
+        if (!file->Open(filePath)) return false;
+
+        m_File = std::move(file);
+        m_Data = m_File->GetSpan();
+        return true;
+    }
+
+    // Views the whole of a file opened or allocated elsewhere
+    bool Open(std::shared_ptr<const MappedFile> file)
+    {
+        Close();
+        if (!file || !file->IsOpen()) return false;
+
+        m_File = std::move(file);
+        m_Data = m_File->GetSpan();
+        return true;
+    }
+
+    void Close()
+    {
+        m_File.reset();
+        m_Data = {};
+        m_Offset = 0;
+    }
+
+    bool IsOpen() const { return m_File != nullptr; }
+
+    // Window into this view, closed view when the range is out of it
+    FileView GetSubView(uint64_t offset, uint64_t size) const
+    {
+        FileView view;
+        if (!m_File || offset > m_Data.size() || size > m_Data.size() - offset) return view;
+
+        view.m_File = m_File;
+        view.m_Data = m_Data.subspan(static_cast<size_t>(offset), static_cast<size_t>(size));
+        view.m_Offset = m_Offset + offset;
+        return view;
+    }
+
+    // Window from offset up to the end of this view
+    FileView GetSubView(uint64_t offset) const
+    {
+        return GetSubView(offset, (offset < m_Data.size()) ? m_Data.size() - offset : 0);
+    }
+
+    const uint8_t* Data() const { return m_Data.data(); }
+
+    uint64_t Size() const { return m_Data.size(); }
+
+    std::span<const uint8_t> GetSpan() const { return m_Data; }
+
+    // Bounded range of the view, empty when the range is out of it
+    std::span<const uint8_t> GetSpan(uint64_t offset, uint64_t size) const
+    {
+        if (offset > m_Data.size() || size > m_Data.size() - offset) return {};
+        return m_Data.subspan(static_cast<size_t>(offset), static_cast<size_t>(size));
+    }
+
+    // Position of the view in the file on disc
+    uint64_t GetFileOffset() const { return m_Offset; }
+
+    // True when the view covers its whole file on disc
+    bool IsWholeFile() const { return m_File && m_Offset == 0 && m_Data.size() == m_File->Size(); }
+
+    // Mapped file on disc the view belongs to
+    const MappedFile& GetFile() const { return *m_File; }
+
+    // Shared mapping, for holders that must not keep it alive or have to outlive the view
+    const std::shared_ptr<const MappedFile>& GetSharedFile() const { return m_File; }
+
+    const std::string& GetFilePath() const { return m_File->GetFilePath(); }
+
+    // Hints the OS to read the view in ahead of use
+    void Prefetch() const
+    {
+        if (m_File) m_File->Prefetch(m_Offset, m_Data.size());
+    }
+
+private:
+    std::shared_ptr<const MappedFile> m_File;
+    std::span<const uint8_t> m_Data;
+    uint64_t m_Offset = 0;
+};
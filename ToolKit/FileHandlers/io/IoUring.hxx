@@ -0,0 +1,178 @@
+#pragma once
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define TOOLKIT_HAS_IO_URING 1
+
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <vector>
+#include <algorithm>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Minimal io_uring submission and completion rings over the raw system calls, only what
+// positional reads into registered buffers need. Kernels or sandboxes without io_uring
+// fail Init and callers fall back to plain reads
+class IoUring
+{
+public:
+    IoUring() {}
+    ~IoUring() { Close(); }
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    // Sets up rings holding at least the given number of reads in flight
+    bool Init(unsigned int depth)
+    {
+        Close();
+
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        m_Ring = static_cast<int>(syscall(__NR_io_uring_setup, depth, &params));
+        if (m_Ring < 0) return false;
+
+        size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (singleMap) sqSize = cqSize = (std::max)(sqSize, cqSize);
+
+        m_SqMap = Map(sqSize, IORING_OFF_SQ_RING);
+        m_CqMap = singleMap ? m_SqMap : Map(cqSize, IORING_OFF_CQ_RING);
+        m_SqeMap = Map(params.sq_entries * sizeof(io_uring_sqe), IORING_OFF_SQES);
+        m_SqMapSize = sqSize;
+        m_CqMapSize = singleMap ? 0 : cqSize;
+        m_SqeMapSize = params.sq_entries * sizeof(io_uring_sqe);
+        if (m_SqMap == nullptr || m_CqMap == nullptr || m_SqeMap == nullptr) {
+            Close();
+            return false;
+        }
+
+        uint8_t* sq = static_cast<uint8_t*>(m_SqMap);
+        m_SqHead = reinterpret_cast<uint32_t*>(sq + params.sq_off.head);
+        m_SqTail = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+        m_SqMask = *reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+        m_SqArray = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+        m_Sqes = static_cast<io_uring_sqe*>(m_SqeMap);
+
+        uint8_t* cq = static_cast<uint8_t*>(m_CqMap);
+        m_CqHead = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+        m_CqTail = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+        m_CqMask = *reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+        m_Cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        m_Entries = params.sq_entries;
+        m_Queued = 0;
+        return true;
+    }
+
+    void Close()
+    {
+        if (m_SqeMap) munmap(m_SqeMap, m_SqeMapSize);
+        if (m_CqMap && m_CqMap != m_SqMap) munmap(m_CqMap, m_CqMapSize);
+        if (m_SqMap) munmap(m_SqMap, m_SqMapSize);
+        if (m_Ring >= 0) close(m_Ring);
+        m_SqMap = m_CqMap = m_SqeMap = nullptr;
+        m_Ring = -1;
+    }
+
+    bool IsOpen() const { return m_Ring >= 0; }
+
+    unsigned int GetEntryCount() const { return m_Entries; }
+
+    // Pins the buffers in the kernel once, reads into them skip mapping the pages on every call
+    bool RegisterBuffers(const std::vector<iovec>& buffers)
+    {
+        return syscall(__NR_io_uring_register, m_Ring, IORING_REGISTER_BUFFERS, buffers.data(), static_cast<unsigned int>(buffers.size())) == 0;
+    }
+
+    void UnregisterBuffers()
+    {
+        syscall(__NR_io_uring_register, m_Ring, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+    }
+
+    // Queues a read, into a registered buffer when bufferIndex isn't negative. False when the ring is full
+    bool PushRead(int file, void* buffer, uint32_t size, uint64_t offset, uint64_t userData, int bufferIndex = -1)
+    {
+        uint32_t tail = *m_SqTail + m_Queued;
+        if (tail - __atomic_load_n(m_SqHead, __ATOMIC_ACQUIRE) >= m_Entries) return false;
+
+        uint32_t index = tail & m_SqMask;
+        io_uring_sqe& sqe = m_Sqes[index];
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = (bufferIndex >= 0) ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe.fd = file;
+        sqe.addr = reinterpret_cast<uint64_t>(buffer);
+        sqe.len = size;
+        sqe.off = offset;
+        sqe.user_data = userData;
+        if (bufferIndex >= 0) sqe.buf_index = static_cast<uint16_t>(bufferIndex);
+        m_SqArray[index] = index;
+        m_Queued++;
+        return true;
+    }
+
+    // Hands the queued reads to the kernel and waits for at least waitCount completions
+    bool Submit(unsigned int waitCount)
+    {
+        __atomic_store_n(m_SqTail, *m_SqTail + m_Queued, __ATOMIC_RELEASE);
+        unsigned int toSubmit = m_Queued;
+        m_Queued = 0;
+
+        while (true) {
+            long result = syscall(__NR_io_uring_enter, m_Ring, toSubmit, waitCount, waitCount > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+            if (result >= 0) return true;
+            if (errno != EINTR) return false;
+            toSubmit = 0;
+        }
+    }
+
+    // Takes the next completion, false when there is none
+    bool PopCompletion(uint64_t& userData, int& result)
+    {
+        uint32_t head = *m_CqHead;
+        if (head == __atomic_load_n(m_CqTail, __ATOMIC_ACQUIRE)) return false;
+
+        const io_uring_cqe& cqe = m_Cqes[head & m_CqMask];
+        userData = cqe.user_data;
+        result = cqe.res;
+        __atomic_store_n(m_CqHead, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+private:
+    int m_Ring = -1;
+    void* m_SqMap = nullptr;
+    void* m_CqMap = nullptr;
+    void* m_SqeMap = nullptr;
+    size_t m_SqMapSize = 0;
+    size_t m_CqMapSize = 0;
+    size_t m_SqeMapSize = 0;
+
+    uint32_t* m_SqHead = nullptr;
+    uint32_t* m_SqTail = nullptr;
+    uint32_t* m_SqArray = nullptr;
+    uint32_t m_SqMask = 0;
+    io_uring_sqe* m_Sqes = nullptr;
+
+    uint32_t* m_CqHead = nullptr;
+    uint32_t* m_CqTail = nullptr;
+    uint32_t m_CqMask = 0;
+    io_uring_cqe* m_Cqes = nullptr;
+
+    unsigned int m_Entries = 0;
+    unsigned int m_Queued = 0;
+
+    void* Map(size_t size, off_t offset)
+    {
+        void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_Ring, offset);
+        return (data != MAP_FAILED) ? data : nullptr;
+    }
+};
+
+#endif
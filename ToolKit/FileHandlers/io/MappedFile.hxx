@@ -0,0 +1,270 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <span>
+#include <memory>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only memory mapping of a whole file from disc, files that can't be mapped
+// are read into memory with a single read instead
+class MappedFile
+{
+public:
+    MappedFile() {}
+    ~MappedFile() { Close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Maps the file at the given path, previously mapped file gets released
+    bool Open(const std::string& filePath)
+    {
+        Close();
+
+#ifdef _WIN32
+        m_File = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+        if (m_File == INVALID_HANDLE_VALUE) return false;
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(m_File, &fileSize)) {
+            Close();
+            return false;
+        }
+        m_Size = static_cast<uint64_t>(fileSize.QuadPart);
+
+        // Empty files can't be mapped, keep them open with an empty view
+        if (m_Size > 0) {
+            m_Mapping = CreateFileMappingA(m_File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (m_Mapping != nullptr)
+                m_Data = static_cast<const uint8_t*>(MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0));
+
+            if (m_Data == nullptr && !ReadWhole()) {
+                Close();
+                return false;
+            }
+        }
+#else
+        m_File = open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+        if (m_File < 0) return false;
+
+        struct stat fileStat;
+        if (fstat(m_File, &fileStat) != 0) {
+            Close();
+            return false;
+        }
+        m_Size = static_cast<uint64_t>(fileStat.st_size);
+
+        // Empty files can't be mapped, keep them open with an empty view
+        if (m_Size > 0) {
+            void* data = mmap(nullptr, m_Size, PROT_READ, MAP_SHARED, m_File, 0);
+            if (data != MAP_FAILED)
+                m_Data = static_cast<const uint8_t*>(data);
+            else if (!ReadWhole()) {
+                Close();
+                return false;
+            }
+        }
+#endif
+
+        m_FilePath = filePath;
+        m_bOpen = true;
+        return true;
+    }
+
+    // Zeroed memory standing in for a file, for contents unpacked in the process, filePath is only
+    // used for naming. On Windows the whole size is committed up front and counts against the commit
+    // limit at once, physical pages are only taken once touched. Elsewhere the mapping is lazy on both
+    // counts, subject to the overcommit settings of the system
+    bool Allocate(uint64_t size, const std::string& filePath)
+    {
+        Close();
+
+        if (size > 0) {
+#ifdef _WIN32
+            void* data = VirtualAlloc(nullptr, static_cast<SIZE_T>(size), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+            if (data == nullptr) return false;
+#else
+            void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (data == MAP_FAILED) return false;
+#endif
+            m_Data = static_cast<const uint8_t*>(data);
+        }
+
+        m_Size = size;
+        m_FilePath = filePath;
+        m_bAllocated = true;
+        m_bOpen = true;
+        return true;
+    }
+
+    void Close()
+    {
+#ifdef _WIN32
+        if (m_Data && m_bAllocated) VirtualFree(const_cast<uint8_t*>(m_Data), 0, MEM_RELEASE);
+        else if (m_Data && !m_Buffer) UnmapViewOfFile(m_Data);
+        if (m_Mapping) CloseHandle(m_Mapping);
+        if (m_File != INVALID_HANDLE_VALUE) CloseHandle(m_File);
+        m_Mapping = nullptr;
+        m_File = INVALID_HANDLE_VALUE;
+#else
+        if (m_Data && (m_bAllocated || !m_Buffer)) munmap(const_cast<uint8_t*>(m_Data), m_Size);
+        if (m_File >= 0) close(m_File);
+        m_File = -1;
+#endif
+        m_Buffer.reset();
+        m_Data = nullptr;
+        m_Size = 0;
+        m_bOpen = false;
+        m_bAllocated = false;
+        m_FilePath.clear();
+    }
+
+    bool IsOpen() const { return m_bOpen; }
+
+    // False when the file couldn't be mapped and got read into memory
+    bool IsMapped() const { return m_Data != nullptr && !m_Buffer && !m_bAllocated; }
+
+    const uint8_t* Data() const { return m_Data; }
+
+    // Writable bytes of allocated memory, null for files from disc
+    uint8_t* GetMutableData() { return m_bAllocated ? const_cast<uint8_t*>(m_Data) : nullptr; }
+
+    uint64_t Size() const { return m_Size; }
+
+    const std::string& GetFilePath() const { return m_FilePath; }
+
+#ifdef _WIN32
+    HANDLE GetNativeHandle() const { return m_File; }
+#else
+    int GetNativeHandle() const { return m_File; }
+#endif
+
+    // Reads the range into the buffer with positional reads, safe to call from several threads at once
+    bool ReadAt(uint64_t offset, void* buffer, uint64_t size) const
+    {
+        if (offset > m_Size || size > m_Size - offset) return false;
+
+        // Allocated memory has no file behind it
+        if (m_bAllocated) {
+            if (size > 0) memcpy(buffer, m_Data + offset, static_cast<size_t>(size));
+            return true;
+        }
+
+        uint64_t done = 0;
+        while (done < size) {
+#ifdef _WIN32
+            OVERLAPPED overlapped = {};
+            overlapped.Offset = static_cast<DWORD>(offset + done);
+            overlapped.OffsetHigh = static_cast<DWORD>((offset + done) >> 32);
+            DWORD count = 0;
+            DWORD request = static_cast<DWORD>((std::min)(size - done, uint64_t(0x40000000)));
+            if (!ReadFile(m_File, static_cast<uint8_t*>(buffer) + done, request, &count, &overlapped) || count == 0) return false;
+#else
+            ssize_t count = pread(m_File, static_cast<uint8_t*>(buffer) + done, static_cast<size_t>(size - done), static_cast<off_t>(offset + done));
+            if (count <= 0) return false;
+#endif
+            done += static_cast<uint64_t>(count);
+        }
+        return true;
+    }
+
+    // Asks the OS to read the range in ahead of use, only a hint and ignored for files read into memory
+    void Prefetch(uint64_t offset, uint64_t size) const
+    {
+        if (!IsMapped() || offset >= m_Size || size == 0) return;
+        size = (std::min)(size, m_Size - offset);
+#ifdef _WIN32
+        WIN32_MEMORY_RANGE_ENTRY range = { const_cast<uint8_t*>(m_Data + offset), static_cast<SIZE_T>(size) };
+        PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+        uintptr_t pageMask = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE)) - 1;
+        uintptr_t start = reinterpret_cast<uintptr_t>(m_Data + offset) & ~pageMask;
+        uintptr_t end = reinterpret_cast<uintptr_t>(m_Data + offset + size);
+        madvise(reinterpret_cast<void*>(start), end - start, MADV_WILLNEED);
+#endif
+    }
+
+    // Drops the pages of the range from the process once read, the OS keeps them cached for other readers
+    void Release(uint64_t offset, uint64_t size) const
+    {
+        if (!IsMapped() || offset >= m_Size || size == 0) return;
+        size = (std::min)(size, m_Size - offset);
+#ifdef _WIN32
+        // Unlocking pages that aren't locked takes them out of the working set
+        VirtualUnlock(const_cast<uint8_t*>(m_Data + offset), static_cast<SIZE_T>(size));
+#else
+        // Only whole pages inside the range, the ones at the edges may still be in use
+        uintptr_t pageMask = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE)) - 1;
+        uintptr_t start = (reinterpret_cast<uintptr_t>(m_Data + offset) + pageMask) & ~pageMask;
+        uintptr_t end = reinterpret_cast<uintptr_t>(m_Data + offset + size) & ~pageMask;
+        if (end > start) madvise(reinterpret_cast<void*>(start), end - start, MADV_DONTNEED);
+#endif
+    }
+
+    // Whole mapped file
+    std::span<const uint8_t> GetSpan() const { return { m_Data, static_cast<size_t>(m_Size) }; }
+
+    // Bounded window into the mapped file, empty when the range is out of the file
+    std::span<const uint8_t> GetSpan(uint64_t offset, uint64_t size) const
+    {
+        if (offset > m_Size || size > m_Size - offset) return {};
+        return { m_Data + offset, static_cast<size_t>(size) };
+    }
+
+private:
+    const uint8_t* m_Data = nullptr;
+    std::unique_ptr<uint8_t[]> m_Buffer;
+    uint64_t m_Size = 0;
+    bool m_bOpen = false;
+    bool m_bAllocated = false;
+    std::string m_FilePath;
+
+#ifdef _WIN32
+    HANDLE m_File = INVALID_HANDLE_VALUE;
+    HANDLE m_Mapping = nullptr;
+#else
+    int m_File = -1;
+#endif
+
+    // Reads the whole file into one buffer, the OS splits the request only when it has to
+    bool ReadWhole()
+    {
+        m_Buffer.reset(new (std::nothrow) uint8_t[static_cast<size_t>(m_Size)]);
+        if (!m_Buffer) return false;
+
+        uint64_t done = 0;
+        while (done < m_Size) {
+#ifdef _WIN32
+            LARGE_INTEGER position;
+            position.QuadPart = static_cast<LONGLONG>(done);
+            DWORD count = 0;
+            DWORD request = static_cast<DWORD>((std::min)(m_Size - done, uint64_t(0x40000000)));
+            if (!SetFilePointerEx(m_File, position, nullptr, FILE_BEGIN) ||
+                !ReadFile(m_File, m_Buffer.get() + done, request, &count, nullptr) || count == 0) break;
+#else
+            ssize_t count = pread(m_File, m_Buffer.get() + done, static_cast<size_t>(m_Size - done), static_cast<off_t>(done));
+            if (count <= 0) break;
+#endif
+            done += static_cast<uint64_t>(count);
+        }
+
+        if (done != m_Size) {
+            m_Buffer.reset();
+            return false;
+        }
+        m_Data = m_Buffer.get();
+        return true;
+    }
+};
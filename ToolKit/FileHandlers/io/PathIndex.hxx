@@ -0,0 +1,218 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <span>
+#include <string_view>
+
+// Open addressing hash index from archive paths to entry indices. Paths are
+// compared case-insensitively with '/' and '\' treated as the same separator,
+// keys are views into storage owned by the caller and must outlive the index
+class PathIndex
+{
+public:
+    static constexpr uint32_t npos = UINT32_MAX;
+
+    // Folds a path character into its normalized form
+    static char NormalizeChar(char c)
+    {
+        if (c >= 'A' && c <= 'Z') return c + ('a' - 'A');
+        if (c == '/') return '\\';
+        return c;
+    }
+
+    // Folds 8 path characters at once, A-Z gets lowered and '/' becomes '\'
+    static uint64_t NormalizeWord(uint64_t word)
+    {
+        constexpr uint64_t ones = 0x0101010101010101ull;
+        constexpr uint64_t high = 0x8080808080808080ull;
+
+        uint64_t low7 = word & ~high;
+        uint64_t upper = (low7 + (0x80 - 'A') * ones) & ~(low7 + (0x80 - 'Z' - 1) * ones) & ~word & high;
+        word |= upper >> 2;
+
+        uint64_t slash = word ^ ('/' * ones);
+        uint64_t isSlash = ~(((slash & ~high) + ~high) | slash | ~high);
+        return word ^ ((isSlash >> 7) * ('/' ^ '\\'));
+    }
+
+    // Loads up to 8 path characters, missing ones read as zero
+    static uint64_t LoadWord(const char* data, size_t size)
+    {
+        uint64_t word = 0;
+        memcpy(&word, data, (size < 8) ? size : 8);
+        return word;
+    }
+
+    // Hash of the normalized path, consumes the path a word at a time
+    static uint64_t HashPath(std::string_view path)
+    {
+        uint64_t hash = 0x9E3779B97F4A7C15ull ^ path.size();
+        for (size_t i = 0; i < path.size(); i += 8) {
+            hash ^= NormalizeWord(LoadWord(path.data() + i, path.size() - i));
+            hash *= 0xBF58476D1CE4E5B9ull;
+            hash ^= hash >> 31;
+        }
+        return hash;
+    }
+
+    static bool PathEquals(std::string_view a, std::string_view b)
+    {
+        if (a.size() != b.size()) return false;
+        for (size_t i = 0; i < a.size(); i += 8) {
+            if (NormalizeWord(LoadWord(a.data() + i, a.size() - i)) != NormalizeWord(LoadWord(b.data() + i, b.size() - i))) return false;
+        }
+        return true;
+    }
+
+    // Matches a path against a glob where '*' spans any characters and '?' a single one,
+    // compared the same way as PathEquals
+    static bool MatchGlob(std::string_view pattern, std::string_view path)
+    {
+        size_t p = 0, s = 0, starP = std::string_view::npos, starS = 0;
+        while (s < path.size()) {
+            if (p < pattern.size() && pattern[p] == '*') {
+                starP = p++;
+                starS = s;
+            }
+            else if (p < pattern.size() && (pattern[p] == '?' || NormalizeChar(pattern[p]) == NormalizeChar(path[s]))) {
+                p++;
+                s++;
+            }
+            else if (starP != std::string_view::npos) {
+                p = starP + 1;
+                s = ++starS;
+            }
+            else {
+                return false;
+            }
+        }
+        while (p < pattern.size() && pattern[p] == '*') p++;
+        return p == pattern.size();
+    }
+
+    void Clear()
+    {
+        m_Slots.clear();
+        m_Count = 0;
+    }
+
+    // Sizes the table for the given amount of paths so building never rehashes
+    void Reserve(size_t count)
+    {
+        size_t capacity = 16;
+        while (capacity < count * 2) capacity <<= 1;
+        if (capacity > m_Slots.size()) Rehash(capacity);
+    }
+
+    // Adds a path, the first value inserted for a path wins
+    bool Insert(std::string_view path, uint32_t value)
+    {
+        if ((m_Count + 1) * 2 > m_Slots.size()) Rehash(m_Slots.empty() ? 16 : m_Slots.size() * 2);
+        return InsertHashed(HashPath(path), path, value);
+    }
+
+    // Replaces the value of an existing path or adds it
+    void Assign(std::string_view path, uint32_t value)
+    {
+        uint64_t hash = HashPath(path);
+        size_t slot = FindSlot(hash, path);
+        if (slot != SIZE_MAX) {
+            m_Slots[slot].value = value;
+            return;
+        }
+        if ((m_Count + 1) * 2 > m_Slots.size()) Rehash(m_Slots.empty() ? 16 : m_Slots.size() * 2);
+        InsertHashed(hash, path, value);
+    }
+
+    uint32_t Find(std::string_view path) const
+    {
+        size_t slot = FindSlot(HashPath(path), path);
+        return (slot != SIZE_MAX) ? m_Slots[slot].value : npos;
+    }
+
+    size_t Size() const { return m_Count; }
+
+    // Slot as saved to disc, the key is left out and restored through the value
+    struct SavedSlot {
+        uint64_t hash;
+        uint32_t value;
+        uint32_t reserved;
+    };
+
+    // Slot table without the keys, saved next to the storage the keys point into
+    std::vector<SavedSlot> Save() const
+    {
+        std::vector<SavedSlot> slots(m_Slots.size());
+        for (size_t i = 0; i < slots.size(); i++) slots[i] = { m_Slots[i].hash, m_Slots[i].value, 0 };
+        return slots;
+    }
+
+    // Takes over a saved slot table as it is, keyOf gives the key stored for a value
+    template <typename KeyOf>
+    bool Restore(std::span<const SavedSlot> slots, KeyOf keyOf)
+    {
+        Clear();
+        if (slots.size() & (slots.size() - 1)) return false;
+
+        m_Slots.resize(slots.size());
+        for (size_t i = 0; i < slots.size(); i++) {
+            if (slots[i].value == npos) continue;
+            m_Slots[i] = { slots[i].hash, keyOf(slots[i].value), slots[i].value };
+            m_Count++;
+        }
+
+        // A full table would never end a probe
+        if (m_Count * 2 > m_Slots.size()) {
+            Clear();
+            return false;
+        }
+        return true;
+    }
+
+private:
+    struct Slot {
+        uint64_t hash = 0;
+        std::string_view key;
+        uint32_t value = npos;
+    };
+
+    std::vector<Slot> m_Slots;
+    size_t m_Count = 0;
+
+    size_t FindSlot(uint64_t hash, std::string_view path) const
+    {
+        if (m_Slots.empty()) return SIZE_MAX;
+        size_t mask = m_Slots.size() - 1;
+        for (size_t i = hash & mask;; i = (i + 1) & mask) {
+            const Slot& slot = m_Slots[i];
+            if (slot.value == npos) return SIZE_MAX;
+            if (slot.hash == hash && PathEquals(slot.key, path)) return i;
+        }
+    }
+
+    bool InsertHashed(uint64_t hash, std::string_view path, uint32_t value)
+    {
+        size_t mask = m_Slots.size() - 1;
+        for (size_t i = hash & mask;; i = (i + 1) & mask) {
+            Slot& slot = m_Slots[i];
+            if (slot.value == npos) {
+                slot = { hash, path, value };
+                m_Count++;
+                return true;
+            }
+            if (slot.hash == hash && PathEquals(slot.key, path)) return false;
+        }
+    }
+
+    void Rehash(size_t capacity)
+    {
+        std::vector<Slot> slots(capacity);
+        slots.swap(m_Slots);
+        m_Count = 0;
+        for (auto& slot : slots) {
+            if (slot.value != npos) InsertHashed(slot.hash, slot.key, slot.value);
+        }
+    }
+};
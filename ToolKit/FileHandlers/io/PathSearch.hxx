@@ -0,0 +1,257 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cctype>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <algorithm>
+#include <regex>
+
+#include "PathIndex.hxx"
+
+// Trigram index over archive paths for substring, glob and regex search. Every path is
+// split into its normalized three character runs, a query only verifies the paths holding
+// all trigrams of its literal parts. Paths are numbered in the order they are added, so
+// posting lists stay sorted and more paths can be added at any time
+class PathSearch
+{
+public:
+    void Clear()
+    {
+        m_Paths.clear();
+        m_Postings.clear();
+    }
+
+    // Adds a path and returns its number, the path has to outlive the index
+    uint32_t Add(std::string_view path)
+    {
+        uint32_t id = static_cast<uint32_t>(m_Paths.size());
+        m_Paths.push_back(path);
+
+        // Trigrams repeated inside one path are only listed once, ids only ever grow
+        for (size_t i = 0; i + 3 <= path.size(); i++) {
+            std::vector<uint32_t>& posting = m_Postings[GetTrigram(path.data() + i)];
+            if (posting.empty() || posting.back() != id) posting.push_back(id);
+        }
+        return id;
+    }
+
+    size_t Size() const { return m_Paths.size(); }
+
+    std::string_view GetPath(uint32_t id) const { return m_Paths[id]; }
+
+    // Paths holding the text, case and separator insensitive
+    std::vector<uint32_t> FindSubstring(std::string_view text, size_t limit = SIZE_MAX) const
+    {
+        return Query({ { text } }, limit, [text](std::string_view path) { return Contains(path, text); });
+    }
+
+    // Paths matching a pattern of '*' and '?' wildcards, case and separator insensitive
+    std::vector<uint32_t> FindGlob(std::string_view pattern, size_t limit = SIZE_MAX) const
+    {
+        std::vector<std::string_view> literals;
+        size_t start = 0;
+        for (size_t i = 0; i <= pattern.size(); i++) {
+            if (i < pattern.size() && pattern[i] != '*' && pattern[i] != '?') continue;
+            if (i > start) literals.push_back(pattern.substr(start, i - start));
+            start = i + 1;
+        }
+        return Query({ literals }, limit, [pattern](std::string_view path) { return PathIndex::MatchGlob(pattern, path); });
+    }
+
+    // Paths matching an ECMAScript regular expression, case insensitive
+    std::vector<uint32_t> FindRegex(const std::string& expression, size_t limit = SIZE_MAX) const
+    {
+        std::regex regex;
+        try {
+            regex.assign(expression, std::regex::ECMAScript | std::regex::icase | std::regex::optimize);
+        }
+        catch (const std::regex_error&) {
+            return {};
+        }
+
+        // Every top level alternative brings its own literals, a path has to hold those of one of them
+        std::vector<std::vector<std::string>> alternatives = GetRegexLiterals(expression);
+        std::vector<std::vector<std::string_view>> branches;
+        for (auto& literals : alternatives) branches.emplace_back(literals.begin(), literals.end());
+        return Query(branches, limit, [&regex](std::string_view path) {
+            return std::regex_search(path.begin(), path.end(), regex);
+            });
+    }
+
+    // Finds by the kind of query: a regex between slashes, a glob with wildcards or a substring
+    std::vector<uint32_t> Find(std::string_view query, size_t limit = SIZE_MAX) const
+    {
+        if (query.size() >= 2 && query.front() == '/' && query.back() == '/')
+            return FindRegex(std::string(query.substr(1, query.size() - 2)), limit);
+        if (query.find_first_of("*?") != std::string_view::npos)
+            return FindGlob(query, limit);
+        return FindSubstring(query, limit);
+    }
+
+private:
+    std::vector<std::string_view> m_Paths;
+    std::unordered_map<uint32_t, std::vector<uint32_t>> m_Postings;
+
+    static uint32_t GetTrigram(const char* text)
+    {
+        return (uint32_t(uint8_t(PathIndex::NormalizeChar(text[0]))) << 16) |
+            (uint32_t(uint8_t(PathIndex::NormalizeChar(text[1]))) << 8) |
+            uint32_t(uint8_t(PathIndex::NormalizeChar(text[2])));
+    }
+
+    static bool Contains(std::string_view path, std::string_view text)
+    {
+        if (text.size() > path.size()) return false;
+        for (size_t i = 0; i + text.size() <= path.size(); i++) {
+            size_t j = 0;
+            while (j < text.size() && PathIndex::NormalizeChar(path[i + j]) == PathIndex::NormalizeChar(text[j])) j++;
+            if (j == text.size()) return true;
+        }
+        return false;
+    }
+
+    // Runs of plain characters a match has to contain, one list per top level alternative.
+    // Characters in groups or made optional by a quantifier end a run, so do escapes standing
+    // for a class or a code (\d, \x41, \u0041, \cM) and the bounds of a {m,n} quantifier
+    static std::vector<std::vector<std::string>> GetRegexLiterals(std::string_view expression)
+    {
+        std::vector<std::vector<std::string>> alternatives(1);
+        std::string run;
+        int depth = 0;
+        auto flush = [&]() {
+            if (run.size() >= 3) alternatives.back().push_back(run);
+            run.clear();
+        };
+
+        for (size_t i = 0; i < expression.size(); i++) {
+            char c = expression[i];
+            char literal = 0;
+            if (c == '\\' && i + 1 < expression.size()) {
+                char next = expression[++i];
+                if (!isalnum(static_cast<unsigned char>(next))) literal = next;
+                else {
+                    // The payload of the escape isn't text of its own, backreferences run on over their digits
+                    auto isPayload = [next](char p) {
+                        unsigned char u = static_cast<unsigned char>(p);
+                        if (next == 'x' || next == 'u') return isxdigit(u) != 0;
+                        if (next == 'c') return isalpha(u) != 0;
+                        return isdigit(static_cast<unsigned char>(next)) && isdigit(u);
+                    };
+                    size_t payload = (next == 'x') ? 2 : (next == 'u') ? 4 : (next == 'c') ? 1 : expression.size();
+                    while (payload-- > 0 && i + 1 < expression.size() && isPayload(expression[i + 1])) i++;
+                }
+            }
+            else if (c == '{') {
+                while (i + 1 < expression.size() && expression[i] != '}') i++;
+            }
+            else if (c == '(') depth++;
+            else if (c == ')') depth--;
+            else if (c == '|' && depth == 0) {
+                flush();
+                alternatives.emplace_back();
+                continue;
+            }
+            else if (!strchr(".^$*+?{}|", c)) literal = c;
+
+            char following = (i + 1 < expression.size()) ? expression[i + 1] : 0;
+            if (literal != 0 && depth == 0 && following != '?' && following != '*' && following != '{') {
+                run += literal;
+                continue;
+            }
+            flush();
+        }
+        flush();
+        return alternatives;
+    }
+
+    // First position at or after first holding a value not below id, stepping further each time
+    // so long lists are skipped through quickly while the candidates ascend
+    static std::vector<uint32_t>::const_iterator Gallop(std::vector<uint32_t>::const_iterator first, std::vector<uint32_t>::const_iterator last, uint32_t id)
+    {
+        if (first == last || *first >= id) return first;
+        ptrdiff_t bound = 1;
+        while (bound < last - first && first[bound] < id) bound *= 2;
+        return std::lower_bound(first + bound / 2, (bound < last - first) ? first + bound + 1 : last, id);
+    }
+
+    // Visits the ids of the paths holding every trigram of the literals in ascending order until the
+    // visitor returns false. All is set when the literals have no trigram to narrow the paths down
+    template <typename Visit>
+    void Intersect(const std::vector<std::string_view>& literals, bool& all, Visit visit) const
+    {
+        all = false;
+        std::vector<const std::vector<uint32_t>*> postings;
+        for (std::string_view literal : literals) {
+            for (size_t i = 0; i + 3 <= literal.size(); i++) {
+                auto it = m_Postings.find(GetTrigram(literal.data() + i));
+                if (it == m_Postings.end()) return;
+                postings.push_back(&it->second);
+            }
+        }
+        if (postings.empty()) {
+            all = true;
+            return;
+        }
+
+        // Walks the shortest list and looks every id up in the longer ones
+        std::sort(postings.begin(), postings.end(), [](auto a, auto b) { return (a->size() != b->size()) ? a->size() < b->size() : a < b; });
+        postings.erase(std::unique(postings.begin(), postings.end()), postings.end());
+
+        std::vector<std::vector<uint32_t>::const_iterator> positions;
+        for (auto posting : postings) positions.push_back(posting->begin());
+
+        for (uint32_t id : *postings[0]) {
+            bool found = true;
+            for (size_t p = 1; p < postings.size() && found; p++) {
+                positions[p] = Gallop(positions[p], postings[p]->end(), id);
+                if (positions[p] == postings[p]->end()) return;
+                found = (*positions[p] == id);
+            }
+            if (found && !visit(id)) return;
+        }
+    }
+
+    // Verifies the candidates of every branch, a branch without trigrams has to check every path
+    template <typename Match>
+    std::vector<uint32_t> Query(const std::vector<std::vector<std::string_view>>& branches, size_t limit, Match match) const
+    {
+        std::vector<uint32_t> results;
+        bool all = false;
+
+        // A single branch is verified while intersecting and stops at the limit
+        if (branches.size() == 1) {
+            Intersect(branches[0], all, [&](uint32_t id) {
+                if (match(m_Paths[id])) results.push_back(id);
+                return results.size() < limit;
+                });
+        }
+        else {
+            std::vector<uint32_t> candidates;
+            for (size_t b = 0; b < branches.size() && !all; b++) {
+                size_t middle = candidates.size();
+                Intersect(branches[b], all, [&](uint32_t id) {
+                    candidates.push_back(id);
+                    return true;
+                    });
+                std::inplace_merge(candidates.begin(), candidates.begin() + middle, candidates.end());
+            }
+            candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+            for (size_t i = 0; i < candidates.size() && results.size() < limit && !all; i++) {
+                if (match(m_Paths[candidates[i]])) results.push_back(candidates[i]);
+            }
+        }
+
+        if (all) {
+            results.clear();
+            for (uint32_t id = 0; id < m_Paths.size() && results.size() < limit; id++) {
+                if (match(m_Paths[id])) results.push_back(id);
+            }
+        }
+        return results;
+    }
+};
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <span>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+#include "FileView.hxx"
+#include "BulkReader.hxx"
+
+// Batched reads of many ranges of one view. Ranges are sorted by their position in the file
+// and merged with their neighbours into large reads wherever the gap between them is small,
+// workers read the merged runs front to back so a pass over a whole archive becomes one
+// sequential stream. Each range is handed over as soon as the run holding it is in, so the
+// completions arrive out of the order the ranges were submitted in
+class ReadScheduler
+{
+public:
+    struct Stats {
+        size_t requests = 0;
+        size_t reads = 0;
+        uint64_t bytesRequested = 0;
+        uint64_t bytesRead = 0;
+        double seconds = 0.0;
+    };
+
+    explicit ReadScheduler(const FileView& view) : m_View(view) {}
+
+    // Ranges closer than this get read together, the bytes between them are read and skipped
+    void SetMaxGap(uint64_t maxGap) { m_MaxGap = maxGap; }
+
+    // Largest merged read, a single range larger than it is used straight from the mapping
+    void SetMaxReadSize(uint64_t maxReadSize) { m_MaxReadSize = (maxReadSize > 0) ? maxReadSize : 1; }
+
+    // Queues the range of the view, the tag is handed back with its data
+    void Submit(uint64_t offset, uint64_t size, uint64_t tag)
+    {
+        m_Requests.push_back({ offset, size, tag });
+    }
+
+    size_t GetPendingCount() const { return m_Requests.size(); }
+
+    // Reads the runs through a reader of their own on the file, io_uring where the OS has it. Runs
+    // are kept to the block size of the reader so each one comes back in a single piece
+    void UseBulkReader(const BulkReader::Options& options)
+    {
+        m_BulkOptions = options;
+        m_bBulk = true;
+    }
+
+    // Reads every queued range and calls complete(tag, data) for each from the workers, at the same
+    // time from several of them. Ranges out of the view come with empty data. Runs whose read fails
+    // are used from the mapping instead, false when that couldn't provide them either and their
+    // ranges came with empty data
+    template <typename Complete>
+    bool Run(Complete complete, unsigned int threadCount = std::thread::hardware_concurrency())
+    {
+        auto start = std::chrono::steady_clock::now();
+        if (threadCount == 0) threadCount = 1;
+
+        std::vector<Request> requests = std::move(m_Requests);
+        m_Requests.clear();
+        std::sort(requests.begin(), requests.end(), [](const Request& a, const Request& b) {
+            return (a.offset != b.offset) ? a.offset < b.offset : a.size < b.size;
+            });
+
+        m_Stats = {};
+        m_Stats.requests = requests.size();
+        uint64_t maxReadSize = m_bBulk ? (std::min)(m_MaxReadSize, uint64_t(m_BulkOptions.blockSize)) : m_MaxReadSize;
+        std::vector<ReadRun> runs = GetRuns(requests, maxReadSize);
+
+        // Files that couldn't be mapped are in memory already, everything else is read in runs
+        bool inMemory = m_View.IsOpen() && !m_View.GetFile().IsMapped();
+        std::atomic<size_t> next = 0, reads = 0;
+        std::atomic<uint64_t> bytesRead = 0;
+        std::atomic<bool> failed = false;
+
+        // The bulk reader takes the runs it can hold, the rest and any it failed on are left to the workers
+        std::vector<uint8_t> done(runs.size(), 0);
+        BulkReader bulk;
+        if (m_bBulk && !inMemory && !runs.empty() && bulk.Open(m_View.GetFilePath(), m_BulkOptions)) {
+            for (size_t r = 0; r < runs.size(); r++) {
+                if (runs[r].size <= maxReadSize) bulk.Submit(m_View.GetFileOffset() + runs[r].offset, runs[r].size, r);
+            }
+            bulk.Run([&](uint64_t r, uint64_t, std::span<const uint8_t> data) {
+                CompleteRun(runs[r], requests, data, complete);
+                done[r] = 1;
+                });
+            reads += bulk.GetStats().reads;
+            bytesRead += bulk.GetStats().bytesRead;
+        }
+
+        auto worker = [&]() {
+            std::vector<uint8_t> buffer;
+            for (size_t r = next++; r < runs.size(); r = next++) {
+                if (done[r]) continue;
+                const ReadRun& run = runs[r];
+                std::span<const uint8_t> data = m_View.GetSpan(run.offset, run.size);
+                if (run.size > maxReadSize || inMemory) {
+                    if (!inMemory) m_View.GetFile().Prefetch(m_View.GetFileOffset() + run.offset, run.size);
+                }
+                else {
+                    if (buffer.size() < run.size) buffer.resize(static_cast<size_t>(run.size));
+                    if (m_View.GetFile().ReadAt(m_View.GetFileOffset() + run.offset, buffer.data(), run.size)) {
+                        data = { buffer.data(), static_cast<size_t>(run.size) };
+                        reads++;
+                        bytesRead += run.size;
+                    }
+                }
+                if (data.size() < run.size) failed = true;
+                CompleteRun(run, requests, data, complete);
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (unsigned int t = 1; t < threadCount && t < runs.size(); t++) workers.emplace_back(worker);
+        worker();
+        for (auto& thread : workers) thread.join();
+
+        // Ranges out of the view complete last, with nothing to read
+        for (auto& request : requests) {
+            if (!IsInView(request)) complete(request.tag, std::span<const uint8_t>());
+        }
+
+        m_Stats.reads = reads;
+        m_Stats.bytesRead = bytesRead;
+        m_Stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return !failed;
+    }
+
+    const Stats& GetStats() const { return m_Stats; }
+
+private:
+    struct Request {
+        uint64_t offset;
+        uint64_t size;
+        uint64_t tag;
+    };
+
+    // Merged range of the view and the sorted requests it serves
+    struct ReadRun {
+        uint64_t offset;
+        uint64_t size;
+        size_t first;
+        size_t last;
+    };
+
+    FileView m_View;
+    std::vector<Request> m_Requests;
+    uint64_t m_MaxGap = 64 * 1024;
+    uint64_t m_MaxReadSize = 16 * 1024 * 1024;
+    BulkReader::Options m_BulkOptions;
+    bool m_bBulk = false;
+    Stats m_Stats;
+
+    bool IsInView(const Request& request) const
+    {
+        return request.offset <= m_View.Size() && request.size <= m_View.Size() - request.offset;
+    }
+
+    // Grows a run over the following requests while the gap stays small and the read stays bounded.
+    // Overlapping requests, like entries sharing their data, fall into the same run
+    std::vector<ReadRun> GetRuns(const std::vector<Request>& requests, uint64_t maxReadSize)
+    {
+        std::vector<ReadRun> runs;
+        for (size_t i = 0; i < requests.size(); i++) {
+            const Request& request = requests[i];
+            if (!IsInView(request)) continue;
+            m_Stats.bytesRequested += request.size;
+
+            uint64_t end = request.offset + request.size;
+            if (!runs.empty() && runs.back().last == i) {
+                ReadRun& run = runs.back();
+                uint64_t runEnd = run.offset + run.size;
+                uint64_t mergedEnd = (std::max)(runEnd, end);
+                if (request.offset <= runEnd + m_MaxGap && (mergedEnd - run.offset <= maxReadSize || end <= runEnd)) {
+                    run.size = mergedEnd - run.offset;
+                    run.last = i + 1;
+                    continue;
+                }
+            }
+            runs.push_back({ request.offset, request.size, i, i + 1 });
+        }
+        return runs;
+    }
+
+    // Hands out the requests served by the run from its data, with empty data when the run is missing
+    template <typename Complete>
+    static void CompleteRun(const ReadRun& run, const std::vector<Request>& requests, std::span<const uint8_t> data, Complete& complete)
+    {
+        for (size_t i = run.first; i < run.last; i++) {
+            const Request& request = requests[i];
+            if (data.size() < run.size) complete(request.tag, std::span<const uint8_t>());
+            else complete(request.tag, data.subspan(static_cast<size_t>(request.offset - run.offset), static_cast<size_t>(request.size)));
+        }
+    }
+};
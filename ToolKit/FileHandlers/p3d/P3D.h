@@ -3,8 +3,14 @@
 #include <cstdint>
 #include <vector>
 #include <cstdio>
+#include <cstring>
+#include <span>
+#include <memory>
+#include <algorithm>
 
 #include "pure3d/ChunkFile.hxx"
+#include "pure3d/LoadManager.hxx"
+#include "../io/MappedFile.hxx"
 
 #pragma pack(push, 1)
 
@@ -25,86 +31,96 @@ struct P3DChunkHeader
 
 #pragma pack(pop)
 
+// Chunk of the index, offsets are relative to the data the index was built from.
+// Chunks are linked to their parent, first child, next sibling and top level ancestor by index
 struct P3DChunk 
 {
-	uint64_t uniqueID;
     P3DChunkHeader header;
-    std::vector<uint8_t> body;
-    std::vector<P3DChunk> childs;
-	std::streampos file_offset;
+    uint32_t offset;
+    uint32_t parent;
+    uint32_t firstChild;
+    uint32_t nextSibling;
+    uint32_t top;
+    uint32_t depth;
+
+    // Size of the chunk with its children, chunks with a smaller total than data size have none
+    uint32_t GetTotalSize() const { return (std::max)(header.chunk_size, header.sub_chunks_size); }
+
+    bool HasChildren() const { return firstChild != UINT32_MAX; }
 };
 
+// Flat index of the chunks of a P3D file in file order, built in one pass at any nesting depth.
+// Bodies aren't copied, they are handed out as spans of the data, which has to outlive the index.
+// An index saved earlier can be used in place out of the mapping of its cache file
 class P3D 
 {
 public:
+	static constexpr uint32_t npos = UINT32_MAX;
+
 	P3DHeader header;
-	std::vector<P3DChunk> chunks;
-	uint64_t currentID = 1;
+	std::span<const P3DChunk> chunks;
+
+	P3D() {}
 
-	P3DChunk ReadChunk(FILE* m_File) 
+	// Chunks view the storage of the index itself
+	P3D(const P3D&) = delete;
+	P3D& operator=(const P3D&) = delete;
+
+	// Indexes the chunks of the data from position on, false when a chunk doesn't fit in its parent
+	// or the data. Children of a cut off chunk are indexed as far as they go
+	bool GetChunks(std::span<const uint8_t> data, size_t position)
 	{
-		P3DChunk chunk;
-		chunk.uniqueID = currentID++;
-		chunk.file_offset = std::ftell(m_File);
-		fread(&chunk.header, sizeof(chunk.header), 1, m_File);
-		chunk.body.resize(chunk.header.chunk_size - sizeof(chunk.header));
-		fread(chunk.body.data(), chunk.body.size(), 1, m_File);
-		return chunk;
+		m_Data = data;
+		m_Chunks.clear();
+		m_ChunkFile.reset();
+		bool bComplete = (data.size() <= UINT32_MAX) && Index(data, position);
+		chunks = m_Chunks;
+		return bComplete;
 	}
 
-	void GetChunks(FILE* m_File, std::streampos section_end) 
+	// Uses an index built from the same data before, read in place from the mapping it is kept in.
+	// False when the index doesn't fit the data, links are checked so a damaged cache can't be followed out of it
+	bool SetChunks(std::span<const uint8_t> data, std::span<const P3DChunk> indexed, std::shared_ptr<const MappedFile> file)
 	{
-		while (ftell(m_File) < section_end || section_end == std::streampos(0)) 
-		{
-			auto& chunk = chunks.emplace_back(ReadChunk(m_File));
-			auto header = chunk.header;
-			if (header.chunk_size != header.sub_chunks_size) 
-			{
-				auto chunk_left = header.sub_chunks_size - header.chunk_size;
-				while (chunk_left) {
-					auto next = ReadChunk(m_File);
-					chunk_left -= next.header.chunk_size;
-					chunk.childs.emplace_back(next);
-					if (next.header.chunk_size == next.header.sub_chunks_size)
-						continue;
-					else 
-					{
-						auto child_left = next.header.sub_chunks_size - next.header.chunk_size;
-						while (child_left) {
-							next = ReadChunk(m_File);
-							child_left -= next.header.chunk_size;
-							chunk_left -= next.header.chunk_size;
-							chunk.childs.back().childs.emplace_back(next);
-						}
-					}
-				}
+		m_Data = data;
+		m_Chunks.clear();
+		m_ChunkFile.reset();
+		chunks = {};
+		if (data.size() > UINT32_MAX || indexed.size() >= npos) return false;
+
+		for (const P3DChunk& chunk : indexed) {
+			if (chunk.offset > data.size() || chunk.header.chunk_size < sizeof(P3DChunkHeader) || chunk.header.chunk_size > data.size() - chunk.offset) return false;
+			for (uint32_t link : { chunk.parent, chunk.firstChild, chunk.nextSibling }) {
+				if (link != npos && link >= indexed.size()) return false;
 			}
+			if (chunk.top >= indexed.size()) return false;
 		}
+		m_ChunkFile = std::move(file);
+		chunks = indexed;
+		return true;
 	}
 
-	P3DChunk* GetChunkByID(std::vector<P3DChunk>* chunks, uint64_t chunkID)
+	// First chunk of the top level, its siblings are the other top level chunks
+	uint32_t GetFirstChunk() const { return chunks.empty() ? npos : 0; }
+
+	// Chunk at the index, nullptr when there is none
+	const P3DChunk* GetChunk(uint32_t index) const { return (index < chunks.size()) ? &chunks[index] : nullptr; }
+
+	// Data of the chunk after its header, without the children
+	std::span<const uint8_t> GetBody(const P3DChunk& chunk) const
 	{
-		for (auto& chunk : *chunks)
-		{
-			if (chunk.uniqueID == chunkID)
-			{
-				return &chunk;
-			}
-			else
-			{
-				if (!chunk.childs.empty())
-				{
-					P3DChunk* foundChunk = GetChunkByID(&chunk.childs, chunkID);
-					if (foundChunk != nullptr)
-					{
-						return foundChunk;
-					}
-				}
-			}
-		}
-		return nullptr; // Chunk with specified ID not found
+		return m_Data.subspan(chunk.offset + sizeof(P3DChunkHeader), chunk.header.chunk_size - sizeof(P3DChunkHeader));
+	}
+
+	// Whole chunk from its header through the last child, as far as the data holds it
+	std::span<const uint8_t> GetBytes(const P3DChunk& chunk) const
+	{
+		return m_Data.subspan(chunk.offset, (std::min)(size_t(chunk.GetTotalSize()), m_Data.size() - chunk.offset));
 	}
 
+	// Bytes the index takes on the heap, nothing for an index used out of a mapping
+	size_t GetMemoryUsage() const { return m_Chunks.capacity() * sizeof(P3DChunk); }
+
 	void LoadFile(std::string filename)
 	{
 		LoadStream* stream = new LoadStream(filename.c_str());
@@ -132,4 +148,56 @@ public:
 		}
 	}
 
+private:
+	std::span<const uint8_t> m_Data;
+	std::vector<P3DChunk> m_Chunks;
+	std::shared_ptr<const MappedFile> m_ChunkFile;
+
+	// Builds the chunk index in m_Chunks with a stack of the chunks still open
+	bool Index(std::span<const uint8_t> data, size_t position)
+	{
+		struct Open {
+			uint32_t index;
+			uint32_t lastChild;
+			uint64_t end;
+		};
+
+		std::vector<Open> stack;
+		uint32_t lastRoot = npos;
+		bool bComplete = true;
+		while (position < data.size()) {
+			while (!stack.empty() && position >= stack.back().end) stack.pop_back();
+			uint64_t end = stack.empty() ? data.size() : stack.back().end;
+			if (end - position < sizeof(P3DChunkHeader)) {
+				if (stack.empty()) return false;
+				position = stack.back().end;
+				bComplete = false;
+				continue;
+			}
+
+			P3DChunk chunk;
+			memcpy(&chunk.header, data.data() + position, sizeof(chunk.header));
+			if (chunk.header.chunk_size < sizeof(chunk.header) || chunk.header.chunk_size > end - position) return false;
+			if (chunk.GetTotalSize() > end - position) bComplete = false;
+
+			chunk.offset = static_cast<uint32_t>(position);
+			chunk.parent = stack.empty() ? npos : stack.back().index;
+			chunk.firstChild = npos;
+			chunk.nextSibling = npos;
+			chunk.top = stack.empty() ? static_cast<uint32_t>(m_Chunks.size()) : stack.front().index;
+			chunk.depth = static_cast<uint32_t>(stack.size());
+
+			uint32_t index = static_cast<uint32_t>(m_Chunks.size());
+			uint32_t& previous = stack.empty() ? lastRoot : stack.back().lastChild;
+			if (previous != npos) m_Chunks[previous].nextSibling = index;
+			else if (!stack.empty()) m_Chunks[stack.back().index].firstChild = index;
+			previous = index;
+			m_Chunks.push_back(chunk);
+
+			// Children follow the data of their parent
+			if (chunk.header.sub_chunks_size > chunk.header.chunk_size) stack.push_back({ index, npos, (std::min)(position + chunk.header.sub_chunks_size, end) });
+			position += chunk.header.chunk_size;
+		}
+		return bComplete;
+	}
 };
\ No newline at end of file
@@ -12,6 +12,7 @@
 #include "pure3d/Skeleton.hxx"
 
 #include "P3D.h"
+#include "../rcf/RcfIndexCache.hxx"
 
 ObjectLoader* loader;
 
@@ -35,15 +36,16 @@ public:
         std::vector<ChunkNode> Children;
         bool IsDirectory;
         int file_size;
-        std::streampos file_offset;
+        uint32_t index = P3D::npos;
         P3DChunk chunk;
-        bool IsSelected;
         eDisplayMode displayMode = eDisplayMode::DEFAULT;
-        uint64_t parentID;
     };
 
-    ChunkNode* m_RootNode;
-    ChunkNode* m_selectedChunkNode;
+    ChunkNode* m_RootNode = nullptr;
+    ChunkNode* m_selectedChunkNode = nullptr;
+
+    // Bytes of the loaded P3D, chunk offsets are relative to it
+    FileView m_View;
 
     P3DHandler()
     {
@@ -56,161 +58,90 @@ public:
         g_LoadManager->AddHandler(new SkeletonLoader, Skeleton::SKELETON, "SKELETON");
     }
 
-    void LoadFile(std::string& filePath, int offset) override
+    void LoadFile(std::string& filePath, const FileView& view) override
     {
         std::cout << L"Loading P3D file: " << filePath << std::endl;
 
         m_bFileLoaded = false;
 
-        if (offset == -1) m_LoadedFilePath = filePath;
-
-        m_LoadedFileName = ExtractFileNameWithoutExtension(m_LoadedFilePath);
+        m_LoadedFileName = ExtractFileNameWithoutExtension(filePath);
 
-        FILE* m_File = nullptr;
-        errno_t err = fopen_s(&m_File, filePath.c_str(), "rb");
-        if (err != 0 || m_File == nullptr) {
-            std::cerr << "Failed to open file!" << std::endl;
+        // Chunks are read from the view, a P3D nested in an archive shares the mapping of its parent
+        if (view.GetFileOffset() != 0) std::wcout << L"File at offset: " << view.GetFileOffset() << std::endl;
+        if (view.Size() < sizeof(P3DHeader)) {
+            std::wcerr << L"Error: Not a valid P3D archive." << std::endl;
             return;
         }
 
-        // Seek to the provided offset if provided
-        if (offset != -1) {
-            std::wcout << L"Seek to offset: " << offset << std::endl;
-            if (fseek(m_File, offset, SEEK_SET) != 0) {
-                std::wcerr << L"Error seeking to offset: " << offset << std::endl;
-                fclose(m_File);
-                return;
-            }
-        }
-
         // Read header
-        fread(&p3d.header, sizeof(P3DHeader), 1, m_File);
-
-        //GetFileContent(filePath, (offset != -1) ? offset : 0, p3d.header.file_size);
+        memcpy(&p3d.header, view.Data(), sizeof(P3DHeader));
 
         if (memcmp(p3d.header.file_id, "P3D", sizeof(p3d.header.file_id)) != 0) {
             std::wcerr << L"Error: Not a valid P3D archive." << std::endl;
-            fclose(m_File);
             return;
         }
 
-        p3d.GetChunks(m_File, p3d.header.file_size + offset);
-
-        // Close the file
-        fclose(m_File);
+        // The chunk index comes out of the cache when the file was indexed before
+        m_View = view.GetSubView(0, (std::min)(uint64_t(p3d.header.file_size), view.Size()));
+        RcfIndexCache::OpenChunks(p3d, m_View, sizeof(P3DHeader));
 
+        m_selectedChunkNode = nullptr;
+        m_selectedFileView = {};
         m_RootNode = new ChunkNode();
 
-        m_RootNode->FullPath = (offset == -1) ? std::string(filePath.begin(), filePath.end()) : std::string(m_selectedFilePath.begin(), m_selectedFilePath.end());
+        m_RootNode->FullPath = filePath;
         m_RootNode->FileName = m_RootNode->FullPath.substr(m_RootNode->FullPath.find_last_of('\\') + 1);
         m_RootNode->IsDirectory = true;
-        CreateTreeNodesFromP3DChunks(p3d.chunks, m_RootNode);
+        CreateTreeNodesFromP3DChunks(p3d.GetFirstChunk(), m_RootNode);
         m_bFileLoaded = true;
 
         //p3d.LoadFile(std::string(filePath.begin(), filePath.end()).c_str());
     }
 
-    void CreateTreeNodesFromP3DChunks(const std::vector<P3DChunk>& chunks, ChunkNode* parentNode)
+    // Adds the chunk and its siblings to the parent node, the ID shown is the index of the chunk plus one
+    void CreateTreeNodesFromP3DChunks(uint32_t first, ChunkNode* parentNode)
     {
-        for (P3DChunk chunk : chunks) {
+        for (uint32_t index = first; index != P3D::npos; index = p3d.chunks[index].nextSibling) {
+            const P3DChunk& chunk = p3d.chunks[index];
+
             // Create file or directory node for the chunk
             ChunkNode node;
 
             // Convert data_type to hexadecimal string and add chunk name
             std::stringstream ss;
-            ss << "(" << std::dec << chunk.uniqueID << ")" << std::hex << chunk.header.data_type << " - " << g_LoadManager->GetName(chunk.header.data_type);
+            ss << "(" << std::dec << index + 1 << ")" << std::hex << chunk.header.data_type << " - " << g_LoadManager->GetName(chunk.header.data_type);
             node.FullPath = ss.str();
             node.FileName = ss.str();
-            node.file_offset = chunk.file_offset;
-            node.IsDirectory = (chunk.childs.size() > 0);
+            node.IsDirectory = chunk.HasChildren();
+            node.index = index;
             node.chunk = chunk;
-            node.parentID = parentNode->chunk.uniqueID;
             // Add the node to the parent directory
             parentNode->Children.push_back(node);
 
             // If the chunk has child chunks, recursively call the function
-            if (chunk.childs.size() > 0) {
-                CreateTreeNodesFromP3DChunks(chunk.childs, &parentNode->Children.back());
-            }
-            else {
-                node.parentID = NULL;
-            }
-        }
-    }
-
-    uint64_t FindTopParentID(ChunkNode& node)
-    {
-        if (node.parentID == 0) {
-            // This is the top parent node
-            return node.chunk.uniqueID;
-        }
-        else {
-            // Recursively call the function with the parent node
-            ChunkNode* parentNode = FindParentNode(node.parentID);
-            if (parentNode != nullptr) {
-                return FindTopParentID(*parentNode);
-            }
-            else {
-                // If parent node is not found, return the current node's unique ID
-                return node.chunk.uniqueID;
+            if (chunk.HasChildren()) {
+                CreateTreeNodesFromP3DChunks(chunk.firstChild, &parentNode->Children.back());
             }
         }
     }
 
-    ChunkNode* FindParentNode(uint64_t parentID)
+    // Loads the top level chunk holding the selected one straight from the view, its ancestor is
+    // looked up in the index. The hex view shows the selected chunk out of the same bytes
+    void LoadChunkContent(const ChunkNode& chunkNode)
     {
-        // Traverse the tree to find the node with the given parentID
-        return FindParentNodeRecursive(m_RootNode, parentID);
-    }
-
-    ChunkNode* FindParentNodeRecursive(ChunkNode* currentNode, uint64_t parentID)
-    {
-        if (currentNode->chunk.uniqueID == parentID) {
-            // Found the node with the given parentID
-            return currentNode;
-        }
-
-        // Recursively search in the children nodes
-        for (auto& child : currentNode->Children) {
-            ChunkNode* foundNode = FindParentNodeRecursive(&child, parentID);
-            if (foundNode != nullptr) {
-                return foundNode;
-            }
-        }
+        const P3DChunk* chunk = p3d.GetChunk(chunkNode.index);
+        if (chunk == nullptr) return;
+        const P3DChunk& top = p3d.chunks[chunk->top];
 
-        // If not found in children, return nullptr
-        return nullptr;
-    }
+        m_selectedFileView = p3d.GetBytes(*chunk);
+        m_selectedFileSize = m_selectedFileView.size();
 
-    void LoadChunkContent(ChunkNode chunkNode)
-    {
-        uint64_t topParent = FindTopParentID(chunkNode);
-        if (topParent)
+        LoadStream stream(p3d.GetBytes(top));
+        ChunkFile cf(&stream, true);
+        loader = g_LoadManager->GetHandler(top.header.data_type);
+        if (loader)
         {
-            ChunkNode* node = FindParentNode(topParent);
-            if (node->chunk.uniqueID > 0)
-            {
-                // Apply the content for save the temp file
-                GetFileContent(g_FileHandler->m_LoadedFilePath, node->file_offset, node->chunk.header.sub_chunks_size);
-                SaveToTempFile("chunk.p3d", node->chunk.header.sub_chunks_size);
-                // Apply the content for the hex viewer
-                GetFileContent(g_FileHandler->m_LoadedFilePath, chunkNode.file_offset, chunkNode.chunk.header.sub_chunks_size);
-                P3DChunk* chunk = p3d.GetChunkByID(&p3d.chunks, topParent);
-                if (chunk != nullptr)
-                {
-                    if (m_selectedfileContent.size() == 0) return;
-                    std::string path = std::string(m_savedFilePath.begin(), m_savedFilePath.end());
-                    LoadStream* stream = new LoadStream(path.c_str());
-                    ChunkFile cf(stream, true);
-                    loader = g_LoadManager->GetHandler(chunk->header.data_type);
-                    if (loader)
-                    {
-                        loader->LoadObject(&cf);
-                    }
-                    stream->Close();
-                }
-            }
-
+            loader->LoadObject(&cf);
         }
     }
 
@@ -220,7 +151,7 @@ public:
 
         ImGuiTreeNodeFlags nodeFlags = 0;
 
-        if (chunkNode.IsSelected)
+        if (&chunkNode == m_selectedChunkNode)
             nodeFlags |= ImGuiTreeNodeFlags_Selected;
 
         if (chunkNode.IsDirectory)
@@ -229,11 +160,7 @@ public:
             {
                 if (ImGui::IsItemClicked(0))
                 {
-                    // Unselect all nodes first
-                    UnselectAllNodes(*m_RootNode);
-                    // Select the clicked node
-                    chunkNode.IsSelected = true;
-
+                    // The selection is a pointer, nothing else needs unselecting
                     g_FileHandler->m_selectedFilePath = chunkNode.FullPath;
                     LoadChunkContent(chunkNode);
                     m_selectedChunkNode = &chunkNode;
@@ -249,11 +176,7 @@ public:
             {
                 if (ImGui::IsItemClicked(0))
                 {
-                    // Unselect all nodes first
-                    UnselectAllNodes(*m_RootNode);
-                    // Select the clicked node
-                    chunkNode.IsSelected = true;
-
+                    // The selection is a pointer, nothing else needs unselecting
                     g_FileHandler->m_selectedFilePath = chunkNode.FullPath;
                     LoadChunkContent(chunkNode);
                     m_selectedChunkNode = &chunkNode;
@@ -263,13 +186,6 @@ public:
         ImGui::PopID();
     }
 
-    void UnselectAllNodes(ChunkNode& parentNode)
-    {
-        parentNode.IsSelected = false;
-        for (ChunkNode& childNode : parentNode.Children)
-            UnselectAllNodes(childNode);
-    }
-
     void RenderTree()
     {
         if (g_FileHandler->m_bFileLoaded)
@@ -331,10 +247,12 @@ public:
 
     void RenderHex()
     {
-        if (m_selectedfileContent.size() > 0)
+        if (m_selectedFileView.size() > 0)
         {
+            // Chunk bytes live in the read-only mapping of the file
             static MemoryEditor m_MemoryEdit;
-            m_MemoryEdit.DrawContents(m_selectedfileContent.data(), m_selectedFileSize);
+            m_MemoryEdit.ReadOnly = true;
+            m_MemoryEdit.DrawContents(const_cast<uint8_t*>(m_selectedFileView.data()), m_selectedFileView.size());
         }
     }
 
@@ -1,4 +1,8 @@
+#pragma once
+
 #include <vector>
+#include <map>
+#include <string>
 #include <iostream>
 
 #include "ChunkFile.hxx"
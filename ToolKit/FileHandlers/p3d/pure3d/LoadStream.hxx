@@ -1,64 +1,212 @@
 #pragma once
 
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
 #include <assert.h>
+#include <span>
+#include <vector>
+#include <bit>
+#include <algorithm>
 
+// Reads the little endian values of chunk files out of memory or out of a file. Memory streams
+// read straight from their span, file streams through a block buffer, so the getters are pointer
+// bumps and only a drained buffer goes to the file. Reads past the end give zeros and fail
 class LoadStream
 {
-	FILE *fp;
 public:
+	static constexpr uint32_t BlockSize = 64 * 1024;
+
+	LoadStream() {}
+
 	LoadStream(const char* filename)
 	{
-		fp = nullptr;
 		OpenRead(filename);
 	}
 
+	// Stream over the data, which has to outlive it
+	LoadStream(std::span<const uint8_t> data)
+	{
+		Open(data);
+	}
+
 	~LoadStream(void)
 	{
 		Close();
 	}
 
+	LoadStream(const LoadStream&) = delete;
+	LoadStream& operator=(const LoadStream&) = delete;
+
 	bool OpenRead(const char* filename)
 	{
+		Close();
+		m_File = fopen(filename, "rb");
+		if (m_File == nullptr) return false;
 
-		fp = fopen(filename, "rb");
-		return fp != nullptr;
+		// The block buffer replaces the one of the file
+		setvbuf(m_File, nullptr, _IONBF, 0);
+		fseek(m_File, 0, SEEK_END);
+		long size = ftell(m_File);
+		m_Size = (size > 0) ? static_cast<uint32_t>(size) : 0;
+		m_Buffer.resize(BlockSize);
+		m_Begin = m_Cursor = m_End = m_Buffer.data();
+		return true;
+	}
+
+	bool Open(std::span<const uint8_t> data)
+	{
+		Close();
+		if (data.size() > UINT32_MAX) return false;
+		m_Memory = data;
+		m_bMemory = true;
+		m_Size = static_cast<uint32_t>(data.size());
+		m_Begin = m_Cursor = data.data();
+		m_End = data.data() + data.size();
+		return true;
 	}
 
 	void Close(void)
 	{
-		if (fp)
-			fclose(fp);
+		if (m_File)
+			fclose(m_File);
+		m_File = nullptr;
+		m_Memory = {};
+		m_bMemory = false;
+		m_bFailed = false;
+		m_Size = 0;
+		m_WindowOffset = 0;
+		m_Begin = m_Cursor = m_End = nullptr;
 	}
 
 	bool GetData(void* buf, uint32_t count, uint32_t sz = 1)
 	{
-		return fread(buf, sz, count, fp) == count;
+		size_t bytes = size_t(count) * sz;
+		if (size_t(m_End - m_Cursor) >= bytes) {
+			if (bytes) memcpy(buf, m_Cursor, bytes);
+			m_Cursor += bytes;
+			return true;
+		}
+		return ReadSlow(static_cast<uint8_t*>(buf), bytes);
+	}
+
+	uint32_t GetSize(void) { return m_Size; }
+
+	uint32_t GetPosition(void) { return m_WindowOffset + static_cast<uint32_t>(m_Cursor - m_Begin); }
+
+	// Moves by skip, positions wrap around at 32 bits so a negative skip moves back
+	void Advance(uint32_t skip)
+	{
+		Seek(GetPosition() + skip);
 	}
 
-	uint32_t GetSize(void)
+	void Seek(uint32_t position)
 	{
-		assert(0);
-		return 0;
+		if (position >= m_WindowOffset && position - m_WindowOffset <= size_t(m_End - m_Begin)) {
+			m_Cursor = m_Begin + (position - m_WindowOffset);
+			return;
+		}
+
+		// Memory streams view all of their data again, a file stream reads from the position next time
+		if (m_bMemory && position <= m_Memory.size()) {
+			m_WindowOffset = 0;
+			m_Begin = m_Memory.data();
+			m_End = m_Begin + m_Memory.size();
+			m_Cursor = m_Begin + position;
+			return;
+		}
+		m_WindowOffset = position;
+		m_Begin = m_Cursor = m_End = m_bMemory ? m_Memory.data() + m_Memory.size() : m_Buffer.data();
 	}
 
-	uint32_t GetPosition(void)
+	bool IsOpen(void) { return m_File != nullptr || m_bMemory; }
+
+	bool IsMemory(void) const { return m_bMemory; }
+
+	// True once a read went past the end
+	bool HasFailed(void) const { return m_bFailed; }
+
+	uint8_t GetU8(void) { return Get<uint8_t>(); }
+	uint16_t GetU16(void) { return Get<uint16_t>(); }
+	uint32_t GetU32(void) { return Get<uint32_t>(); }
+	int8_t GetI8(void) { return Get<int8_t>(); }
+	int16_t GetI16(void) { return Get<int16_t>(); }
+	int32_t GetI32(void) { return Get<int32_t>(); }
+	float GetFloat(void) { return Get<float>(); }
+
+private:
+	FILE* m_File = nullptr;
+	std::vector<uint8_t> m_Buffer;
+	std::span<const uint8_t> m_Memory;
+	bool m_bMemory = false;
+	bool m_bFailed = false;
+	uint32_t m_Size = 0;
+
+	// Bytes of the stream at hand, the window starts at m_WindowOffset
+	uint32_t m_WindowOffset = 0;
+	const uint8_t* m_Begin = nullptr;
+	const uint8_t* m_Cursor = nullptr;
+	const uint8_t* m_End = nullptr;
+
+	template <typename T>
+	T Get(void)
 	{
-		return ftell(fp);
+		uint8_t bytes[sizeof(T)];
+		if (size_t(m_End - m_Cursor) >= sizeof(T)) {
+			memcpy(bytes, m_Cursor, sizeof(T));
+			m_Cursor += sizeof(T);
+		}
+		else if (!ReadSlow(bytes, sizeof(T))) return T();
+
+		if constexpr (std::endian::native == std::endian::big) std::reverse(bytes, bytes + sizeof(T));
+		T value;
+		memcpy(&value, bytes, sizeof(T));
+		return value;
 	}
 
-	void Advance(uint32_t skip)
+	// Reads across the end of the window, large reads go around the block buffer
+	bool ReadSlow(uint8_t* out, size_t bytes)
 	{
-		fseek(fp, skip, SEEK_CUR);
+		while (bytes > 0) {
+			size_t available = size_t(m_End - m_Cursor);
+			if (available > 0) {
+				size_t part = (std::min)(available, bytes);
+				memcpy(out, m_Cursor, part);
+				m_Cursor += part;
+				out += part;
+				bytes -= part;
+				continue;
+			}
+
+			if (m_File && bytes >= BlockSize) {
+				uint32_t position = GetPosition();
+				size_t read = (fseek(m_File, long(position), SEEK_SET) == 0) ? fread(out, 1, bytes, m_File) : 0;
+				Seek(static_cast<uint32_t>(position + read));
+				out += read;
+				bytes -= read;
+				if (bytes > 0) break;
+				continue;
+			}
+			if (!Refill()) break;
+		}
+		if (bytes == 0) return true;
+
+		memset(out, 0, bytes);
+		m_bFailed = true;
+		return false;
 	}
 
-	bool IsOpen(void) { return fp != nullptr; }
+	// Reads the next block of the file into the buffer
+	bool Refill(void)
+	{
+		if (m_File == nullptr) return false;
+		uint32_t position = GetPosition();
+		if (fseek(m_File, long(position), SEEK_SET) != 0) return false;
 
-	uint8_t GetU8(void) { uint8_t tmp; GetData(&tmp, 1, sizeof(tmp)); return tmp; }
-	uint16_t GetU16(void) { uint16_t tmp; GetData(&tmp, 1, sizeof(tmp)); return tmp; }
-	uint32_t GetU32(void) { uint32_t tmp; GetData(&tmp, 1, sizeof(tmp)); return tmp; }
-	int8_t GetI8(void) { int8_t tmp; GetData(&tmp, 1, sizeof(tmp)); return tmp; }
-	int16_t GetI16(void) { int16_t tmp; GetData(&tmp, 1, sizeof(tmp)); return tmp; }
-	int32_t GetI32(void) { int32_t tmp; GetData(&tmp, 1, sizeof(tmp)); return tmp; }
-	float GetFloat(void) { float tmp; GetData(&tmp, 1, sizeof(tmp)); return tmp; }
+		size_t read = fread(m_Buffer.data(), 1, m_Buffer.size(), m_File);
+		m_WindowOffset = position;
+		m_Begin = m_Cursor = m_Buffer.data();
+		m_End = m_Begin + read;
+		return read > 0;
+	}
 };
@@ -34,6 +34,15 @@ struct RCFFilenameDirectoryEntry {
     uint32_t padding;
 };
 
+// Fixed part of a filename directory entry as laid out on disc, followed by
+// path_len - 1 path characters and 4 bytes of padding
+struct RCFFilenameEntryHeader {
+    uint32_t date;
+    uint32_t unk2;
+    uint32_t unk3;
+    uint32_t path_len;
+};
+
 #pragma pack(pop)
 
 // Main structure to hold the data for cement files
@@ -43,16 +52,3 @@ struct RCF {
     std::vector<RCFFilenameDirectoryEntry> filename_directory;
 };
 
-
-RCFDirectoryEntry* GetDirectoryEntry(RCF rcf, std::string path)
-{
-    int index = 0;
-    for (auto& filenameEntry : rcf.filename_directory) {
-        if (filenameEntry.path == path)
-        {
-            return &rcf.directory[index];
-        }
-        index++;
-    }
-    return NULL;
-}
\ No newline at end of file
@@ -3,141 +3,304 @@
 
 #include "../FileHandler.hxx"
 
-#include "RCF.h"
+#include "RcfArchive.hxx"
+#include "RcfTree.hxx"
+#include "RcfIndexCache.hxx"
+#include "../io/PathSearch.hxx"
+#include "RcfNameRecovery.hxx"
+#include "RcfExtractor.hxx"
+#include "RcfWriter.hxx"
+#include "RcfPatcher.hxx"
+#include "RcfDedup.hxx"
+#include "RcfDiff.hxx"
+#include "RcfDelta.hxx"
+#include "RcfPack.hxx"
+#include "../io/EntryReader.hxx"
 
 class RCFHandler : public FileHandler
 {
 public:
     RCFHandler() {}
-    RCF rcf;
+    RcfArchive m_Archive;
 
-    struct FileNode
+    // Flat directory tree, nodes are addressed by index
+    RcfTree m_Tree;
+    uint32_t m_NodeSelected = RcfTree::npos;
+
+    // Path the tree root is labeled after
+    std::string m_RootPath;
+
+    // Trigram index over the entry paths, search ids map to entry indices
+    PathSearch m_Search;
+    std::vector<uint32_t> m_SearchEntries;
+    std::vector<bool> m_SearchIndexed;
+    std::vector<uint32_t> m_SearchResults;
+    char m_SearchQuery[256] = {};
+
+    // Copy of the selected entry the hex view shows, held while it is selected
+    EntryCache::Bytes m_SelectedBytes;
+
+    // Files read ahead of a selection, after and before it
+    static constexpr size_t PrefetchAhead = 16;
+    static constexpr size_t PrefetchBehind = 4;
+
+    // Name recovery runs on a worker of its own, the names it found are assigned on the UI thread
+    std::unique_ptr<RcfNameRecovery> m_Recovery;
+    std::thread m_RecoveryThread;
+    std::atomic<bool> m_bRecoveryDone = false;
+    std::vector<RcfNameRecovery::Match> m_RecoveredNames;
+
+    ~RCFHandler()
     {
-        std::string FullPath;
-        std::string FileName;
-        std::vector<FileNode> Children;
-        bool IsDirectory;
-        FileHandler::eFileType FileType;
-        RCFFilenameDirectoryEntry* entry = nullptr;
-        RCFDirectoryEntry* dir_entry = nullptr;
-    };
-
-    FileNode* m_RootNode;
-    FileNode* m_NodeSelected;
-
-    void LoadFile(std::string& filePath, int offset) override
+        StopRecovery();
+    }
+
+    void LoadFile(std::string& filePath, const FileView& view) override
     {
         std::cout << L"Loading RCF file: " << filePath << std::endl;
 
         m_bFileLoaded = false;
+        StopRecovery();
+
+        // Tables are parsed in place from the view, nested archives share the mapping of their parent.
+        // Archives opened before are restored with their tree from the index cache
+        if (view.GetFileOffset() != 0) std::wcout << L"Archive at offset: " << view.GetFileOffset() << std::endl;
+        m_RootPath = filePath;
+        m_NodeSelected = RcfTree::npos;
+        if (!RcfIndexCache::Open(m_Archive, m_Tree, view, m_RootPath.substr(m_RootPath.find_last_of('\\') + 1))) return;
+
+        m_Search.Clear();
+        m_SearchEntries.clear();
+        m_SearchIndexed.assign(m_Archive.GetEntryCount(), false);
+        IndexSearchPaths();
+        m_bFileLoaded = true;
+    }
+
+    // Adds the named entries missing from the search index, so recovered names become searchable
+    void IndexSearchPaths()
+    {
+        for (uint32_t i = 0; i < m_Archive.GetEntryCount(); i++) {
+            if (m_SearchIndexed[i] || m_Archive.GetEntry(i).path.empty()) continue;
+            m_Search.Add(m_Archive.GetEntry(i).path);
+            m_SearchEntries.push_back(i);
+            m_SearchIndexed[i] = true;
+        }
+        m_SearchResults = m_Search.Find(m_SearchQuery, 1000);
+    }
 
-        if (offset == -1) m_LoadedFilePath = filePath;
+    void CreateTreeNodesFromPaths()
+    {
+        m_NodeSelected = RcfTree::npos;
+        m_Tree.Build(m_Archive, m_RootPath.substr(m_RootPath.find_last_of('\\') + 1));
+    }
+
+    // Starts matching candidate names against the hashes of unnamed entries on a worker, the
+    // archive is only read until the worker is done and FinishRecovery assigns the names
+    void RecoverNames()
+    {
+        if (m_Recovery) {
+            std::cout << "Name recovery is already running." << std::endl;
+            return;
+        }
 
-        FILE* m_File = nullptr;
-        errno_t err = fopen_s(&m_File, filePath.c_str(), "rb");
-        if (err != 0 || m_File == nullptr) {
-            std::cerr << "Failed to open file!" << std::endl;
+        auto recovery = std::make_unique<RcfNameRecovery>();
+        recovery->AddTargets(m_Archive);
+        if (recovery->GetTargetCount() == 0) {
+            std::cout << "All entries are named." << std::endl;
             return;
         }
 
-        // Seek to the provided offset if provided
-        if (offset != -1) {
-            std::wcout << L"Seek to offset: " << offset << std::endl;
-            if (fseek(m_File, offset, SEEK_SET) != 0) {
-                std::wcerr << L"Error seeking to offset: " << offset << std::endl;
-                fclose(m_File);
-                return;
+        // Optional dictionary, one name per line
+        std::string dictionaryPath = OpenFileDlg();
+
+        m_Recovery = std::move(recovery);
+        m_bRecoveryDone = false;
+        m_RecoveryThread = std::thread([this, dictionaryPath]() {
+            // Strings out of the P3D files and the known directories and extensions
+            m_Recovery->HarvestArchive(m_Archive);
+            m_Recovery->AddTemplate("{$dirs}\\{$p3d}.{$exts}");
+            if (!dictionaryPath.empty() && m_Recovery->AddDictionary(dictionaryPath)) {
+                m_Recovery->AddTemplate("{$dirs}\\{$dict}.{$exts}");
             }
+            m_RecoveredNames = m_Recovery->Run();
+            m_bRecoveryDone = true;
+            });
+    }
+
+    // Assigns the names of a finished recovery and rebuilds the tree, called every frame
+    void FinishRecovery()
+    {
+        if (!m_Recovery || !m_bRecoveryDone) return;
+        m_RecoveryThread.join();
+
+        size_t named = 0;
+        for (auto& match : m_RecoveredNames) {
+            named += m_Archive.AssignName(match.hash, match.name);
+        }
+        std::cout << "Recovered " << named << " of " << m_Recovery->GetTargetCount() << " names." << std::endl;
+        m_RecoveredNames.clear();
+        m_Recovery.reset();
+
+        if (named > 0) {
+            CreateTreeNodesFromPaths();
+            IndexSearchPaths();
         }
+    }
 
-        // Read header
-        fread(&rcf.header, sizeof(RCFHeader), 1, m_File);
+    // Cancels a recovery in progress and drops what it found, before the archive changes
+    void StopRecovery()
+    {
+        if (!m_Recovery) return;
+        m_Recovery->Cancel();
+        if (m_RecoveryThread.joinable()) m_RecoveryThread.join();
+        m_RecoveredNames.clear();
+        m_Recovery.reset();
+    }
+
+    // Rebuilds the archive, files of an optional override folder replace or add entries
+    void Repack()
+    {
+        RcfWriter writer;
+        writer.AddArchive(m_Archive);
 
-        if (strcmp(rcf.header.file_id, "ATG CORE CEMENT LIBRARY") != 0) {
-            std::wcerr << L"Error: Not a valid RCF archive." << std::endl;
-            fclose(m_File);
+        std::string overrideDir = OpenFolderDlg();
+        if (!overrideDir.empty() && !writer.AddDirectory(overrideDir)) return;
+
+        std::string outputPath = SaveFileDlg();
+        if (outputPath.empty()) return;
+
+        if (PathIndex::PathEquals(outputPath, m_Archive.GetFilePath())) {
+            std::cerr << "Can't repack an archive over itself." << std::endl;
             return;
         }
+        writer.Write(outputPath);
+    }
 
-        // Read directory entries
-        fseek(m_File, rcf.header.dir_offset, SEEK_SET);
-        rcf.directory.resize(rcf.header.number_files);
-        fread(rcf.directory.data(), sizeof(RCFDirectoryEntry), rcf.header.number_files, m_File);
+    // Prints the identical entries of the loaded archive and of every archive in an optional folder
+    void ReportDuplicates()
+    {
+        RcfDedup dedup;
+        dedup.AddArchive(m_Archive);
+
+        std::vector<std::unique_ptr<RcfArchive>> archives;
+        std::string installDir = OpenFolderDlg();
+        if (!installDir.empty()) {
+            std::error_code error;
+            for (auto& item : std::filesystem::recursive_directory_iterator(installDir, error)) {
+                if (!item.is_regular_file() || !PathIndex::PathEquals(item.path().extension().string(), ".rcf")) continue;
+                if (PathIndex::PathEquals(item.path().string(), m_Archive.GetFilePath())) continue;
+
+                auto archive = std::make_unique<RcfArchive>();
+                if (!archive->Open(item.path().string())) continue;
+                dedup.AddArchive(*archive);
+                archives.push_back(std::move(archive));
+            }
+        }
 
-        // Sort directory entries by file offset
-        std::sort(rcf.directory.begin(), rcf.directory.end(), [](const RCFDirectoryEntry& a, const RCFDirectoryEntry& b) {
-            return a.fl_offset < b.fl_offset;
-            });
+        dedup.Run();
+        dedup.PrintReport();
+    }
 
-        // Read filename directory entries
-        fseek(m_File, (offset == -1) ? rcf.header.flnames_dir_offset + 8 : rcf.header.flnames_dir_offset + 8 + offset, SEEK_SET);
-        rcf.filename_directory.resize(rcf.header.number_files);
-        for (auto& entry : rcf.filename_directory) {
-            fread(&entry.date, sizeof(entry.date), 1, m_File);
-            fread(&entry.unk2, sizeof(entry.unk2), 1, m_File);
-            fread(&entry.unk3, sizeof(entry.unk3), 1, m_File);
-            fread(&entry.path_len, sizeof(entry.path_len), 1, m_File);
-            char* path_buffer = new char[entry.path_len - 1];
-            fread(path_buffer, entry.path_len - 1, 1, m_File);
-            entry.path = std::string(path_buffer, entry.path_len - 1);
-            delete[] path_buffer;
-            fread(&entry.padding, sizeof(entry.padding), 1, m_File);
-        }
+    // Prints what changed from the loaded archive to another version of it
+    void Compare()
+    {
+        std::string filePath = OpenFileDlg();
+        if (filePath.empty()) return;
 
-        // Close the file
-        fclose(m_File);
+        RcfArchive other;
+        if (!other.Open(filePath)) return;
 
-        m_RootNode = new FileNode();
+        RcfDiff diff;
+        diff.Run(m_Archive, other);
+        diff.Print();
+    }
 
-        m_RootNode->FullPath = (offset == -1) ? std::string(filePath.begin(), filePath.end()) : std::string(m_selectedFilePath.begin(), m_selectedFilePath.end());
-        m_RootNode->FileName = m_RootNode->FullPath.substr(m_RootNode->FullPath.find_last_of('\\') + 1);
-        m_RootNode->IsDirectory = true;
-        CreateTreeNodesFromPaths(m_RootNode);
-        m_bFileLoaded = true;
+    // Writes a delta from the loaded archive to a newer version of it
+    void CreateDelta()
+    {
+        if (!m_Archive.GetSourceView().IsWholeFile()) {
+            std::cerr << "Can't make a delta of an archive nested in another file." << std::endl;
+            return;
+        }
+        if (m_Archive.IsPacked()) {
+            std::cerr << "Can't make a delta of a packed archive, repack it first." << std::endl;
+            return;
+        }
+
+        std::string newFilePath = OpenFileDlg();
+        if (newFilePath.empty()) return;
+        std::string deltaFilePath = SaveFileDlg();
+        if (deltaFilePath.empty()) return;
+        RcfDelta::Create(m_Archive.GetFilePath(), newFilePath, deltaFilePath);
     }
 
-    void CreateTreeNodesFromPaths(FileNode* parentNode)
+    // Rebuilds a newer version of the loaded archive from a delta
+    void ApplyDelta()
     {
-        for (auto& filenameEntry : rcf.filename_directory) {
-            std::string directoryPath = filenameEntry.path.substr(0, filenameEntry.path.find_last_of('\\'));
+        if (!m_Archive.GetSourceView().IsWholeFile()) {
+            std::cerr << "Can't apply a delta to an archive nested in another file." << std::endl;
+            return;
+        }
+        if (m_Archive.IsPacked()) {
+            std::cerr << "Can't apply a delta to a packed archive, repack it first." << std::endl;
+            return;
+        }
 
-            std::string fileName = g_FileHandler->ExtractFileName(filenameEntry.path);
+        std::string deltaFilePath = OpenFileDlg();
+        if (deltaFilePath.empty()) return;
+        std::string outputPath = SaveFileDlg();
+        if (outputPath.empty()) return;
+        RcfDelta::Apply(m_Archive.GetFilePath(), deltaFilePath, outputPath);
+    }
 
-            std::istringstream iss(directoryPath);
-            std::string directory;
-            FileNode* currentNode = parentNode;
-            if (directoryPath != fileName)
-            {
-                while (std::getline(iss, directory, '\\')) {
-                    bool found = false;
-                    for (auto& child : currentNode->Children) {
-                        if (child.FileName == directory && child.IsDirectory) {
-                            currentNode = &child;
-                            found = true;
-                            break;
-                        }
-                    }
-
-                    if (!found) {
-                        FileNode newNode;
-                        newNode.FileName = directory;
-                        newNode.FullPath = directory;
-                        newNode.FileType = eFileType::DIR_FILE;
-                        newNode.IsDirectory = true;
-                        currentNode->Children.push_back(newNode);
-                        currentNode = &currentNode->Children.back();
-                    }
-                }
-            }
+    // Writes the loaded archive as a block pack, entries of the pack open with a single block unpacked
+    void Pack(BlockPack::Codec codec)
+    {
+        std::string outputPath = SaveFileDlg();
+        if (outputPath.empty()) return;
+        if (PathIndex::PathEquals(outputPath, m_Archive.GetFilePath())) {
+            std::cerr << "Can't pack over the archive being read." << std::endl;
+            return;
+        }
+        RcfPack::Create(m_Archive, outputPath, codec);
+    }
 
-            FileNode fileNode;
-            fileNode.FileName = ExtractFileName(filenameEntry.path);
-            fileNode.FullPath = filenameEntry.path;
-            fileNode.FileType = GetFileTypeFromExtension(GetFileExtension(filenameEntry.path));
-            fileNode.IsDirectory = false;
-            fileNode.entry = &filenameEntry;
-            currentNode->Children.push_back(fileNode);
+    // Patches the loaded archive in place with the files of a folder and reloads it
+    void Patch()
+    {
+        std::string patchDir = OpenFolderDlg();
+        if (patchDir.empty()) return;
+
+        if (!m_Archive.GetSourceView().IsWholeFile()) {
+            std::cerr << "Can't patch an archive nested in another file." << std::endl;
+            return;
+        }
+        if (m_Archive.IsPacked()) {
+            std::cerr << "Can't patch a packed archive, repack it first." << std::endl;
+            return;
         }
+
+        RcfPatcher patcher;
+        if (!patcher.SetDirectory(patchDir) || patcher.GetPatchCount() == 0) return;
+
+        // The archive can't stay mapped while it gets written
+        StopRecovery();
+        std::string archivePath = m_LoadedFilePath;
+        m_NodeSelected = RcfTree::npos;
+        m_Tree.Clear();
+        m_Search.Clear();
+        m_SearchResults.clear();
+        m_selectedFileView = {};
+        m_SelectedBytes.reset();
+        g_EntryCache.Clear();
+        m_bFileLoaded = false;
+        m_Archive.Close();
+
+        patcher.Apply(archivePath);
+
+        FileView view;
+        if (view.Open(archivePath))
+            LoadFile(m_RootPath, view);
     }
 
     std::string TimestampToString(uint32_t timestamp) {
@@ -152,119 +315,217 @@ public:
         return std::string(buffer);
     }
 
-    bool GetFileInformation(std::string path)
+    bool GetFileInformation(const RcfEntry& entry)
     {
-        int index = 0;
-        for (auto& filenameEntry : rcf.filename_directory) {
-            if (filenameEntry.path == path)
-            {
-                printf("File index: %d\n", index);
-                printf("File path: %s\n", path.c_str());
-                printf("File offset: %d\n", rcf.directory[index].fl_offset);
-                printf("File size: %d\n", rcf.directory[index].fl_size);
-                printf("File hash: %p\n", rcf.directory[index].hash);
-                std::wstring wPath(path.begin(), path.end());
-                GetFileContent(g_FileHandler->m_LoadedFilePath, rcf.directory[index].fl_offset, rcf.directory[index].fl_size);
-                return true;
-            }
-            index++;
+        printf("File index: %zu\n", static_cast<size_t>(&entry - m_Archive.GetEntries().data()));
+        printf("File path: %.*s\n", static_cast<int>(entry.path.size()), entry.path.data());
+        printf("File offset: %u\n", entry.dir->fl_offset);
+        printf("File size: %u\n", entry.dir->fl_size);
+        printf("File hash: %08X\n", entry.dir->hash);
+
+        // Entries come from the shared cache, the ones too large for it straight from the archive mapping
+        FileView view = m_Archive.GetEntryView(entry);
+        m_SelectedBytes = g_EntryCache.Load(view);
+        m_selectedFileView = m_SelectedBytes ? std::span<const uint8_t>(*m_SelectedBytes) : view.GetSpan();
+        m_selectedFileSize = m_selectedFileView.size();
+        return true;
+    }
+
+    // Saves the selected entry to disc, streamed from the archive a chunk at a time
+    void ExportSelected()
+    {
+        const RcfEntry* entry = m_Archive.FindEntry(m_selectedFilePath);
+        if (entry == nullptr) return;
+
+        std::string outputPath = SaveFileDlg();
+        if (outputPath.empty()) return;
+
+        FILE* file = fopen(outputPath.c_str(), "wb");
+        if (file == nullptr) {
+            std::cerr << "Failed to open " << outputPath << " for writing" << std::endl;
+            return;
         }
 
-        return false;
+        EntryReader reader(m_Archive.GetEntryView(*entry));
+        bool written = reader.ForEachChunk([file](std::span<const uint8_t> chunk, uint64_t) {
+            return fwrite(chunk.data(), 1, chunk.size(), file) == chunk.size();
+            });
+        written = (fclose(file) == 0) && written;
+        if (!written) std::cerr << "Failed to write " << outputPath << std::endl;
     }
 
-    void DisplayDirectoryNode(FileNode* parentNode)
+    // Reads the files next to the selected node ahead, the following ones first
+    void PrefetchSiblings(uint32_t nodeIndex)
     {
-        if (parentNode != nullptr)
-        {
-            ImGui::PushID(parentNode);
+        const RcfTree::Node& node = m_Tree.GetNode(nodeIndex);
+        if (node.parent == RcfTree::npos) return;
+
+        std::vector<uint32_t> siblings;
+        size_t position = 0;
+        for (uint32_t child = m_Tree.GetNode(node.parent).firstChild; child != RcfTree::npos; child = m_Tree.GetNode(child).nextSibling) {
+            if (child == nodeIndex) position = siblings.size();
+            if (!m_Tree.GetNode(child).IsDirectory()) siblings.push_back(child);
+        }
 
-            ImGuiTreeNodeFlags m_TreeNodeFlags = IMGUI_TREENODE_FLAGS;
-            if (m_NodeSelected == parentNode)
-                m_TreeNodeFlags |= ImGuiTreeNodeFlags_Selected;
+        // Packed entries are unpacked by the cache workers, not here
+        std::vector<FileView> views;
+        for (size_t i = position + 1; i < siblings.size() && i <= position + PrefetchAhead; i++)
+            views.push_back(m_Archive.GetLazyEntryView(m_Archive.GetEntry(m_Tree.GetNode(siblings[i]).entry)));
+        for (size_t i = position; i > 0 && position - i < PrefetchBehind; i--)
+            views.push_back(m_Archive.GetLazyEntryView(m_Archive.GetEntry(m_Tree.GetNode(siblings[i - 1]).entry)));
+        g_EntryCache.Prefetch(std::move(views), m_Archive.GetViewLoader());
+    }
 
-            if (parentNode->IsDirectory)
+    // Reads the search results after the selected one ahead
+    void PrefetchResults(size_t resultIndex)
+    {
+        std::vector<FileView> views;
+        for (size_t i = resultIndex + 1; i < m_SearchResults.size() && i <= resultIndex + PrefetchAhead; i++)
+            views.push_back(m_Archive.GetLazyEntryView(m_Archive.GetEntry(m_SearchEntries[m_SearchResults[i]])));
+        g_EntryCache.Prefetch(std::move(views), m_Archive.GetViewLoader());
+    }
+
+    bool GetFileInformation(std::string path)
+    {
+        const RcfEntry* entry = m_Archive.FindEntry(path);
+        return (entry != nullptr) && GetFileInformation(*entry);
+    }
+
+    void DisplayDirectoryNode(uint32_t nodeIndex)
+    {
+        const RcfTree::Node& node = m_Tree.GetNode(nodeIndex);
+        ImGui::PushID(static_cast<int>(nodeIndex));
+
+        ImGuiTreeNodeFlags m_TreeNodeFlags = IMGUI_TREENODE_FLAGS;
+        if (m_NodeSelected == nodeIndex)
+            m_TreeNodeFlags |= ImGuiTreeNodeFlags_Selected;
+
+        // Names are views into the archive paths and aren't null terminated
+        int nameLength = static_cast<int>(node.name.size());
+
+        if (node.IsDirectory())
+        {
+            if (ImGui::TreeNodeEx("##Node", m_TreeNodeFlags, "%.*s", nameLength, node.name.data()))
             {
-                if (ImGui::TreeNodeEx(parentNode->FileName.c_str(), m_TreeNodeFlags))
-                {
-                    for (FileNode& childNode : parentNode->Children)
-                        DisplayDirectoryNode(&childNode);
-                    ImGui::TreePop();
-                }
+                for (uint32_t child = node.firstChild; child != RcfTree::npos; child = m_Tree.GetNode(child).nextSibling)
+                    DisplayDirectoryNode(child);
+                ImGui::TreePop();
             }
-            else
+        }
+        else
+        {
+            const RcfEntry& entry = m_Archive.GetEntry(node.entry);
+            if (ImGui::TreeNodeEx("##Node", m_TreeNodeFlags | ImGuiTreeNodeFlags_NoTreePushOnOpen | ImGuiTreeNodeFlags_Leaf | ImGuiTreeNodeFlags_SpanFullWidth, "%.*s", nameLength, node.name.data()))
             {
-                if (ImGui::TreeNodeEx(parentNode->FileName.c_str(), m_TreeNodeFlags | ImGuiTreeNodeFlags_NoTreePushOnOpen | ImGuiTreeNodeFlags_Leaf | ImGuiTreeNodeFlags_SpanFullWidth))
+                if (ImGui::IsItemClicked(0))
                 {
-                    if (ImGui::IsItemClicked(0))
-                    {
-                        g_FileHandler->m_selectedFilePath = parentNode->FullPath;
-                        printf("Clicked file: %s\n", g_FileHandler->m_selectedFilePath.c_str());
-                        GetFileInformation(g_FileHandler->m_selectedFilePath);
-                    }
+                    g_FileHandler->m_selectedFilePath = std::string(entry.path);
+                    printf("Clicked file: %s\n", g_FileHandler->m_selectedFilePath.c_str());
+                    GetFileInformation(entry);
+                    PrefetchSiblings(nodeIndex);
                 }
 
-                if (ImGui_ToolTipHover())
+                // Nested archives and P3D files open as a window into this archive
+                if (ImGui::IsItemHovered() && ImGui::IsMouseDoubleClicked(0))
                 {
-                    parentNode->dir_entry = GetDirectoryEntry(rcf, parentNode->FullPath);
-                    std::pair<const char*, std::string> m_ResourceInfoList[] =
-                    {
-                        { "Name",          parentNode->FileName },
-                        { "Path",          parentNode->FullPath },
-                        { "Type",          GetFileExtensionFromType(parentNode->FileType) },
-                        { "Date",          (parentNode->entry) ? TimestampToString(parentNode->entry->date) : "-" },
-                        { "Size",          (parentNode->dir_entry) ? std::to_string(parentNode->dir_entry->fl_size) : "-" },
-                    };
-
-                    // Loop through the m_ResourceInfoList array
-                    for (auto& m_Pair : m_ResourceInfoList)
-                    {
-                        ImGui::Text("%s:", m_Pair.first);
-                        ImGui::SameLine(80.f);
-                        ImGui::PushStyleColor(ImGuiCol_Text, IMGUI_COLOR_TEXT2);
-                        ImGui::Text(&m_Pair.second[0]);
-                        ImGui::PopStyleColor();
-                    }
-
-                    ImGui::EndTooltip();
+                    std::string path(entry.path);
+                    eFileType type = GetFileTypeFromExtension(GetFileExtension(path));
+                    if (type == eFileType::RCF_FILE || type == eFileType::P3D_FILE)
+                        OpenEmbeddedFile(path, m_Archive.GetEntryView(entry));
                 }
             }
 
-            // Mark node as selected
-            if (ImGui::IsItemClicked() && !ImGui::IsItemToggledOpen())
-                m_NodeSelected = parentNode;
+            if (ImGui_ToolTipHover())
+            {
+                std::string path(entry.path);
+                std::pair<const char*, std::string> m_ResourceInfoList[] =
+                {
+                    { "Name",          std::string(node.name) },
+                    { "Path",          path },
+                    { "Type",          GetFileExtensionFromType(GetFileTypeFromExtension(GetFileExtension(path))) },
+                    { "Date",          (entry.name) ? TimestampToString(entry.name->date) : "-" },
+                    { "Size",          std::to_string(entry.dir->fl_size) },
+                };
+
+                // Loop through the m_ResourceInfoList array
+                for (auto& m_Pair : m_ResourceInfoList)
+                {
+                    ImGui::Text("%s:", m_Pair.first);
+                    ImGui::SameLine(80.f);
+                    ImGui::PushStyleColor(ImGuiCol_Text, IMGUI_COLOR_TEXT2);
+                    ImGui::Text(&m_Pair.second[0]);
+                    ImGui::PopStyleColor();
+                }
 
-            ImGui::PopID();
+                ImGui::EndTooltip();
+            }
         }
+
+        // Mark node as selected
+        if (ImGui::IsItemClicked() && !ImGui::IsItemToggledOpen())
+            m_NodeSelected = nodeIndex;
+
+        ImGui::PopID();
     }
 
     void RenderTree()
     {
-        if (g_FileHandler->m_bFileLoaded)
-            DisplayDirectoryNode(m_RootNode);
+        if (!g_FileHandler->m_bFileLoaded || m_Tree.IsEmpty()) return;
+
+        ImGui::SetNextItemWidth(-FLT_MIN);
+        if (ImGui::InputTextWithHint("##Search", "Search: text, *glob* or /regex/", m_SearchQuery, sizeof(m_SearchQuery)))
+            m_SearchResults = m_Search.Find(m_SearchQuery, 1000);
+
+        if (m_SearchQuery[0] == '\0')
+        {
+            DisplayDirectoryNode(0);
+            return;
+        }
+
+        // Only the visible results get a label
+        ImGuiListClipper m_Clipper;
+        m_Clipper.Begin(static_cast<int>(m_SearchResults.size()));
+        while (m_Clipper.Step())
+        {
+            for (int i = m_Clipper.DisplayStart; i < m_Clipper.DisplayEnd; i++)
+            {
+                const RcfEntry& entry = m_Archive.GetEntry(m_SearchEntries[m_SearchResults[i]]);
+                std::string path(entry.path);
+
+                ImGui::PushID(i);
+                if (ImGui::Selectable(path.c_str(), g_FileHandler->m_selectedFilePath == path))
+                {
+                    g_FileHandler->m_selectedFilePath = path;
+                    GetFileInformation(entry);
+                    PrefetchResults(i);
+                }
+                ImGui::PopID();
+            }
+        }
     }
 
     void RenderPropetries()
     {
-        if (m_NodeSelected)
+        if (m_NodeSelected != RcfTree::npos)
         {
-            if (m_NodeSelected->entry != nullptr)
+            const RcfTree::Node& node = m_Tree.GetNode(m_NodeSelected);
+            if (!node.IsDirectory())
             {
-                ImGui::Text(m_NodeSelected->entry->path.c_str());
-            }
-            if (m_NodeSelected->dir_entry != nullptr)
-            {
-                ImGui::Text("%d", m_NodeSelected->dir_entry->fl_size);
+                const RcfEntry& entry = m_Archive.GetEntry(node.entry);
+                ImGui::Text("%.*s", static_cast<int>(entry.path.size()), entry.path.data());
+                ImGui::Text("%u", entry.dir->fl_size);
             }
         }
     }
 
     void RenderHex()
     {
-        if (m_selectedfileContent.size() > 0)
+        if (m_selectedFileView.size() > 0)
         {
+            // Entry data lives in the read-only archive mapping
             static MemoryEditor m_MemoryEdit;
-            m_MemoryEdit.DrawContents(m_selectedfileContent.data(), m_selectedFileSize);
+            m_MemoryEdit.ReadOnly = true;
+            m_MemoryEdit.DrawContents(const_cast<uint8_t*>(m_selectedFileView.data()), m_selectedFileView.size());
         }
     }
 
@@ -297,7 +558,7 @@ public:
             ImGui::DockBuilderFinish(m_DockSpaceID);
         }
 
-        bool m_OpenFile = false, m_SaveFile = false;
+        bool m_OpenFile = false, m_SaveFile = false, m_RecoverNames = false, m_ExtractAll = false, m_Repack = false, m_Patch = false, m_ReportDuplicates = false, m_Compare = false, m_CreateDelta = false, m_ApplyDelta = false, m_PackFast = false, m_PackSmall = false;
 
         if (ImGui::BeginMenuBar())
         {
@@ -309,6 +570,38 @@ public:
 
                 ImGui::EndMenu();
             }
+            if (ImGui::BeginMenu(u8"\uF0AD Tools"))
+            {
+                if (ImGui::MenuItemEx("Recover Names", u8"\uF002"))
+                    m_RecoverNames = true;
+                if (ImGui::MenuItemEx("Extract All", u8"\uF56E"))
+                    m_ExtractAll = true;
+                if (ImGui::MenuItemEx("Repack", u8"\uF1C6"))
+                    m_Repack = true;
+                if (ImGui::MenuItemEx("Patch From Folder", u8"\uF0C7"))
+                    m_Patch = true;
+                if (ImGui::MenuItemEx("Duplicate Report", u8"\uF0C5"))
+                    m_ReportDuplicates = true;
+                if (ImGui::MenuItemEx("Compare With", u8"\uF0EC"))
+                    m_Compare = true;
+                if (ImGui::MenuItemEx("Create Delta", u8"\uF56E"))
+                    m_CreateDelta = true;
+                if (ImGui::MenuItemEx("Apply Delta", u8"\uF56F"))
+                    m_ApplyDelta = true;
+                if (ImGui::MenuItemEx("Pack For Speed", u8"\uF1C6"))
+                    m_PackFast = true;
+                if (ImGui::MenuItemEx("Pack For Size", u8"\uF1C6"))
+                    m_PackSmall = true;
+
+                ImGui::EndMenu();
+            }
+
+            // Progress of a name recovery running in the background
+            if (m_Recovery) {
+                ImGui::Text("Recovering names, %.1f M tested", m_Recovery->GetTestedCount() / 1e6);
+                if (ImGui::MenuItem("Cancel"))
+                    m_Recovery->Cancel();
+            }
         }
 
         // Shortcuts
@@ -349,6 +642,44 @@ public:
             }
         }
 
+        if (m_SaveFile)
+            ExportSelected();
+
+        if (m_RecoverNames)
+            RecoverNames();
+        FinishRecovery();
+
+        if (m_ExtractAll)
+        {
+            std::string outputDir = OpenFolderDlg();
+            if (!outputDir.empty())
+                RcfExtractor::Extract(m_Archive, outputDir);
+        }
+
+        if (m_Repack)
+            Repack();
+
+        if (m_Patch)
+            Patch();
+
+        if (m_ReportDuplicates)
+            ReportDuplicates();
+
+        if (m_Compare)
+            Compare();
+
+        if (m_CreateDelta)
+            CreateDelta();
+
+        if (m_ApplyDelta)
+            ApplyDelta();
+
+        if (m_PackFast)
+            Pack(BlockPack::GetFastCodec());
+
+        if (m_PackSmall)
+            Pack(BlockPack::GetSmallCodec());
+
         ImGui::End();
     }
 
@@ -0,0 +1,333 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <span>
+#include <memory>
+#include <functional>
+#include <algorithm>
+#include <iostream>
+
+#include "RCF.h"
+#include "../io/FileView.hxx"
+#include "../io/BlockPack.hxx"
+#include "../io/PathIndex.hxx"
+#include "RcfHash.hxx"
+
+// Single file of a cement library, both tables viewed straight from the mapping.
+// Entries missing from the filename directory have no name and an empty path
+struct RcfEntry {
+    const RCFDirectoryEntry* dir = nullptr;
+    const RCFFilenameEntryHeader* name = nullptr;
+    std::string_view path;
+};
+
+// Cement library mapped once from disc, tables and entry data are handed out as
+// views over the mapping instead of being read and copied on every access
+class RcfArchive
+{
+public:
+    // Maps the archive, baseOffset locates an archive embedded in a bigger file
+    bool Open(const std::string& filePath, uint64_t baseOffset = 0)
+    {
+        FileView file;
+        if (!file.Open(filePath)) {
+            Close();
+            std::cerr << "Failed to open file!" << std::endl;
+            return false;
+        }
+        return Open(file.GetSubView(baseOffset));
+    }
+
+    // Parses the archive seen through the view, sharing its mapping
+    bool Open(const FileView& view)
+    {
+        Close();
+
+        if (!view.IsOpen()) {
+            std::wcerr << L"Error: RCF archive is out of the file." << std::endl;
+            return false;
+        }
+
+        if (!SetView(view) || !Parse()) {
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    void Close()
+    {
+        m_Index.Clear();
+        m_AssignedNames.clear();
+        m_Entries.clear();
+        m_Directory = {};
+        m_Header = nullptr;
+        m_Data = {};
+        m_View.Close();
+        m_Pack.reset();
+    }
+
+    bool IsOpen() const { return m_Header != nullptr; }
+
+    const RCFHeader& GetHeader() const { return *m_Header; }
+
+    // True when the archive was opened from a block pack, entries are unpacked as they are asked for
+    bool IsPacked() const { return m_Pack != nullptr; }
+
+    // Directory as stored in the archive
+    std::span<const RCFDirectoryEntry> GetDirectory() const { return m_Directory; }
+
+    // Entries sorted by file offset, paired with the filename directory
+    const std::vector<RcfEntry>& GetEntries() const { return m_Entries; }
+
+    size_t GetEntryCount() const { return m_Entries.size(); }
+
+    const RcfEntry& GetEntry(size_t index) const { return m_Entries[index]; }
+
+    // Whole archive bytes, a packed archive is unpacked in full first
+    std::span<const uint8_t> GetData() const
+    {
+        if (m_Pack) m_Pack->LoadAll();
+        return m_Data;
+    }
+
+    // Entry bytes, empty when the entry points outside of the archive
+    std::span<const uint8_t> GetEntryData(const RcfEntry& entry) const
+    {
+        if (m_Pack) m_Pack->Load(entry.dir->fl_offset, entry.dir->fl_size);
+        return GetRange(entry.dir->fl_offset, entry.dir->fl_size);
+    }
+
+    // Finds the entry stored with the given path, case and separator insensitive
+    const RcfEntry* FindEntry(std::string_view path) const
+    {
+        uint32_t index = m_Index.Find(path);
+        return (index != PathIndex::npos) ? &m_Entries[index] : nullptr;
+    }
+
+    // Names every unnamed entry stored with the given hash, used for recovered names
+    size_t AssignName(uint32_t hash, std::string_view path)
+    {
+        size_t count = 0;
+        for (uint32_t i = 0; i < m_Entries.size(); i++) {
+            RcfEntry& entry = m_Entries[i];
+            if (!entry.path.empty() || entry.dir->hash != hash) continue;
+
+            if (count == 0) m_AssignedNames.emplace_back(path);
+            entry.path = m_AssignedNames.back();
+            m_Index.Insert(entry.path, i);
+            count++;
+        }
+        return count;
+    }
+
+    // Entry as a view of its own, for opening files nested in the archive
+    FileView GetEntryView(const RcfEntry& entry) const
+    {
+        if (m_Pack) m_Pack->Load(entry.dir->fl_offset, entry.dir->fl_size);
+        return m_View.GetSubView(entry.dir->fl_offset, entry.dir->fl_size);
+    }
+
+    // Entry as a view without unpacking it, for readers running the loader of GetViewLoader first
+    FileView GetLazyEntryView(const RcfEntry& entry) const
+    {
+        return m_View.GetSubView(entry.dir->fl_offset, entry.dir->fl_size);
+    }
+
+    // Unpacks the bytes of a view of the archive, null for archives that aren't packed. The loader
+    // holds on to the pack, so it stays usable on workers once the archive is closed
+    std::function<void(const FileView&)> GetViewLoader() const
+    {
+        if (!m_Pack) return nullptr;
+        return [pack = m_Pack, base = m_View.GetFileOffset()](const FileView& view) { pack->Load(view.GetFileOffset() - base, view.Size()); };
+    }
+
+    // Absolute path of the mapped file on disc holding the archive
+    const std::string& GetFilePath() const { return m_View.GetFilePath(); }
+
+    // View of the archive bytes, a packed archive is unpacked in full first
+    const FileView& GetView() const
+    {
+        if (m_Pack) m_Pack->LoadAll();
+        return m_View;
+    }
+
+    // View the archive was opened from, the pack itself for packed archives
+    const FileView& GetSourceView() const { return m_Pack ? m_Pack->GetPackedView() : m_View; }
+
+    // Mapped file holding the archive, for callers going through the OS with file offsets
+    const MappedFile& GetFile() const { return m_View.GetFile(); }
+
+    // Position of the entry data in the file on disc
+    uint64_t GetEntryFileOffset(const RcfEntry& entry) const { return m_View.GetFileOffset() + entry.dir->fl_offset; }
+
+private:
+    friend class RcfIndexCache;
+
+    FileView m_View;
+    std::span<const uint8_t> m_Data;
+    std::shared_ptr<const BlockPack> m_Pack;
+    const RCFHeader* m_Header = nullptr;
+    std::span<const RCFDirectoryEntry> m_Directory;
+    std::vector<RcfEntry> m_Entries;
+    std::deque<std::string> m_AssignedNames;
+    PathIndex m_Index;
+
+    static void SetName(RcfEntry& entry, const RCFFilenameEntryHeader* name)
+    {
+        entry.name = name;
+        entry.path = std::string_view(reinterpret_cast<const char*>(name + 1), name->path_len - 1);
+    }
+
+    // Pairs every name with the unnamed entry carrying its hash, fails if any name has no entry
+    bool PairNamesByHash(const std::vector<const RCFFilenameEntryHeader*>& names)
+    {
+        std::vector<uint32_t> byHash(m_Entries.size());
+        for (uint32_t i = 0; i < byHash.size(); i++) byHash[i] = i;
+        std::sort(byHash.begin(), byHash.end(), [this](uint32_t a, uint32_t b) {
+            return m_Entries[a].dir->hash < m_Entries[b].dir->hash;
+            });
+
+        std::vector<const RCFFilenameEntryHeader*> paired(m_Entries.size(), nullptr);
+        for (auto name : names) {
+            uint32_t hash = RcfHash::HashName(std::string_view(reinterpret_cast<const char*>(name + 1), name->path_len - 1));
+            auto it = std::lower_bound(byHash.begin(), byHash.end(), hash, [this](uint32_t index, uint32_t value) {
+                return m_Entries[index].dir->hash < value;
+                });
+            while (it != byHash.end() && m_Entries[*it].dir->hash == hash && paired[*it] != nullptr) ++it;
+            if (it == byHash.end() || m_Entries[*it].dir->hash != hash) return false;
+            paired[*it] = name;
+        }
+
+        for (size_t i = 0; i < paired.size(); i++) {
+            if (paired[i] != nullptr) SetName(m_Entries[i], paired[i]);
+        }
+        return true;
+    }
+
+    // True when the path holds a byte below a space, eight bytes per step
+    static bool HasControlChars(std::string_view path)
+    {
+        constexpr uint64_t ones = 0x0101010101010101ull;
+        size_t i = 0;
+        for (; i + sizeof(uint64_t) <= path.size(); i += sizeof(uint64_t)) {
+            uint64_t word;
+            memcpy(&word, path.data() + i, sizeof(word));
+            if ((word - ones * 0x20) & ~word & (ones * 0x80)) return true;
+        }
+        for (; i < path.size(); i++) {
+            if (static_cast<uint8_t>(path[i]) < 0x20) return true;
+        }
+        return false;
+    }
+
+    // Collects the filename directory straight from the mapped table. The walk only follows the
+    // entry lengths, every path is checked afterwards in one pass and the table ends at a bad one
+    void ScanNames(std::vector<const RCFFilenameEntryHeader*>& names) const
+    {
+        names.reserve(m_Entries.size());
+        uint64_t position = uint64_t(m_Header->flnames_dir_offset) + 8;
+        uint64_t tableEnd = (std::min)(position + m_Header->flnames_dir_size, uint64_t(m_Data.size()));
+        while (names.size() < m_Entries.size() && position + sizeof(RCFFilenameEntryHeader) <= tableEnd) {
+            auto name = reinterpret_cast<const RCFFilenameEntryHeader*>(m_Data.data() + position);
+            uint64_t entrySize = sizeof(RCFFilenameEntryHeader) + uint64_t(name->path_len) - 1 + sizeof(uint32_t);
+            if (name->path_len == 0 || position + entrySize > tableEnd) break;
+
+            names.push_back(name);
+            position += entrySize;
+        }
+
+        for (size_t i = 0; i < names.size(); i++) {
+            std::string_view path(reinterpret_cast<const char*>(names[i] + 1), names[i]->path_len - 1);
+            if (HasControlChars(path)) {
+                std::wcerr << L"Warning: RCF filename directory is corrupt after " << i << L" names." << std::endl;
+                names.resize(i);
+                break;
+            }
+        }
+    }
+
+    // Views the archive bytes, block packs are opened with their tables unpacked
+    bool SetView(const FileView& view)
+    {
+        m_Pack.reset();
+        m_View = view;
+        if (BlockPack::IsPack(view)) {
+            auto pack = std::make_shared<BlockPack>();
+            if (!pack->Open(view)) return false;
+            m_View = pack->GetView();
+            m_Pack = std::move(pack);
+        }
+        m_Data = m_View.GetSpan();
+        return true;
+    }
+
+    std::span<const uint8_t> GetRange(uint64_t offset, uint64_t size) const
+    {
+        if (offset > m_Data.size() || size > m_Data.size() - offset) return {};
+        return m_Data.subspan(static_cast<size_t>(offset), static_cast<size_t>(size));
+    }
+
+    // Checks the header and views the directory
+    bool ParseHeader()
+    {
+        if (m_Data.size() < sizeof(RCFHeader)) {
+            std::wcerr << L"Error: Not a valid RCF archive." << std::endl;
+            return false;
+        }
+
+        auto header = reinterpret_cast<const RCFHeader*>(m_Data.data());
+        if (strncmp(header->file_id, "ATG CORE CEMENT LIBRARY", sizeof(header->file_id)) != 0) {
+            std::wcerr << L"Error: Not a valid RCF archive." << std::endl;
+            return false;
+        }
+
+        // Directory entries
+        auto directory = GetRange(header->dir_offset, uint64_t(header->number_files) * sizeof(RCFDirectoryEntry));
+        if (directory.size() != uint64_t(header->number_files) * sizeof(RCFDirectoryEntry)) {
+            std::wcerr << L"Error: RCF directory is out of the file." << std::endl;
+            return false;
+        }
+        m_Header = header;
+        m_Directory = { reinterpret_cast<const RCFDirectoryEntry*>(directory.data()), header->number_files };
+        return true;
+    }
+
+    bool Parse()
+    {
+        if (!ParseHeader()) return false;
+
+        // Filename directory lists the files in data order, pair it with the directory sorted by offset
+        std::vector<uint32_t> order(m_Directory.size());
+        for (uint32_t i = 0; i < order.size(); i++) order[i] = i;
+        std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+            if (m_Directory[a].fl_offset != m_Directory[b].fl_offset) return m_Directory[a].fl_offset < m_Directory[b].fl_offset;
+            return a < b;
+            });
+
+        m_Entries.resize(m_Directory.size());
+        for (size_t i = 0; i < order.size(); i++) m_Entries[i].dir = &m_Directory[order[i]];
+
+        // Filename directory entries, the table may be cut short or hold less names than files
+        std::vector<const RCFFilenameEntryHeader*> names;
+        ScanNames(names);
+
+        // A complete table pairs by position, an incomplete one can only be paired through the name hash
+        if (names.size() == m_Entries.size() || !PairNamesByHash(names)) {
+            for (size_t i = 0; i < names.size(); i++) SetName(m_Entries[i], names[i]);
+        }
+
+        // Path lookup index over the paired entries, independent of any table order
+        m_Index.Reserve(m_Entries.size());
+        for (uint32_t i = 0; i < m_Entries.size(); i++) {
+            if (!m_Entries[i].path.empty()) m_Index.Insert(m_Entries[i].path, i);
+        }
+
+        return true;
+    }
+};
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <cstring>
+#include <vector>
+#include <span>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+#include "RcfArchive.hxx"
+#include "../io/EntryReader.hxx"
+#include "../io/ReadScheduler.hxx"
+
+// Finds entries with identical content within and across archives. Every entry is hashed
+// straight from its archive mapping by a pool of workers, entries of equal size and hash
+// are then compared byte by byte so a hash collision never merges different files
+class RcfDedup
+{
+public:
+    struct Item {
+        const RcfArchive* archive;
+        const RcfEntry* entry;
+        uint64_t hash = 0;
+    };
+
+    // Items holding the same bytes, the first one is the copy that would be kept
+    struct Group {
+        uint64_t hash;
+        uint64_t size;
+        std::vector<uint32_t> items;
+
+        uint64_t GetWastedBytes() const { return size * (items.size() - 1); }
+    };
+
+    // Adds every entry of the archive, it has to stay open until the report is done
+    void AddArchive(const RcfArchive& archive)
+    {
+        for (auto& entry : archive.GetEntries()) m_Items.push_back({ &archive, &entry });
+    }
+
+    // Hashes every item and groups the identical ones, returns the wasted bytes
+    uint64_t Run(unsigned int threadCount = std::thread::hardware_concurrency())
+    {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::span<const uint8_t>> data(m_Items.size());
+        std::vector<uint64_t> hashes(m_Items.size());
+        std::vector<uint8_t> missing(m_Items.size(), 0);
+
+        // Entries of each archive are read in file order in a few large reads and hashed as they come in
+        for (size_t first = 0; first < m_Items.size();) {
+            const RcfArchive* archive = m_Items[first].archive;
+            ReadScheduler scheduler(archive->GetView());
+            size_t last = first;
+            for (; last < m_Items.size() && m_Items[last].archive == archive; last++) {
+                const RCFDirectoryEntry* dir = m_Items[last].entry->dir;
+                data[last] = archive->GetEntryData(*m_Items[last].entry);
+                scheduler.Submit(dir->fl_offset, dir->fl_size, last);
+            }
+
+            // Items whose read came back short are hashed from the mapping afterwards
+            bool ok = scheduler.Run([&](uint64_t item, std::span<const uint8_t> bytes) {
+                if (bytes.size() == data[item].size()) hashes[item] = ContentHash::Hash(bytes);
+                else missing[item] = 1;
+                }, threadCount);
+            if (!ok) std::cerr << "Failed to read some entries of " << archive->GetFilePath() << ", hashing them from the mapping" << std::endl;
+            for (size_t i = first; i < last; i++) {
+                if (missing[i]) hashes[i] = ContentHash::Hash(data[i]);
+            }
+            first = last;
+        }
+
+        uint64_t bytes = 0;
+        for (size_t i = 0; i < m_Items.size(); i++) {
+            m_Items[i].hash = hashes[i];
+            bytes += data[i].size();
+        }
+
+        m_Groups = GroupIdentical(data, hashes);
+        m_WastedBytes = 0;
+        for (auto& group : m_Groups) m_WastedBytes += group.GetWastedBytes();
+
+        m_Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("Hashed %zu entries, %.1f MB in %.2f s, %.1f MB/s\n", m_Items.size(), bytes / (1024.0 * 1024.0),
+            m_Seconds, (m_Seconds > 0.0) ? bytes / m_Seconds / (1024.0 * 1024.0) : 0.0);
+        return m_WastedBytes;
+    }
+
+    // Prints the summary and the groups wasting the most space
+    void PrintReport(size_t groupLimit = 20) const
+    {
+        size_t duplicates = 0;
+        for (auto& group : m_Groups) duplicates += group.items.size() - 1;
+        printf("%zu groups of identical entries, %zu duplicates, %.1f MB wasted\n", m_Groups.size(), duplicates, m_WastedBytes / (1024.0 * 1024.0));
+
+        for (size_t g = 0; g < m_Groups.size() && g < groupLimit; g++) {
+            const Group& group = m_Groups[g];
+            printf("%016llX %llu bytes x %zu, %.1f KB wasted\n", static_cast<unsigned long long>(group.hash),
+                static_cast<unsigned long long>(group.size), group.items.size(), group.GetWastedBytes() / 1024.0);
+            for (uint32_t index : group.items) {
+                const Item& item = m_Items[index];
+                std::string_view path = item.entry->path.empty() ? std::string_view("<unnamed>") : item.entry->path;
+                printf("    %s: %.*s\n", item.archive->GetFilePath().c_str(), static_cast<int>(path.size()), path.data());
+            }
+        }
+    }
+
+    const std::vector<Item>& GetItems() const { return m_Items; }
+
+    // Groups sorted by wasted bytes, largest first
+    const std::vector<Group>& GetGroups() const { return m_Groups; }
+
+    uint64_t GetWastedBytes() const { return m_WastedBytes; }
+
+    // Content hash of every view or buffer, computed by a pool of workers taking them in order. Each is
+    // streamed in chunks, so entries of any size hash without staying in memory
+    template <typename Data>
+    static std::vector<uint64_t> HashAll(const std::vector<Data>& data, unsigned int threadCount = std::thread::hardware_concurrency())
+    {
+        if (threadCount == 0) threadCount = 1;
+
+        std::vector<uint64_t> hashes(data.size());
+        std::atomic<size_t> next = 0;
+        auto worker = [&]() {
+            for (size_t i = next++; i < data.size(); i = next++) hashes[i] = EntryReader(data[i]).Hash();
+        };
+
+        std::vector<std::thread> workers;
+        for (unsigned int t = 1; t < threadCount && t < data.size(); t++) workers.emplace_back(worker);
+        worker();
+        for (auto& thread : workers) thread.join();
+        return hashes;
+    }
+
+    // Groups of at least two buffers with the same bytes, items in a group keep their input order
+    static std::vector<Group> GroupIdentical(const std::vector<std::span<const uint8_t>>& data, const std::vector<uint64_t>& hashes)
+    {
+        std::vector<uint32_t> order(data.size());
+        for (uint32_t i = 0; i < order.size(); i++) order[i] = i;
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            if (data[a].size() != data[b].size()) return data[a].size() < data[b].size();
+            if (hashes[a] != hashes[b]) return hashes[a] < hashes[b];
+            return a < b;
+            });
+
+        std::vector<Group> groups;
+        for (size_t first = 0; first < order.size();) {
+            size_t last = first + 1;
+            while (last < order.size() && data[order[last]].size() == data[order[first]].size() && hashes[order[last]] == hashes[order[first]]) last++;
+
+            // Equal hashes are confirmed against the first copy of every distinct content
+            size_t groupStart = groups.size();
+            for (size_t i = first; i < last && last - first > 1; i++) {
+                auto& candidate = data[order[i]];
+                size_t g = groupStart;
+                while (g < groups.size() && memcmp(data[groups[g].items[0]].data(), candidate.data(), candidate.size()) != 0) g++;
+                if (g == groups.size()) groups.push_back({ hashes[order[i]], candidate.size(), {} });
+                groups[g].items.push_back(order[i]);
+            }
+            groups.erase(std::remove_if(groups.begin() + groupStart, groups.end(), [](const Group& group) { return group.items.size() < 2; }), groups.end());
+            first = last;
+        }
+
+        std::sort(groups.begin(), groups.end(), [](const Group& a, const Group& b) {
+            if (a.GetWastedBytes() != b.GetWastedBytes()) return a.GetWastedBytes() > b.GetWastedBytes();
+            return a.items[0] < b.items[0];
+            });
+        return groups;
+    }
+
+private:
+    std::vector<Item> m_Items;
+    std::vector<Group> m_Groups;
+    uint64_t m_WastedBytes = 0;
+    double m_Seconds = 0.0;
+};
@@ -0,0 +1,553 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <filesystem>
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+#include "RCF.h"
+#include "RcfArchive.hxx"
+#include "../io/MappedFile.hxx"
+#include "../io/ContentHash.hxx"
+
+// Binary delta between two versions of a cement library. The new file is described by
+// operations copying ranges of the old file, inserting bytes carried in the delta or filling
+// zeros. Every entry is encoded against the entry of the same path in the old archive with a
+// rolling block hash, the tables against the old tables. Encoding runs on a pool of workers,
+// applying fills a bounded ring of chunks on the workers while one writer streams them out
+class RcfDelta
+{
+public:
+    static constexpr uint32_t Version = 1;
+
+    struct Stats {
+        size_t operations = 0;
+        uint64_t copied = 0;
+        uint64_t inserted = 0;
+        uint64_t zeroed = 0;
+        double seconds = 0.0;
+    };
+
+    // Writes the delta turning the old archive into the new one
+    static bool Create(const std::string& oldFilePath, const std::string& newFilePath, const std::string& deltaFilePath,
+        unsigned int threadCount = std::thread::hardware_concurrency(), Stats* outStats = nullptr)
+    {
+        auto start = std::chrono::steady_clock::now();
+        if (threadCount == 0) threadCount = 1;
+
+        RcfArchive oldArchive, newArchive;
+        if (!oldArchive.Open(oldFilePath) || !newArchive.Open(newFilePath)) return false;
+
+        // Deltas are applied to the file as it is on disc, a pack would be matched unpacked
+        if (oldArchive.IsPacked()) {
+            std::cerr << "Can't make a delta from a packed archive, repack it first." << std::endl;
+            return false;
+        }
+        auto oldData = oldArchive.GetData();
+        auto newData = newArchive.GetData();
+
+        DeltaHeader header;
+        header.oldSize = oldData.size();
+        header.oldTablesHash = HashTables(oldData);
+        header.newSize = newData.size();
+
+        // The new file is hashed alongside the encoding, for the check after applying
+        std::vector<Segment> segments = GetSegments(oldArchive, newArchive);
+        std::thread hasher([&]() { header.newHash = HashChunks(newData, header.chunkSize); });
+
+        std::atomic<size_t> next = 0;
+        auto worker = [&]() {
+            for (size_t i = next++; i < segments.size(); i = next++) Encode(segments[i], oldData, newData);
+        };
+        std::vector<std::thread> workers;
+        for (unsigned int t = 1; t < threadCount && t < segments.size(); t++) workers.emplace_back(worker);
+        worker();
+        for (auto& thread : workers) thread.join();
+        hasher.join();
+
+        std::vector<Op> ops;
+        for (auto& segment : segments) {
+            for (auto& op : segment.ops) Append(ops, op);
+        }
+        segments.clear();
+
+        // Inserted bytes follow the operations in order, their sources turn into offsets there
+        Stats stats;
+        std::vector<std::pair<uint64_t, uint64_t>> inserts;
+        for (auto& op : ops) {
+            if (op.kind == Insert) {
+                inserts.emplace_back(op.source, op.length);
+                op.source = header.insertSize;
+                header.insertSize += op.length;
+                stats.inserted += op.length;
+            }
+            else if (op.kind == Copy) stats.copied += op.length;
+            else stats.zeroed += op.length;
+        }
+        header.opCount = ops.size();
+        stats.operations = ops.size();
+
+        FILE* file = fopen(deltaFilePath.c_str(), "wb");
+        if (file == nullptr) {
+            std::cerr << "Failed to open " << deltaFilePath << " for writing" << std::endl;
+            return false;
+        }
+
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+            fwrite(ops.data(), sizeof(Op), ops.size(), file) == ops.size();
+        for (size_t i = 0; i < inserts.size() && ok; i++) {
+            ok = fwrite(newData.data() + inserts[i].first, 1, inserts[i].second, file) == inserts[i].second;
+        }
+        ok = (fclose(file) == 0) && ok;
+        if (!ok) {
+            std::error_code error;
+            std::filesystem::remove(deltaFilePath, error);
+            std::cerr << "Failed to write " << deltaFilePath << std::endl;
+            return false;
+        }
+
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("Created %s: %zu operations, %.1f MB copied, %.1f MB inserted, %.1f MB zeroed in %.2f s\n", deltaFilePath.c_str(), stats.operations,
+            stats.copied / (1024.0 * 1024.0), stats.inserted / (1024.0 * 1024.0), stats.zeroed / (1024.0 * 1024.0), stats.seconds);
+        if (outStats) *outStats = stats;
+        return true;
+    }
+
+    // Rebuilds the new archive from the old one and the delta, the output is only put in place once verified
+    static bool Apply(const std::string& oldFilePath, const std::string& deltaFilePath, const std::string& outputFilePath,
+        unsigned int threadCount = std::thread::hardware_concurrency(), Stats* outStats = nullptr)
+    {
+        auto start = std::chrono::steady_clock::now();
+        if (threadCount == 0) threadCount = 1;
+
+        std::error_code error;
+        if (std::filesystem::equivalent(oldFilePath, outputFilePath, error)) {
+            std::cerr << "Can't apply a delta over the archive it is based on." << std::endl;
+            return false;
+        }
+
+        MappedFile oldFile, delta;
+        if (!oldFile.Open(oldFilePath) || !delta.Open(deltaFilePath)) {
+            std::cerr << "Failed to open file!" << std::endl;
+            return false;
+        }
+
+        DeltaHeader header;
+        std::vector<Op> ops;
+        std::vector<uint64_t> starts;
+        if (!ReadDelta(delta, header, ops, starts)) {
+            std::cerr << "Error: " << deltaFilePath << " is not a valid archive delta." << std::endl;
+            return false;
+        }
+        if (header.oldSize != oldFile.Size() || header.oldTablesHash != HashTables(oldFile.GetSpan())) {
+            std::cerr << "Error: " << deltaFilePath << " was not made for " << oldFilePath << std::endl;
+            return false;
+        }
+
+        Stats stats;
+        stats.operations = ops.size();
+        for (auto& op : ops) {
+            if (op.kind == Copy) stats.copied += op.length;
+            else if (op.kind == Insert) stats.inserted += op.length;
+            else stats.zeroed += op.length;
+        }
+
+        std::filesystem::path tempPath = outputFilePath;
+        tempPath += ".tmp";
+        FILE* file = fopen(tempPath.string().c_str(), "wb");
+        if (file == nullptr) {
+            std::cerr << "Failed to open " << outputFilePath << " for writing" << std::endl;
+            return false;
+        }
+
+        auto inserts = delta.GetSpan(sizeof(DeltaHeader) + ops.size() * sizeof(Op), header.insertSize);
+        uint64_t hash = 0;
+        bool ok = StreamOutput(file, header, ops, starts, oldFile.GetSpan(), inserts, threadCount, hash);
+        ok = (fclose(file) == 0) && ok;
+        if (ok && hash != header.newHash) {
+            std::cerr << "Error: " << outputFilePath << " doesn't match the archive the delta was made from." << std::endl;
+            ok = false;
+        }
+
+        if (ok) std::filesystem::rename(tempPath, outputFilePath, error);
+        if (!ok || error) {
+            std::filesystem::remove(tempPath, error);
+            std::cerr << "Failed to write " << outputFilePath << std::endl;
+            return false;
+        }
+
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("Wrote %s: %.1f MB in %.2f s, %.1f MB/s\n", outputFilePath.c_str(), header.newSize / (1024.0 * 1024.0), stats.seconds,
+            (stats.seconds > 0.0) ? header.newSize / stats.seconds / (1024.0 * 1024.0) : 0.0);
+        if (outStats) *outStats = stats;
+        return true;
+    }
+
+private:
+    enum OpKind : uint32_t {
+        Copy,
+        Insert,
+        Zero
+    };
+
+    // Copies source from the old file, inserts from source in the inserted bytes or fills zeros
+    struct Op {
+        uint32_t kind;
+        uint32_t reserved;
+        uint64_t source;
+        uint64_t length;
+    };
+
+    struct DeltaHeader {
+        char magic[8] = { 'T', 'K', 'R', 'C', 'F', 'D', 'L', 'T' };
+        uint32_t version = Version;
+        uint32_t chunkSize = 4 * 1024 * 1024;
+        uint64_t oldSize = 0;
+        uint64_t oldTablesHash = 0;
+        uint64_t newSize = 0;
+        uint64_t newHash = 0;
+        uint64_t opCount = 0;
+        uint64_t insertSize = 0;
+    };
+    static_assert(sizeof(DeltaHeader) % 8 == 0 && sizeof(Op) == 24, "Delta sections are 8 byte aligned");
+
+    // Range of the new file and the range of the old file it is encoded against
+    struct Segment {
+        uint64_t start;
+        uint64_t size;
+        uint64_t baseStart;
+        uint64_t baseSize;
+        std::vector<Op> ops;
+    };
+
+    // Zero runs shorter than this stay part of the inserted bytes
+    static constexpr uint64_t MinZeroRun = 32;
+
+    // Ring slots held while applying, bounds the memory to this many chunks
+    static constexpr size_t MaxSlots = 16;
+
+    // Sum of the bytes and sum of the running sums over a window, moved a byte at a time
+    struct RollingHash {
+        uint32_t a = 0;
+        uint32_t b = 0;
+        uint32_t size = 0;
+
+        void Reset(const uint8_t* data, uint32_t length)
+        {
+            a = b = 0;
+            size = length;
+            for (uint32_t i = 0; i < length; i++) {
+                a += data[i];
+                b += a;
+            }
+        }
+
+        void Roll(uint8_t out, uint8_t in)
+        {
+            a += uint32_t(in) - out;
+            b += a - size * uint32_t(out);
+        }
+
+        uint32_t Get() const { return (a & 0xFFFF) | (b << 16); }
+    };
+
+    static std::span<const uint8_t> Clamp(std::span<const uint8_t> data, uint64_t offset, uint64_t size)
+    {
+        if (offset > data.size()) return {};
+        return data.subspan(offset, (std::min)(size, data.size() - offset));
+    }
+
+    // Header and both tables, the part of the old archive a delta has to be made for
+    static uint64_t HashTables(std::span<const uint8_t> data)
+    {
+        if (data.size() < sizeof(RCFHeader)) return 0;
+        RCFHeader header;
+        memcpy(&header, data.data(), sizeof(header));
+
+        uint64_t hash = ContentHash::Hash(data.first(sizeof(RCFHeader)));
+        hash = ContentHash::Hash(Clamp(data, header.dir_offset, header.dir_size), hash);
+        return ContentHash::Hash(Clamp(data, header.flnames_dir_offset, uint64_t(header.flnames_dir_size) + 8), hash);
+    }
+
+    // Hash chained over fixed size chunks, so it can be taken while the chunks get written
+    static uint64_t HashChunks(std::span<const uint8_t> data, uint64_t chunkSize)
+    {
+        uint64_t hash = 0;
+        for (uint64_t offset = 0; offset < data.size(); offset += chunkSize) hash = ContentHash::Hash(Clamp(data, offset, chunkSize), hash);
+        return hash;
+    }
+
+    // Splits the new file into its entries and the ranges between them. Entries are encoded against
+    // the old entry of the same path, or of the same name hash when unnamed, ranges holding tables
+    // against the old tables and the remaining ranges stand alone
+    static std::vector<Segment> GetSegments(const RcfArchive& oldArchive, const RcfArchive& newArchive)
+    {
+        std::unordered_map<uint32_t, const RcfEntry*> oldByHash;
+        for (auto& entry : oldArchive.GetEntries()) oldByHash.emplace(entry.dir->hash, &entry);
+
+        auto tablesOf = [](const RCFHeader& header, uint64_t& start, uint64_t& end) {
+            start = (std::min)(header.dir_offset, header.flnames_dir_offset);
+            end = (std::max)(uint64_t(header.dir_offset) + header.dir_size, uint64_t(header.flnames_dir_offset) + 8 + header.flnames_dir_size);
+        };
+        uint64_t oldTablesStart, oldTablesEnd, newTablesStart, newTablesEnd;
+        tablesOf(oldArchive.GetHeader(), oldTablesStart, oldTablesEnd);
+        tablesOf(newArchive.GetHeader(), newTablesStart, newTablesEnd);
+        oldTablesEnd = (std::min)(oldTablesEnd, uint64_t(oldArchive.GetData().size()));
+
+        uint64_t newSize = newArchive.GetData().size();
+        std::vector<Segment> segments;
+        auto addRange = [&](uint64_t start, uint64_t end) {
+            if (end <= start) return;
+            bool tables = start < newTablesEnd && end > newTablesStart && oldTablesStart < oldTablesEnd;
+            segments.push_back({ start, end - start, tables ? oldTablesStart : 0, tables ? oldTablesEnd - oldTablesStart : 0, {} });
+        };
+
+        std::vector<const RcfEntry*> entries;
+        for (auto& entry : newArchive.GetEntries()) entries.push_back(&entry);
+        std::sort(entries.begin(), entries.end(), [](const RcfEntry* a, const RcfEntry* b) {
+            return (a->dir->fl_offset != b->dir->fl_offset) ? a->dir->fl_offset < b->dir->fl_offset : a->dir->fl_size > b->dir->fl_size;
+            });
+
+        // Entries sharing data are covered once, the file is walked in offset order
+        uint64_t position = 0;
+        for (auto entry : entries) {
+            uint64_t start = entry->dir->fl_offset;
+            uint64_t end = (std::min)(start + entry->dir->fl_size, newSize);
+            if (end <= position || end <= start) continue;
+            if (start < position) {
+                addRange(position, end);
+                position = end;
+                continue;
+            }
+            addRange(position, start);
+
+            const RcfEntry* base = entry->path.empty() ? nullptr : oldArchive.FindEntry(entry->path);
+            if (base == nullptr && entry->path.empty()) {
+                auto it = oldByHash.find(entry->dir->hash);
+                if (it != oldByHash.end()) base = it->second;
+            }
+            auto baseData = base ? oldArchive.GetEntryData(*base) : std::span<const uint8_t>();
+            uint64_t baseStart = baseData.empty() ? 0 : base->dir->fl_offset;
+            segments.push_back({ start, end - start, baseStart, baseData.size(), {} });
+            position = end;
+        }
+        addRange(position, newSize);
+        return segments;
+    }
+
+    // Adds the operation, continuing the last one when it picks up where that one ended
+    static void Append(std::vector<Op>& ops, const Op& op)
+    {
+        if (op.length == 0) return;
+        if (!ops.empty() && ops.back().kind == op.kind && (op.kind == Zero || ops.back().source + ops.back().length == op.source)) {
+            ops.back().length += op.length;
+            return;
+        }
+        ops.push_back(op);
+    }
+
+    // Inserts bytes of the new file at the offset, long zero runs are filled instead
+    static void AddLiteral(std::vector<Op>& ops, std::span<const uint8_t> data, uint64_t offset)
+    {
+        uint64_t literal = 0;
+        for (uint64_t i = 0; i < data.size();) {
+            if (data[i] != 0) {
+                i++;
+                continue;
+            }
+            uint64_t end = i;
+            while (end < data.size() && data[end] == 0) end++;
+            if (end - i >= MinZeroRun) {
+                Append(ops, { Insert, 0, offset + literal, i - literal });
+                Append(ops, { Zero, 0, 0, end - i });
+                literal = end;
+            }
+            i = end;
+        }
+        Append(ops, { Insert, 0, offset + literal, data.size() - literal });
+    }
+
+    // Blocks of the base get larger with its size, so the block table stays small
+    static uint32_t GetBlockSize(uint64_t baseSize)
+    {
+        return static_cast<uint32_t>((std::max)(uint64_t(32), (baseSize + 65535) / 65536));
+    }
+
+    // Copies the runs of the segment found in its base, matched by the weak hash of a block and
+    // confirmed and grown in both directions by comparing the bytes. Everything else is inserted
+    static void Encode(Segment& segment, std::span<const uint8_t> oldData, std::span<const uint8_t> newData)
+    {
+        auto target = newData.subspan(segment.start, segment.size);
+        auto base = oldData.subspan(segment.baseStart, segment.baseSize);
+        std::vector<Op>& ops = segment.ops;
+        if (base.size() == target.size() && memcmp(base.data(), target.data(), target.size()) == 0) {
+            Append(ops, { Copy, 0, segment.baseStart, target.size() });
+            return;
+        }
+
+        uint32_t block = GetBlockSize(base.size());
+        if (base.size() < block || target.size() < block) {
+            AddLiteral(ops, target, segment.start);
+            return;
+        }
+
+        std::unordered_map<uint32_t, uint32_t> blocks;
+        blocks.reserve(base.size() / block);
+        RollingHash rolling;
+        for (uint64_t offset = 0; offset + block <= base.size(); offset += block) {
+            rolling.Reset(base.data() + offset, block);
+            blocks.emplace(rolling.Get(), static_cast<uint32_t>(offset / block));
+        }
+
+        uint64_t literal = 0;
+        uint64_t i = 0;
+        rolling.Reset(target.data(), block);
+        while (i + block <= target.size()) {
+            auto it = blocks.find(rolling.Get());
+            uint64_t match = (it != blocks.end()) ? uint64_t(it->second) * block : 0;
+            if (it != blocks.end() && memcmp(base.data() + match, target.data() + i, block) == 0) {
+                uint64_t from = i;
+                uint64_t baseFrom = match;
+                while (from > literal && baseFrom > 0 && target[from - 1] == base[baseFrom - 1]) {
+                    from--;
+                    baseFrom--;
+                }
+
+                uint64_t to = i + block;
+                uint64_t baseTo = match + block;
+                while (to + 64 <= target.size() && baseTo + 64 <= base.size() && memcmp(target.data() + to, base.data() + baseTo, 64) == 0) {
+                    to += 64;
+                    baseTo += 64;
+                }
+                while (to < target.size() && baseTo < base.size() && target[to] == base[baseTo]) {
+                    to++;
+                    baseTo++;
+                }
+
+                AddLiteral(ops, target.subspan(literal, from - literal), segment.start + literal);
+                Append(ops, { Copy, 0, segment.baseStart + baseFrom, to - from });
+                literal = i = to;
+                if (i + block <= target.size()) rolling.Reset(target.data() + i, block);
+                continue;
+            }
+
+            if (i + block < target.size()) rolling.Roll(target[i], target[i + block]);
+            i++;
+        }
+        AddLiteral(ops, target.subspan(literal), segment.start + literal);
+    }
+
+    // Checks the header and every operation, starts gets the offset of each operation in the new file
+    static bool ReadDelta(const MappedFile& delta, DeltaHeader& header, std::vector<Op>& ops, std::vector<uint64_t>& starts)
+    {
+        DeltaHeader expected;
+        if (delta.Size() < sizeof(DeltaHeader)) return false;
+        memcpy(&header, delta.Data(), sizeof(header));
+        if (memcmp(header.magic, expected.magic, sizeof(expected.magic)) != 0 || header.version != Version ||
+            header.chunkSize == 0 || header.chunkSize > 64 * 1024 * 1024) return false;
+
+        uint64_t available = delta.Size() - sizeof(DeltaHeader);
+        if (header.opCount > available / sizeof(Op) || header.insertSize != available - header.opCount * sizeof(Op)) return false;
+
+        ops.resize(header.opCount);
+        memcpy(ops.data(), delta.Data() + sizeof(DeltaHeader), ops.size() * sizeof(Op));
+
+        uint64_t position = 0;
+        starts.resize(ops.size());
+        for (size_t i = 0; i < ops.size(); i++) {
+            const Op& op = ops[i];
+            uint64_t limit = (op.kind == Copy) ? header.oldSize : header.insertSize;
+            if (op.kind > Zero || (op.kind != Zero && (op.source > limit || op.length > limit - op.source))) return false;
+            if (op.length > header.newSize - position) return false;
+            starts[i] = position;
+            position += op.length;
+        }
+        return position == header.newSize;
+    }
+
+    // Fills chunks of the new file on the workers and writes them in order, hashing each one on the way
+    static bool StreamOutput(FILE* file, const DeltaHeader& header, const std::vector<Op>& ops, const std::vector<uint64_t>& starts,
+        std::span<const uint8_t> oldData, std::span<const uint8_t> inserts, unsigned int threadCount, uint64_t& hash)
+    {
+        size_t chunkCount = static_cast<size_t>((header.newSize + header.chunkSize - 1) / header.chunkSize);
+        auto fill = [&](size_t chunk, uint8_t* buffer) {
+            uint64_t position = uint64_t(chunk) * header.chunkSize;
+            uint64_t end = (std::min)(position + header.chunkSize, header.newSize);
+            size_t i = std::upper_bound(starts.begin(), starts.end(), position) - starts.begin() - 1;
+            for (; position < end; i++) {
+                const Op& op = ops[i];
+                uint64_t offset = position - starts[i];
+                uint64_t size = (std::min)(op.length - offset, end - position);
+                uint8_t* target = buffer + (position - uint64_t(chunk) * header.chunkSize);
+                if (op.kind == Copy) memcpy(target, oldData.data() + op.source + offset, size);
+                else if (op.kind == Insert) memcpy(target, inserts.data() + op.source + offset, size);
+                else memset(target, 0, size);
+                position += size;
+            }
+        };
+
+        // Ring of buffers, a slot holds chunk i once ready[i % slots] == i + 1
+        size_t slotCount = (std::min)(MaxSlots, (std::max)(size_t(2), size_t(threadCount) * 2));
+        std::vector<std::vector<uint8_t>> buffers(slotCount, std::vector<uint8_t>(header.chunkSize));
+        std::vector<size_t> ready(slotCount, 0);
+        std::mutex mutex;
+        std::condition_variable readyChanged, slotFreed;
+        size_t written = 0;
+        std::atomic<size_t> next = 0;
+        std::atomic<bool> failed = false;
+
+        auto worker = [&]() {
+            for (size_t i = next++; i < chunkCount && !failed; i = next++) {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    slotFreed.wait(lock, [&]() { return i < written + slotCount || failed; });
+                    if (failed) break;
+                }
+                fill(i, buffers[i % slotCount].data());
+
+                std::lock_guard<std::mutex> lock(mutex);
+                ready[i % slotCount] = i + 1;
+                readyChanged.notify_all();
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (unsigned int t = 0; t < threadCount && t < chunkCount; t++) workers.emplace_back(worker);
+
+        hash = 0;
+        for (size_t i = 0; i < chunkCount && !failed; i++) {
+            size_t slot = i % slotCount;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                readyChanged.wait(lock, [&]() { return ready[slot] == i + 1 || failed; });
+            }
+
+            size_t size = static_cast<size_t>((std::min)(uint64_t(header.chunkSize), header.newSize - uint64_t(i) * header.chunkSize));
+            hash = ContentHash::Hash({ buffers[slot].data(), size }, hash);
+            if (fwrite(buffers[slot].data(), 1, size, file) != size) failed = true;
+
+            std::lock_guard<std::mutex> lock(mutex);
+            written = i + 1;
+            slotFreed.notify_all();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (written < chunkCount) failed = true;
+            slotFreed.notify_all();
+        }
+        for (auto& thread : workers) thread.join();
+        return !failed;
+    }
+};
@@ -0,0 +1,260 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+#include "RcfArchive.hxx"
+#include "RcfDedup.hxx"
+
+// Differences between two versions of a cement library. Entries are paired by path, or by
+// the name hash of the directory when the path is unknown, and metadata decides wherever it
+// can: a different size is a change without reading any data. Only pairs of equal size are
+// compared, and only unpaired entries are hashed to find the ones that got renamed. Both
+// run over the mapped ranges on a pool of workers
+class RcfDiff
+{
+public:
+    enum class Kind {
+        Added,
+        Removed,
+        Moved,
+        Changed
+    };
+
+    // Moved entries hold the same bytes under a new path, changed ones new bytes under the same path
+    struct Change {
+        Kind kind;
+        const RcfEntry* oldEntry;
+        const RcfEntry* newEntry;
+    };
+
+    struct Stats {
+        size_t paired = 0;
+        size_t compared = 0;
+        size_t hashed = 0;
+        uint64_t bytesRead = 0;
+        double seconds = 0.0;
+    };
+
+    // Compares the archives, both have to stay open while the changes are used
+    const std::vector<Change>& Run(const RcfArchive& oldArchive, const RcfArchive& newArchive, unsigned int threadCount = std::thread::hardware_concurrency())
+    {
+        auto start = std::chrono::steady_clock::now();
+        m_Changes.clear();
+        m_Stats = {};
+        if (threadCount == 0) threadCount = 1;
+
+        auto& oldEntries = oldArchive.GetEntries();
+        auto& newEntries = newArchive.GetEntries();
+
+        // Unnamed entries can still be told apart by the name hash of their directory entry
+        std::unordered_multimap<uint32_t, uint32_t> unnamed;
+        for (uint32_t i = 0; i < newEntries.size(); i++) {
+            if (newEntries[i].path.empty()) unnamed.emplace(newEntries[i].dir->hash, i);
+        }
+
+        std::vector<bool> newPaired(newEntries.size());
+        std::vector<std::pair<const RcfEntry*, const RcfEntry*>> candidates;
+        std::vector<const RcfEntry*> removed;
+        for (auto& oldEntry : oldEntries) {
+            const RcfEntry* newEntry = FindPair(oldEntry, newArchive, unnamed, newPaired);
+            if (newEntry == nullptr) {
+                removed.push_back(&oldEntry);
+                continue;
+            }
+
+            m_Stats.paired++;
+            newPaired[newEntry - newEntries.data()] = true;
+            if (oldEntry.dir->fl_size != newEntry->dir->fl_size) m_Changes.push_back({ Kind::Changed, &oldEntry, newEntry });
+            else candidates.emplace_back(&oldEntry, newEntry);
+        }
+
+        // Pairs of equal size differ only if their bytes do
+        std::vector<bool> differs = CompareAll(oldArchive, newArchive, candidates, threadCount);
+        for (size_t i = 0; i < candidates.size(); i++) {
+            if (differs[i]) m_Changes.push_back({ Kind::Changed, candidates[i].first, candidates[i].second });
+        }
+        m_Stats.compared = candidates.size();
+
+        std::vector<const RcfEntry*> added;
+        for (uint32_t i = 0; i < newEntries.size(); i++) {
+            if (!newPaired[i]) added.push_back(&newEntries[i]);
+        }
+        MatchMoved(oldArchive, newArchive, removed, added, threadCount);
+
+        std::stable_sort(m_Changes.begin(), m_Changes.end(), [](const Change& a, const Change& b) { return a.kind < b.kind; });
+        m_Stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return m_Changes;
+    }
+
+    // Prints every change and the totals
+    void Print() const
+    {
+        static const char* kinds[] = { "added", "removed", "moved", "changed" };
+        size_t counts[4] = {};
+        for (auto& change : m_Changes) {
+            counts[static_cast<int>(change.kind)]++;
+            if (change.kind == Kind::Moved) {
+                std::string from = GetName(*change.oldEntry);
+                std::string to = GetName(*change.newEntry);
+                printf("moved    %s -> %s\n", from.c_str(), to.c_str());
+            }
+            else {
+                const RcfEntry& entry = change.newEntry ? *change.newEntry : *change.oldEntry;
+                printf("%-8s %s\n", kinds[static_cast<int>(change.kind)], GetName(entry).c_str());
+            }
+        }
+
+        printf("%zu added, %zu removed, %zu moved, %zu changed, %zu of %zu pairs compared, %zu hashed, %.1f MB read in %.2f s\n",
+            counts[0], counts[1], counts[2], counts[3], m_Stats.compared, m_Stats.paired, m_Stats.hashed,
+            m_Stats.bytesRead / (1024.0 * 1024.0), m_Stats.seconds);
+    }
+
+    // Changes ordered as added, removed, moved and changed
+    const std::vector<Change>& GetChanges() const { return m_Changes; }
+
+    const Stats& GetStats() const { return m_Stats; }
+
+private:
+    // Large entries are compared in pieces so a single one doesn't keep one worker busy alone
+    static constexpr uint64_t PieceSize = 4 * 1024 * 1024;
+
+    std::vector<Change> m_Changes;
+    Stats m_Stats;
+
+    static std::string GetName(const RcfEntry& entry)
+    {
+        if (!entry.path.empty()) return std::string(entry.path);
+        char name[16];
+        snprintf(name, sizeof(name), "<%08X>", entry.dir->hash);
+        return name;
+    }
+
+    static const RcfEntry* FindPair(const RcfEntry& oldEntry, const RcfArchive& newArchive,
+        const std::unordered_multimap<uint32_t, uint32_t>& unnamed, const std::vector<bool>& newPaired)
+    {
+        if (!oldEntry.path.empty()) {
+            const RcfEntry* newEntry = newArchive.FindEntry(oldEntry.path);
+            if (newEntry && !newPaired[newEntry - newArchive.GetEntries().data()]) return newEntry;
+        }
+
+        auto range = unnamed.equal_range(oldEntry.dir->hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (!newPaired[it->second]) return &newArchive.GetEntry(it->second);
+        }
+        return nullptr;
+    }
+
+    // Compares the pairs piece by piece, the remaining pieces of a pair are skipped once it differs
+    std::vector<bool> CompareAll(const RcfArchive& oldArchive, const RcfArchive& newArchive,
+        const std::vector<std::pair<const RcfEntry*, const RcfEntry*>>& pairs, unsigned int threadCount)
+    {
+        struct Piece {
+            uint32_t pair;
+            uint64_t offset;
+            uint64_t size;
+        };
+
+        std::vector<Piece> pieces;
+        for (uint32_t i = 0; i < pairs.size(); i++) {
+            uint64_t size = pairs[i].first->dir->fl_size;
+            uint64_t offset = 0;
+            do {
+                pieces.push_back({ i, offset, (std::min)(PieceSize, size - offset) });
+                offset += PieceSize;
+            } while (offset < size);
+        }
+
+        std::vector<std::atomic<bool>> differs(pairs.size());
+        std::atomic<uint64_t> bytesRead = 0;
+        std::atomic<size_t> next = 0;
+        auto worker = [&]() {
+            uint64_t read = 0;
+            for (size_t i = next++; i < pieces.size(); i = next++) {
+                const Piece& piece = pieces[i];
+                if (differs[piece.pair].load(std::memory_order_relaxed)) continue;
+
+                auto oldData = oldArchive.GetEntryData(*pairs[piece.pair].first);
+                auto newData = newArchive.GetEntryData(*pairs[piece.pair].second);
+                if (oldData.size() != newData.size() || oldData.size() < piece.offset + piece.size ||
+                    memcmp(oldData.data() + piece.offset, newData.data() + piece.offset, piece.size) != 0)
+                    differs[piece.pair].store(true, std::memory_order_relaxed);
+                read += piece.size * 2;
+            }
+            bytesRead += read;
+        };
+
+        std::vector<std::thread> workers;
+        for (unsigned int t = 1; t < threadCount && t < pieces.size(); t++) workers.emplace_back(worker);
+        worker();
+        for (auto& thread : workers) thread.join();
+
+        m_Stats.bytesRead += bytesRead;
+        std::vector<bool> result(pairs.size());
+        for (size_t i = 0; i < pairs.size(); i++) result[i] = differs[i];
+        return result;
+    }
+
+    // Pairs removed and added entries holding the same bytes as moved, the rest stay added or removed
+    void MatchMoved(const RcfArchive& oldArchive, const RcfArchive& newArchive,
+        const std::vector<const RcfEntry*>& removed, const std::vector<const RcfEntry*>& added, unsigned int threadCount)
+    {
+        // Only sizes present on both sides can match, everything else is decided without reading
+        std::vector<uint32_t> removedSizes, addedSizes;
+        for (auto entry : removed) removedSizes.push_back(entry->dir->fl_size);
+        for (auto entry : added) addedSizes.push_back(entry->dir->fl_size);
+        std::sort(removedSizes.begin(), removedSizes.end());
+        std::sort(addedSizes.begin(), addedSizes.end());
+
+        std::vector<std::span<const uint8_t>> data;
+        std::vector<const RcfEntry*> owners;
+        std::vector<bool> isRemoved;
+        auto collect = [&](const RcfArchive& archive, const std::vector<const RcfEntry*>& entries, const std::vector<uint32_t>& otherSizes, bool side) {
+            for (auto entry : entries) {
+                if (!std::binary_search(otherSizes.begin(), otherSizes.end(), entry->dir->fl_size)) continue;
+                data.push_back(archive.GetEntryData(*entry));
+                owners.push_back(entry);
+                isRemoved.push_back(side);
+                m_Stats.bytesRead += data.back().size();
+            }
+        };
+        collect(oldArchive, removed, addedSizes, true);
+        collect(newArchive, added, removedSizes, false);
+        m_Stats.hashed = data.size();
+
+        std::vector<bool> moved(data.size());
+        for (auto& group : RcfDedup::GroupIdentical(data, RcfDedup::HashAll(data, threadCount))) {
+            // Removed entries come first in a group, each one is paired with one added entry
+            size_t split = 0;
+            while (split < group.items.size() && isRemoved[group.items[split]]) split++;
+            for (size_t i = 0; i < split && split + i < group.items.size(); i++) {
+                moved[group.items[i]] = moved[group.items[split + i]] = true;
+                m_Changes.push_back({ Kind::Moved, owners[group.items[i]], owners[group.items[split + i]] });
+            }
+        }
+
+        std::vector<const RcfEntry*> movedEntries;
+        for (size_t i = 0; i < data.size(); i++) {
+            if (moved[i]) movedEntries.push_back(owners[i]);
+        }
+        std::sort(movedEntries.begin(), movedEntries.end());
+        auto isMoved = [&movedEntries](const RcfEntry* entry) { return std::binary_search(movedEntries.begin(), movedEntries.end(), entry); };
+
+        for (auto entry : added) {
+            if (!isMoved(entry)) m_Changes.push_back({ Kind::Added, nullptr, entry });
+        }
+        for (auto entry : removed) {
+            if (!isMoved(entry)) m_Changes.push_back({ Kind::Removed, entry, nullptr });
+        }
+    }
+};
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <filesystem>
+#include <set>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+
+#include "RcfArchive.hxx"
+#include "../io/EntryReader.hxx"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#endif
+
+// Extracts archive entries to disc. Entries are taken in file offset order so the
+// archive is read front to back, workers write them out in parallel and on Linux
+// the data moves file to file inside the kernel
+class RcfExtractor
+{
+public:
+    struct Stats {
+        size_t files = 0;
+        size_t failed = 0;
+        uint64_t bytes = 0;
+        double seconds = 0.0;
+
+        double GetMBps() const { return (seconds > 0.0) ? bytes / seconds / (1024.0 * 1024.0) : 0.0; }
+    };
+
+    // Extracts every named entry matching the glob, "*" extracts the whole archive
+    static Stats Extract(const RcfArchive& archive, const std::string& outputDir, std::string_view pattern = "*",
+        unsigned int threadCount = std::thread::hardware_concurrency())
+    {
+        Stats stats;
+        auto start = std::chrono::steady_clock::now();
+        if (threadCount == 0) threadCount = 1;
+
+        // Requests in physical order
+        std::vector<const RcfEntry*> requests;
+        for (auto& entry : archive.GetEntries()) {
+            if (!entry.path.empty() && PathIndex::MatchGlob(pattern, entry.path)) requests.push_back(&entry);
+        }
+        std::sort(requests.begin(), requests.end(), [](const RcfEntry* a, const RcfEntry* b) {
+            return a->dir->fl_offset < b->dir->fl_offset;
+            });
+
+        // Output paths and their directories are resolved up front, workers only write
+        std::vector<std::filesystem::path> outputs(requests.size());
+        std::set<std::filesystem::path> directories;
+        for (size_t i = 0; i < requests.size(); i++) {
+            if (!GetOutputPath(outputDir, requests[i]->path, outputs[i])) {
+                std::cerr << "Skipping unsafe path: " << requests[i]->path << std::endl;
+                continue;
+            }
+            directories.insert(outputs[i].parent_path());
+        }
+        for (auto& directory : directories) {
+            std::error_code error;
+            std::filesystem::create_directories(directory, error);
+        }
+
+#if !defined(_WIN32) && defined(POSIX_FADV_SEQUENTIAL)
+        posix_fadvise(archive.GetFile().GetNativeHandle(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+        std::atomic<size_t> next = 0, files = 0, failed = 0;
+        std::atomic<uint64_t> bytes = 0;
+        auto worker = [&]() {
+            for (size_t i = next++; i < requests.size(); i = next++) {
+                if (outputs[i].empty()) {
+                    failed++;
+                    continue;
+                }
+                if (WriteEntry(archive, *requests[i], outputs[i])) {
+                    files++;
+                    bytes += requests[i]->dir->fl_size;
+                }
+                else {
+                    std::cerr << "Failed to extract " << outputs[i].string() << std::endl;
+                    failed++;
+                }
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (unsigned int t = 1; t < threadCount; t++) workers.emplace_back(worker);
+        worker();
+        for (auto& thread : workers) thread.join();
+
+        stats.files = files;
+        stats.failed = failed;
+        stats.bytes = bytes;
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("Extracted %zu files (%zu failed), %.1f MB in %.2f s, %.1f MB/s\n",
+            stats.files, stats.failed, stats.bytes / (1024.0 * 1024.0), stats.seconds, stats.GetMBps());
+        return stats;
+    }
+
+    // Joins an archive path to the output directory, refuses absolute paths and ".." components
+    static bool GetOutputPath(const std::string& outputDir, std::string_view archivePath, std::filesystem::path& output)
+    {
+        std::filesystem::path result(outputDir);
+        size_t start = 0;
+        while (start <= archivePath.size()) {
+            size_t end = archivePath.find_first_of("\\/", start);
+            if (end == std::string_view::npos) end = archivePath.size();
+            std::string_view part = archivePath.substr(start, end - start);
+            if (part == ".." || part.find(':') != std::string_view::npos) return false;
+            if (!part.empty() && part != ".") result /= std::filesystem::path(std::string(part));
+            start = end + 1;
+        }
+        output = result;
+        return true;
+    }
+
+private:
+    static bool WriteEntry(const RcfArchive& archive, const RcfEntry& entry, const std::filesystem::path& output)
+    {
+        std::span<const uint8_t> data = archive.GetEntryData(entry);
+        if (data.size() != entry.dir->fl_size) return false;
+
+#ifdef _WIN32
+        HANDLE file = CreateFileW(output.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+
+        // Straight from the mapping a chunk at a time, so large entries don't pile up in the working set
+        EntryReader reader(archive.GetEntryView(entry));
+        bool written = reader.ForEachChunk([file](std::span<const uint8_t> chunk, uint64_t) {
+            DWORD done = 0;
+            return WriteFile(file, chunk.data(), static_cast<DWORD>(chunk.size()), &done, nullptr) && done == chunk.size();
+            });
+        CloseHandle(file);
+        return written;
+#else
+        int file = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (file < 0) return false;
+
+        size_t left = data.size();
+#ifdef __linux__
+        // Kernel side copies, copy_file_range may refuse across filesystems so sendfile backs it up
+        int source = archive.GetFile().GetNativeHandle();
+        loff_t sourceOffset = static_cast<loff_t>(archive.GetEntryFileOffset(entry));
+        while (left > 0) {
+            ssize_t done = copy_file_range(source, &sourceOffset, file, nullptr, left, 0);
+            if (done <= 0) break;
+            left -= done;
+        }
+        off_t sendOffset = static_cast<off_t>(sourceOffset);
+        while (left > 0) {
+            ssize_t done = sendfile(file, source, &sendOffset, left);
+            if (done <= 0) break;
+            left -= done;
+        }
+#endif
+        // Plain writes out of the mapping for whatever is left, a chunk at a time
+        EntryReader reader(archive.GetEntryView(entry));
+        reader.Seek(data.size() - left);
+        reader.ForEachChunk([file, &left](std::span<const uint8_t> chunk, uint64_t) {
+            for (size_t written = 0; written < chunk.size();) {
+                ssize_t done = write(file, chunk.data() + written, chunk.size() - written);
+                if (done <= 0) return false;
+                written += done;
+                left -= done;
+            }
+            return true;
+            });
+        close(file);
+        return left == 0;
+#endif
+    }
+};
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+
+#include "RcfArchive.hxx"
+#include "../io/FileView.hxx"
+#include "../io/PathIndex.hxx"
+#include "../io/PathSearch.hxx"
+
+// Layered view over every cement library of an install plus loose mod folders. Each layer
+// has a priority, the file of the highest priority layer wins a path and layers of the same
+// priority are overridden by the later mounted one. All winning paths are kept in one index
+class RcfFileSystem
+{
+public:
+    // Winning file of a path, index is the entry of an archive layer or the file of a folder layer
+    struct File {
+        std::string_view path;
+        uint32_t layer;
+        uint32_t index;
+        uint64_t size;
+    };
+
+    // Mounts a single archive from disc
+    bool MountArchive(const std::string& filePath, int priority = 0)
+    {
+        return AddArchive(filePath, priority);
+    }
+
+    // Mounts every file below the folder, paths are relative to it
+    bool MountDirectory(const std::string& rootDir, int priority = 0)
+    {
+        return AddDirectory(rootDir, priority);
+    }
+
+    // Mounts every archive found below the install folder in path order, returns the mounted count
+    size_t MountInstall(const std::string& installDir, int priority = 0)
+    {
+        std::error_code error;
+        std::vector<std::filesystem::path> archives;
+        for (auto& item : std::filesystem::recursive_directory_iterator(installDir, error)) {
+            if (!item.is_regular_file()) continue;
+            std::string extension = item.path().extension().string();
+            if (PathIndex::PathEquals(extension, ".rcf")) archives.push_back(item.path());
+        }
+        if (error) {
+            std::cerr << "Failed to read directory " << installDir << std::endl;
+            return 0;
+        }
+        std::sort(archives.begin(), archives.end());
+
+        size_t mounted = 0;
+        for (auto& archive : archives) {
+            if (AddArchive(archive.string(), priority)) mounted++;
+        }
+        return mounted;
+    }
+
+    void Clear()
+    {
+        m_Search.Clear();
+        m_SearchFiles.clear();
+        m_Index.Clear();
+        m_Files.clear();
+        m_Layers.clear();
+    }
+
+    // Finds the winning file stored with the given path, case and separator insensitive
+    const File* Find(std::string_view path) const
+    {
+        uint32_t index = m_Index.Find(path);
+        return (index != PathIndex::npos) ? &m_Files[index] : nullptr;
+    }
+
+    // Winning files matching a substring, a glob with wildcards or a /regex/ over every mounted path
+    std::vector<const File*> Search(std::string_view query, size_t limit = SIZE_MAX) const
+    {
+        std::vector<const File*> results;
+        for (uint32_t id : m_Search.Find(query)) {
+            if (results.size() >= limit) break;
+
+            // Overridden copies of a path are indexed as well, only the winner is listed
+            const File* file = Find(m_Search.GetPath(id));
+            if (file && file->layer == m_SearchFiles[id].first && file->index == m_SearchFiles[id].second) results.push_back(file);
+        }
+        return results;
+    }
+
+    // Winning file of every path over all layers
+    const std::vector<File>& GetFiles() const { return m_Files; }
+
+    // File content, archive entries are views into the archive mapping and loose files get mapped
+    FileView Open(const File& file) const
+    {
+        const Layer& layer = *m_Layers[file.layer];
+        if (layer.archive) return layer.archive->GetEntryView(layer.archive->GetEntry(file.index));
+
+        FileView view;
+        if (!view.Open((std::filesystem::path(layer.name) / layer.files[file.index].filePath).string()))
+            std::cerr << "Failed to open file " << file.path << std::endl;
+        return view;
+    }
+
+    // Archive of an archive layer, nullptr for folder layers
+    const RcfArchive* GetArchive(uint32_t layer) const { return m_Layers[layer]->archive.get(); }
+
+    // Archive path or folder of the layer
+    const std::string& GetLayerName(uint32_t layer) const { return m_Layers[layer]->name; }
+
+    size_t GetLayerCount() const { return m_Layers.size(); }
+
+private:
+    // Loose file of a folder layer
+    struct LooseFile {
+        std::string path;
+        std::string filePath;
+        uint64_t size;
+    };
+
+    struct Layer {
+        std::string name;
+        int priority = 0;
+        std::unique_ptr<RcfArchive> archive;
+        std::deque<LooseFile> files;
+    };
+
+    std::vector<std::unique_ptr<Layer>> m_Layers;
+    std::vector<File> m_Files;
+    PathIndex m_Index;
+
+    // Search index over the paths of every layer, grown as layers get mounted
+    PathSearch m_Search;
+    std::vector<std::pair<uint32_t, uint32_t>> m_SearchFiles;
+
+    // Adds the paths of the last mounted layer to the search index
+    void IndexLayer()
+    {
+        uint32_t layerIndex = static_cast<uint32_t>(m_Layers.size() - 1);
+        const Layer& layer = *m_Layers.back();
+        if (layer.archive) {
+            for (uint32_t i = 0; i < layer.archive->GetEntryCount(); i++) {
+                if (layer.archive->GetEntry(i).path.empty()) continue;
+                m_Search.Add(layer.archive->GetEntry(i).path);
+                m_SearchFiles.emplace_back(layerIndex, i);
+            }
+        }
+        else {
+            for (uint32_t i = 0; i < layer.files.size(); i++) {
+                m_Search.Add(layer.files[i].path);
+                m_SearchFiles.emplace_back(layerIndex, i);
+            }
+        }
+    }
+
+    bool AddArchive(const std::string& filePath, int priority)
+    {
+        auto layer = std::make_unique<Layer>();
+        layer->archive = std::make_unique<RcfArchive>();
+        if (!layer->archive->Open(filePath)) {
+            std::cerr << "Failed to mount " << filePath << std::endl;
+            return false;
+        }
+
+        layer->name = filePath;
+        layer->priority = priority;
+        m_Layers.push_back(std::move(layer));
+        IndexLayer();
+        MergeLayer();
+        return true;
+    }
+
+    bool AddDirectory(const std::string& rootDir, int priority)
+    {
+        std::error_code error;
+        std::vector<std::filesystem::path> files;
+        for (auto& item : std::filesystem::recursive_directory_iterator(rootDir, error)) {
+            if (item.is_regular_file()) files.push_back(item.path());
+        }
+        if (error) {
+            std::cerr << "Failed to read directory " << rootDir << std::endl;
+            return false;
+        }
+        std::sort(files.begin(), files.end());
+
+        auto layer = std::make_unique<Layer>();
+        layer->name = rootDir;
+        layer->priority = priority;
+        for (auto& file : files) {
+            LooseFile& loose = layer->files.emplace_back();
+            loose.filePath = std::filesystem::relative(file, rootDir).string();
+            loose.path = std::filesystem::relative(file, rootDir).generic_string();
+            std::replace(loose.path.begin(), loose.path.end(), '/', '\\');
+            loose.size = std::filesystem::file_size(file, error);
+        }
+        m_Layers.push_back(std::move(layer));
+        IndexLayer();
+        MergeLayer();
+        return true;
+    }
+
+    // Merges the last mounted layer into the winning files. Every other layer was mounted before it,
+    // so it takes over the paths of layers with a lower or the same priority and only its own paths are visited
+    void MergeLayer()
+    {
+        uint32_t layerIndex = static_cast<uint32_t>(m_Layers.size() - 1);
+        const Layer& layer = *m_Layers.back();
+        if (layer.archive) {
+            m_Index.Reserve(m_Index.Size() + layer.archive->GetEntryCount());
+            for (uint32_t i = 0; i < layer.archive->GetEntryCount(); i++) {
+                const RcfEntry& entry = layer.archive->GetEntry(i);
+                if (!entry.path.empty()) AddFile({ entry.path, layerIndex, i, entry.dir->fl_size });
+            }
+        }
+        else {
+            m_Index.Reserve(m_Index.Size() + layer.files.size());
+            for (uint32_t i = 0; i < layer.files.size(); i++)
+                AddFile({ layer.files[i].path, layerIndex, i, layer.files[i].size });
+        }
+    }
+
+    // Adds the path or takes it over, within a layer the first file of a path is kept
+    void AddFile(const File& file)
+    {
+        uint32_t index = m_Index.Find(file.path);
+        if (index == PathIndex::npos) {
+            m_Index.Insert(file.path, static_cast<uint32_t>(m_Files.size()));
+            m_Files.push_back(file);
+        }
+        else if (m_Files[index].layer != file.layer && m_Layers[file.layer]->priority >= m_Layers[m_Files[index].layer]->priority) m_Files[index] = file;
+    }
+};
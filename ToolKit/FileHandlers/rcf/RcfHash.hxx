@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <array>
+#include <string_view>
+
+#include "../io/PathIndex.hxx"
+
+// Cement library name hash stored in RCFDirectoryEntry::hash: CRC-32 (reflected,
+// polynomial 0xEDB88320) over the path folded to lower case with '\' separators
+class RcfHash
+{
+public:
+    // Running state before any character, Finish() turns a state into the stored hash
+    static constexpr uint32_t Seed = 0xFFFFFFFF;
+
+    static uint32_t Finish(uint32_t state) { return ~state; }
+
+    static uint32_t HashName(std::string_view name) { return Finish(Update(Seed, name)); }
+
+    // Continues a running state over more characters, lets callers share path prefixes
+    static uint32_t Update(uint32_t state, std::string_view text)
+    {
+        const char* data = text.data();
+        size_t size = text.size();
+        while (size >= 8) {
+            state = Step8(state, data);
+            data += 8;
+            size -= 8;
+        }
+        return StepTail(state, data, size);
+    }
+
+    // Continues several running states at once, four lanes are interleaved so the
+    // table lookups of independent names overlap instead of waiting on each other
+    static void UpdateBatch(const uint32_t* states, const std::string_view* texts, uint32_t* results, size_t count)
+    {
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            uint32_t s0 = states[i], s1 = states[i + 1], s2 = states[i + 2], s3 = states[i + 3];
+            const char* d0 = texts[i].data();
+            const char* d1 = texts[i + 1].data();
+            const char* d2 = texts[i + 2].data();
+            const char* d3 = texts[i + 3].data();
+            size_t n0 = texts[i].size(), n1 = texts[i + 1].size(), n2 = texts[i + 2].size(), n3 = texts[i + 3].size();
+
+            size_t common = (std::min)((std::min)(n0, n1), (std::min)(n2, n3)) & ~size_t(7);
+            for (size_t k = 0; k < common; k += 8) {
+                s0 = Step8(s0, d0 + k);
+                s1 = Step8(s1, d1 + k);
+                s2 = Step8(s2, d2 + k);
+                s3 = Step8(s3, d3 + k);
+            }
+
+            results[i] = Update(s0, texts[i].substr(common));
+            results[i + 1] = Update(s1, texts[i + 1].substr(common));
+            results[i + 2] = Update(s2, texts[i + 2].substr(common));
+            results[i + 3] = Update(s3, texts[i + 3].substr(common));
+        }
+        for (; i < count; i++) results[i] = Update(states[i], texts[i]);
+    }
+
+private:
+    // Slicing-by-8 tables, Tables[0] is the plain byte table
+    using TableSet = std::array<std::array<uint32_t, 256>, 8>;
+
+    static const TableSet& Tables()
+    {
+        static const TableSet tables = [] {
+            TableSet set = {};
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t crc = i;
+                for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320u : 0);
+                set[0][i] = crc;
+            }
+            for (uint32_t i = 0; i < 256; i++) {
+                for (int k = 1; k < 8; k++) set[k][i] = (set[k - 1][i] >> 8) ^ set[0][set[k - 1][i] & 0xFF];
+            }
+            return set;
+        }();
+        return tables;
+    }
+
+    static uint32_t Step8(uint32_t state, const char* data)
+    {
+        const TableSet& t = Tables();
+        uint64_t word = PathIndex::NormalizeWord(PathIndex::LoadWord(data, 8));
+        uint32_t one = static_cast<uint32_t>(word) ^ state;
+        uint32_t two = static_cast<uint32_t>(word >> 32);
+        return t[7][one & 0xFF] ^ t[6][(one >> 8) & 0xFF] ^ t[5][(one >> 16) & 0xFF] ^ t[4][one >> 24] ^
+            t[3][two & 0xFF] ^ t[2][(two >> 8) & 0xFF] ^ t[1][(two >> 16) & 0xFF] ^ t[0][two >> 24];
+    }
+
+    static uint32_t StepTail(uint32_t state, const char* data, size_t size)
+    {
+        const TableSet& t = Tables();
+        for (size_t i = 0; i < size; i++) {
+            uint8_t c = static_cast<uint8_t>(PathIndex::NormalizeChar(data[i]));
+            state = t[0][(state ^ c) & 0xFF] ^ (state >> 8);
+        }
+        return state;
+    }
+};
@@ -0,0 +1,334 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <vector>
+#include <memory>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <span>
+#include <filesystem>
+#include <iostream>
+
+#include "RCF.h"
+#include "RcfArchive.hxx"
+#include "RcfTree.hxx"
+#include "../io/FileView.hxx"
+#include "../io/MappedFile.hxx"
+#include "../io/PathIndex.hxx"
+#include "../p3d/P3D.h"
+
+// Parsed tables of an archive saved to disc: the pairing of directory and filename entries,
+// the path index slots and the tree nodes. Every section is a flat array the archive and tree
+// are restored from in one pass, without sorting, hashing or probing again. The archive and tree
+// still get their own copy of the entries and nodes, as they point into the archive mapping.
+// Chunk indices of P3D files are cached the same way in files of their own and used in place
+// out of the mapping of the cache. A cache is tied to the path, size and write time of the file
+// and to the position of the archive or P3D in it
+class RcfIndexCache
+{
+public:
+    static constexpr uint32_t Version = 2;
+
+    // Opens the archive and builds its tree through the cache, a missing or stale cache is written anew
+    static bool Open(RcfArchive& archive, RcfTree& tree, const FileView& view, std::string_view rootName)
+    {
+        std::filesystem::path cachePath = GetCachePath(view);
+        if (Load(cachePath, archive, tree, view, rootName)) return true;
+
+        if (!archive.Open(view)) return false;
+        tree.Build(archive, rootName);
+        Save(cachePath, archive, tree);
+        return true;
+    }
+
+    // Indexes the chunks of a P3D view through the cache, complete indices are written to it
+    static bool OpenChunks(P3D& p3d, const FileView& view, size_t position)
+    {
+        std::filesystem::path cachePath = GetCachePath(view, "p3didx");
+        if (LoadChunks(cachePath, p3d, view)) return true;
+
+        bool bComplete = p3d.GetChunks(view.GetSpan(), position);
+        if (bComplete) SaveChunks(cachePath, p3d, view);
+        return bComplete;
+    }
+
+    // Cache file of an archive or P3D view, in the temporary folder
+    static std::filesystem::path GetCachePath(const FileView& view, const char* extension = "rcfidx")
+    {
+        char fileName[48];
+        uint64_t hash = PathIndex::HashPath(std::filesystem::absolute(view.GetFilePath()).string()) ^ view.GetFileOffset();
+        snprintf(fileName, sizeof(fileName), "%016llx.%s", static_cast<unsigned long long>(hash), extension);
+        return std::filesystem::temp_directory_path() / "ToolKit" / fileName;
+    }
+
+    // Restores the archive and tree, false when there is no cache matching the view
+    static bool Load(const std::filesystem::path& cachePath, RcfArchive& archive, RcfTree& tree, const FileView& view, std::string_view rootName)
+    {
+        MappedFile cache;
+        CacheHeader header;
+        uint64_t position = 0;
+        if (!OpenCache(cachePath, cache, view, header, position)) return false;
+
+        auto entries = cache.GetSpan(position, uint64_t(header.entryCount) * sizeof(CacheEntry));
+        position += entries.size();
+        auto nodes = cache.GetSpan(position, uint64_t(header.nodeCount) * sizeof(CacheNode));
+        position += nodes.size();
+        auto slots = cache.GetSpan(position, uint64_t(header.slotCount) * sizeof(PathIndex::SavedSlot));
+        if (entries.size() != uint64_t(header.entryCount) * sizeof(CacheEntry) || nodes.size() != uint64_t(header.nodeCount) * sizeof(CacheNode) ||
+            slots.size() != uint64_t(header.slotCount) * sizeof(PathIndex::SavedSlot)) return false;
+
+        if (RestoreArchive(archive, view, { reinterpret_cast<const CacheEntry*>(entries.data()), header.entryCount },
+            { reinterpret_cast<const PathIndex::SavedSlot*>(slots.data()), header.slotCount }) &&
+            RestoreTree(tree, archive, { reinterpret_cast<const CacheNode*>(nodes.data()), header.nodeCount }, rootName)) return true;
+
+        archive.Close();
+        tree.Clear();
+        return false;
+    }
+
+    // Writes the tables of a freshly parsed archive and its tree, names assigned later aren't saved
+    static bool Save(const std::filesystem::path& cachePath, const RcfArchive& archive, const RcfTree& tree)
+    {
+        CacheHeader header;
+        if (!GetKey(archive.GetSourceView(), header)) return false;
+
+        const uint8_t* base = archive.m_Data.data();
+        uint64_t size = archive.m_Data.size();
+        auto offsetOf = [base, size](std::string_view text) -> uint32_t {
+            uintptr_t start = reinterpret_cast<uintptr_t>(base);
+            uintptr_t position = reinterpret_cast<uintptr_t>(text.data());
+            if (position < start || position - start > size || text.size() > size - (position - start)) return npos;
+            return static_cast<uint32_t>(position - start);
+        };
+
+        std::vector<CacheEntry> entries(archive.GetEntryCount());
+        for (size_t i = 0; i < entries.size(); i++) {
+            const RcfEntry& entry = archive.GetEntry(i);
+            entries[i].directory = static_cast<uint32_t>(entry.dir - archive.GetDirectory().data());
+            entries[i].name = entry.name ? offsetOf({ reinterpret_cast<const char*>(entry.name), sizeof(RCFFilenameEntryHeader) }) : npos;
+            if (entry.name && entries[i].name == npos) return false;
+        }
+
+        // The root is labeled on load, every other name has to be a view into the archive
+        std::vector<CacheNode> nodes(tree.GetNodeCount());
+        for (uint32_t i = 0; i < nodes.size(); i++) {
+            const RcfTree::Node& node = tree.GetNode(i);
+            nodes[i] = { (i == 0) ? npos : offsetOf(node.name), static_cast<uint32_t>(node.name.size()), node.parent, node.firstChild, node.nextSibling, node.entry };
+            if (i != 0 && nodes[i].nameOffset == npos) return false;
+        }
+
+        std::vector<PathIndex::SavedSlot> slots = archive.m_Index.Save();
+        header.entryCount = static_cast<uint32_t>(entries.size());
+        header.nodeCount = static_cast<uint32_t>(nodes.size());
+        header.slotCount = static_cast<uint32_t>(slots.size());
+        return WriteCache(cachePath, header, archive.GetFilePath(), { AsBytes(entries), AsBytes(nodes), AsBytes(slots) });
+    }
+
+    // Uses the chunk index saved for the view in place, false when there is none matching it
+    static bool LoadChunks(const std::filesystem::path& cachePath, P3D& p3d, const FileView& view)
+    {
+        auto cache = std::make_shared<MappedFile>();
+        CacheHeader header;
+        uint64_t position = 0;
+        if (!OpenCache(cachePath, *cache, view, header, position)) return false;
+
+        auto chunks = cache->GetSpan(position, uint64_t(header.chunkCount) * sizeof(P3DChunk));
+        if (header.chunkCount == 0 || chunks.size() != uint64_t(header.chunkCount) * sizeof(P3DChunk)) return false;
+        return p3d.SetChunks(view.GetSpan(), { reinterpret_cast<const P3DChunk*>(chunks.data()), header.chunkCount }, std::move(cache));
+    }
+
+    // Writes the chunk index of a P3D indexed from the view
+    static bool SaveChunks(const std::filesystem::path& cachePath, const P3D& p3d, const FileView& view)
+    {
+        CacheHeader header;
+        if (p3d.chunks.empty() || !GetKey(view, header)) return false;
+
+        header.chunkCount = static_cast<uint32_t>(p3d.chunks.size());
+        return WriteCache(cachePath, header, view.GetFilePath(), { AsBytes(p3d.chunks) });
+    }
+
+private:
+    static constexpr uint32_t npos = UINT32_MAX;
+
+    // Leading bytes of the view are part of the key, the header for archives
+    struct CacheHeader {
+        char magic[8] = { 'T', 'K', 'R', 'C', 'F', 'I', 'D', 'X' };
+        uint32_t version = Version;
+        uint32_t pathLength = 0;
+        uint64_t fileSize = 0;
+        int64_t fileTime = 0;
+        uint64_t viewOffset = 0;
+        uint64_t viewSize = 0;
+        RCFHeader archiveHeader = {};
+        uint32_t entryCount = 0;
+        uint32_t nodeCount = 0;
+        uint32_t slotCount = 0;
+        uint32_t chunkCount = 0;
+        uint32_t reserved = 0;
+    };
+    static_assert(sizeof(CacheHeader) % 8 == 0, "Cache sections are 8 byte aligned");
+
+    // Entry in data order, directory index and offset of its filename entry in the archive
+    struct CacheEntry {
+        uint32_t directory;
+        uint32_t name;
+    };
+
+    // Tree node with its name as offset and length in the archive
+    struct CacheNode {
+        uint32_t nameOffset;
+        uint32_t nameLength;
+        uint32_t parent;
+        uint32_t firstChild;
+        uint32_t nextSibling;
+        uint32_t entry;
+    };
+
+    static uint64_t Align(uint64_t value) { return (value + 7) & ~uint64_t(7); }
+
+    template <typename T>
+    static std::span<const uint8_t> AsBytes(std::span<const T> items) { return { reinterpret_cast<const uint8_t*>(items.data()), items.size_bytes() }; }
+
+    template <typename T>
+    static std::span<const uint8_t> AsBytes(const std::vector<T>& items) { return AsBytes(std::span<const T>(items)); }
+
+    static bool GetKey(const FileView& view, CacheHeader& key)
+    {
+        std::error_code error;
+        auto fileTime = std::filesystem::last_write_time(view.GetFilePath(), error);
+        if (error || !view.IsOpen()) return false;
+
+        key.fileSize = view.GetFile().Size();
+        key.fileTime = static_cast<int64_t>(fileTime.time_since_epoch().count());
+        key.viewOffset = view.GetFileOffset();
+        key.viewSize = view.Size();
+        memcpy(&key.archiveHeader, view.Data(), (std::min)(view.Size(), uint64_t(sizeof(RCFHeader))));
+        return true;
+    }
+
+    // Maps the cache and checks its key against the view as it is on disc now, position is left behind the path
+    static bool OpenCache(const std::filesystem::path& cachePath, MappedFile& cache, const FileView& view, CacheHeader& header, uint64_t& position)
+    {
+        std::error_code error;
+        if (!std::filesystem::exists(cachePath, error)) return false;
+        if (!cache.Open(cachePath.string()) || cache.Size() < sizeof(CacheHeader)) return false;
+
+        memcpy(&header, cache.Data(), sizeof(header));
+        CacheHeader key;
+        if (!GetKey(view, key) || memcmp(header.magic, key.magic, sizeof(key.magic)) != 0 || header.version != key.version ||
+            header.fileSize != key.fileSize || header.fileTime != key.fileTime || header.viewOffset != key.viewOffset ||
+            header.viewSize != key.viewSize || memcmp(&header.archiveHeader, &key.archiveHeader, sizeof(RCFHeader)) != 0) return false;
+
+        position = sizeof(CacheHeader);
+        auto filePath = cache.GetSpan(position, header.pathLength);
+        position += Align(header.pathLength);
+        return filePath.size() == header.pathLength &&
+            PathIndex::PathEquals(std::string_view(reinterpret_cast<const char*>(filePath.data()), filePath.size()), std::filesystem::absolute(view.GetFilePath()).string());
+    }
+
+    // Writes the header, the path of the file and the sections. Written next to the cache and renamed
+    // over it, a reader never sees half a cache
+    static bool WriteCache(const std::filesystem::path& cachePath, CacheHeader& header, const std::string& sourcePath, std::initializer_list<std::span<const uint8_t>> sections)
+    {
+        std::string filePath = std::filesystem::absolute(sourcePath).string();
+        header.pathLength = static_cast<uint32_t>(filePath.size());
+
+        std::error_code error;
+        std::filesystem::create_directories(cachePath.parent_path(), error);
+        std::filesystem::path tempPath = cachePath;
+        tempPath += ".tmp";
+
+        FILE* file = fopen(tempPath.string().c_str(), "wb");
+        if (file == nullptr) {
+            std::cerr << "Failed to write index cache " << cachePath.string() << std::endl;
+            return false;
+        }
+
+        static const uint8_t padding[8] = {};
+        bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+            fwrite(filePath.data(), 1, filePath.size(), file) == filePath.size() &&
+            fwrite(padding, 1, Align(filePath.size()) - filePath.size(), file) == Align(filePath.size()) - filePath.size();
+        for (auto& section : sections) written = written && fwrite(section.data(), 1, section.size(), file) == section.size();
+        written = (fclose(file) == 0) && written;
+
+        if (written) std::filesystem::rename(tempPath, cachePath, error);
+        if (!written || error) {
+            std::filesystem::remove(tempPath, error);
+            std::cerr << "Failed to write index cache " << cachePath.string() << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    static bool RestoreArchive(RcfArchive& archive, const FileView& view, std::span<const CacheEntry> entries, std::span<const PathIndex::SavedSlot> slots)
+    {
+        archive.Close();
+        if (!archive.SetView(view) || !archive.ParseHeader() || entries.size() != archive.m_Directory.size()) return false;
+
+        archive.m_Entries.resize(entries.size());
+        for (size_t i = 0; i < entries.size(); i++) {
+            RcfEntry& entry = archive.m_Entries[i];
+            if (entries[i].directory >= archive.m_Directory.size()) return false;
+            entry.dir = &archive.m_Directory[entries[i].directory];
+            if (entries[i].name == npos) continue;
+
+            auto name = archive.GetRange(entries[i].name, sizeof(RCFFilenameEntryHeader));
+            if (name.empty()) return false;
+            auto header = reinterpret_cast<const RCFFilenameEntryHeader*>(name.data());
+            if (header->path_len == 0 || archive.GetRange(entries[i].name + sizeof(RCFFilenameEntryHeader), header->path_len - 1).size() != header->path_len - 1) return false;
+            RcfArchive::SetName(entry, header);
+        }
+
+        auto& archiveEntries = archive.m_Entries;
+        for (auto& slot : slots) {
+            if (slot.value != npos && slot.value >= archiveEntries.size()) return false;
+        }
+        return archive.m_Index.Restore(slots, [&archiveEntries](uint32_t value) { return archiveEntries[value].path; });
+    }
+
+    static bool RestoreTree(RcfTree& tree, const RcfArchive& archive, std::span<const CacheNode> nodes, std::string_view rootName)
+    {
+        tree.Clear();
+        if (nodes.empty()) return false;
+
+        tree.m_RootName = rootName;
+        tree.m_Nodes.resize(nodes.size());
+        auto data = archive.m_Data;
+        for (size_t i = 0; i < nodes.size(); i++) {
+            const CacheNode& cached = nodes[i];
+            RcfTree::Node& node = tree.m_Nodes[i];
+            if ((cached.parent != npos && cached.parent >= nodes.size()) || (cached.firstChild != npos && cached.firstChild >= nodes.size()) ||
+                (cached.nextSibling != npos && cached.nextSibling >= nodes.size()) || (cached.entry != npos && cached.entry >= archive.GetEntryCount())) return false;
+
+            if (i == 0) node.name = tree.m_RootName;
+            else if (cached.nameOffset > data.size() || cached.nameLength > data.size() - cached.nameOffset) return false;
+            else node.name = std::string_view(reinterpret_cast<const char*>(data.data()) + cached.nameOffset, cached.nameLength);
+
+            node.parent = cached.parent;
+            node.firstChild = cached.firstChild;
+            node.nextSibling = cached.nextSibling;
+            node.entry = cached.entry;
+        }
+
+        // Links in range can still loop, every node has to hang below its parent and be reached once from the root
+        if (nodes[0].parent != npos) return false;
+        std::vector<bool> visited(nodes.size(), false);
+        std::vector<uint32_t> pending = { 0 };
+        visited[0] = true;
+        size_t visitedCount = 1;
+        while (!pending.empty()) {
+            uint32_t owner = pending.back();
+            pending.pop_back();
+            for (uint32_t child = nodes[owner].firstChild; child != npos; child = nodes[child].nextSibling) {
+                if (nodes[child].parent != owner || visited[child]) return false;
+                visited[child] = true;
+                visitedCount++;
+                pending.push_back(child);
+            }
+        }
+        return visitedCount == nodes.size();
+    }
+};
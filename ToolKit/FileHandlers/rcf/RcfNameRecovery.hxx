@@ -0,0 +1,410 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <span>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+#include <iostream>
+
+#include "RcfHash.hxx"
+#include "RcfArchive.hxx"
+#include "../io/ReadScheduler.hxx"
+
+// Recovers the paths of unnamed archive entries by hashing candidate names and
+// matching them against the hashes stored in the directory. Candidates come from
+// dictionaries, strings harvested out of P3D files and path templates such as
+// "art\{$dirs}\{$words}.{p3d,rsd}" where {a,b} lists alternatives and {$list}
+// expands a named word list. Templates expanding to more names than the limit are
+// refused, a run can be cancelled from another thread
+class RcfNameRecovery
+{
+public:
+    struct Match {
+        uint32_t hash;
+        std::string name;
+    };
+
+    // Names a single template may expand to, a few minutes of hashing on a desktop
+    static constexpr uint64_t DefaultLimit = 4000000000ull;
+
+    // Longest harvested string taken as a word, longer runs are data rather than names
+    static constexpr size_t MaxWordLength = 128;
+
+    void AddTarget(uint32_t hash)
+    {
+        m_Targets.push_back(hash);
+        m_bTargetsReady = false;
+    }
+
+    // Adds the hash of every entry the filename directory left without a name
+    void AddTargets(const RcfArchive& archive)
+    {
+        for (auto& entry : archive.GetEntries()) {
+            if (entry.path.empty()) AddTarget(entry.dir->hash);
+        }
+    }
+
+    size_t GetTargetCount() const { return m_Targets.size(); }
+
+    void AddCandidate(std::string_view name)
+    {
+        if (m_CandidateSet.count(name)) return;
+        m_CandidateSet.insert(m_Candidates.emplace_back(name));
+    }
+
+    void SetLimit(uint64_t limit) { m_Limit = limit; }
+
+    // Stops a run in progress as soon as the workers notice, the matches so far are returned
+    void Cancel() { m_bCancel = true; }
+
+    bool IsCancelled() const { return m_bCancel; }
+
+    // Adds every non-empty line of a text file as a candidate
+    bool AddDictionary(const std::string& filePath)
+    {
+        std::ifstream file(filePath);
+        if (!file) {
+            std::cerr << "Failed to open dictionary " << filePath << std::endl;
+            return false;
+        }
+
+        std::string line;
+        while (std::getline(file, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (!line.empty()) AddWord("dict", line);
+        }
+        return true;
+    }
+
+    // Adds a word to a named list usable in templates, words are candidates themselves. Every
+    // word is kept once per list
+    void AddWord(const std::string& list, std::string_view word)
+    {
+        auto& words = m_WordLists[list];
+        if (words.seen.count(word)) return;
+        words.seen.insert(words.words.emplace_back(word));
+        AddCandidate(word);
+    }
+
+    size_t GetWordCount(const std::string& list) const
+    {
+        auto it = m_WordLists.find(list);
+        return (it != m_WordLists.end()) ? it->second.words.size() : 0;
+    }
+
+    // Collects the printable runs out of binary data that could be names, P3D files keep them as
+    // length prefixed strings. Returns the runs taken
+    size_t HarvestStrings(std::span<const uint8_t> data, size_t minLength = 4)
+    {
+        size_t count = 0;
+        size_t start = 0;
+        for (size_t i = 0; i <= data.size(); i++) {
+            bool printable = (i < data.size()) && data[i] >= 0x20 && data[i] < 0x7F;
+            if (printable) continue;
+
+            std::string_view word(reinterpret_cast<const char*>(data.data() + start), i - start);
+            start = i + 1;
+            if (word.size() < minLength || !IsPathLike(word)) continue;
+            AddWord("p3d", word);
+
+            // Strip an extension so the name can be recombined in templates
+            size_t dot = word.find_last_of('.');
+            if (dot != std::string_view::npos && dot > 0) AddWord("p3d", word.substr(0, dot));
+            count++;
+        }
+        return count;
+    }
+
+    // Names and paths are letters, digits and a few separators, with at least one letter
+    static bool IsPathLike(std::string_view word)
+    {
+        if (word.size() > MaxWordLength) return false;
+        bool bLetter = false;
+        for (char c : word) {
+            bool letter = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+            bool digit = (c >= '0' && c <= '9');
+            if (!letter && !digit && c != '_' && c != '-' && c != '.' && c != '\\' && c != '/') return false;
+            bLetter |= letter;
+        }
+        return bLetter;
+    }
+
+    // Harvests the strings of every P3D file in the archive and fills the word lists
+    // "dirs" and "exts" with the directories and extensions of the known paths
+    void HarvestArchive(const RcfArchive& archive)
+    {
+        std::map<std::string, bool> dirs, exts;
+        ReadScheduler scheduler(archive.GetView());
+        for (auto& entry : archive.GetEntries()) {
+            if (entry.path.empty()) continue;
+
+            size_t slash = entry.path.find_last_of("\\/");
+            size_t dot = entry.path.find_last_of('.');
+            if (slash != std::string_view::npos) dirs[std::string(entry.path.substr(0, slash))] = true;
+            if (dot != std::string_view::npos && (slash == std::string_view::npos || dot > slash)) {
+                std::string ext(entry.path.substr(dot + 1));
+                for (auto& c : ext) c = PathIndex::NormalizeChar(c);
+                exts[ext] = true;
+
+                if (ext == "p3d") scheduler.Submit(entry.dir->fl_offset, entry.dir->fl_size, 0);
+            }
+        }
+
+        // P3D files are read in file order in a few large reads
+        std::mutex mutex;
+        scheduler.Run([this, &mutex](uint64_t, std::span<const uint8_t> data) {
+            std::lock_guard<std::mutex> lock(mutex);
+            HarvestStrings(data);
+            });
+        for (auto& dir : dirs) AddWord("dirs", dir.first);
+        for (auto& ext : exts) AddWord("exts", ext.first);
+    }
+
+    void AddTemplate(std::string_view pattern) { m_Templates.emplace_back(pattern); }
+
+    // Hashes every candidate and template expansion, returns the names matching a target
+    std::vector<Match> Run(unsigned int threadCount = std::thread::hardware_concurrency())
+    {
+        PrepareTargets();
+        m_Tested = 0;
+        m_Matches.clear();
+        std::vector<Match> matches;
+        if (m_Targets.empty()) return matches;
+        if (threadCount == 0) threadCount = 1;
+
+        auto start = std::chrono::steady_clock::now();
+
+        // Plain candidates, split in contiguous ranges over the workers
+        {
+            std::vector<std::thread> workers;
+            size_t step = (m_Candidates.size() + threadCount - 1) / threadCount;
+            for (unsigned int t = 0; t < threadCount; t++) {
+                size_t begin = (std::min)(m_Candidates.size(), t * step);
+                size_t end = (std::min)(m_Candidates.size(), begin + step);
+                if (begin == end) break;
+                workers.emplace_back([this, begin, end]() {
+                    std::vector<std::string_view> names(m_Candidates.begin() + begin, m_Candidates.begin() + end);
+                    std::vector<uint32_t> seeds(names.size(), RcfHash::Seed);
+                    TestBatch(seeds, names);
+                    });
+            }
+            for (auto& worker : workers) worker.join();
+        }
+
+        // Templates, literal leading segments are hashed once and the workers take the
+        // alternatives of the first varying segment round-robin
+        for (auto& pattern : m_Templates) {
+            std::vector<std::vector<std::string_view>> segments;
+            if (m_bCancel || !ParseTemplate(pattern, segments) || segments.empty()) continue;
+
+            uint64_t count = CountExpansions(segments);
+            if (count > m_Limit) {
+                std::cerr << "Template " << pattern << " expands to " << count << " names, more than the limit of " << m_Limit << ", skipped" << std::endl;
+                continue;
+            }
+
+            size_t split = 0;
+            uint32_t state = RcfHash::Seed;
+            std::string prefix;
+            while (split < segments.size() && segments[split].size() == 1) {
+                state = RcfHash::Update(state, segments[split][0]);
+                prefix += segments[split][0];
+                split++;
+            }
+            if (split == segments.size()) {
+                if (IsTarget(RcfHash::Finish(state))) AddMatch(RcfHash::Finish(state), prefix);
+                m_Tested++;
+                continue;
+            }
+
+            std::vector<std::thread> workers;
+            for (unsigned int t = 0; t < threadCount; t++) {
+                workers.emplace_back([this, &segments, split, state, &prefix, t, threadCount]() {
+                    auto& varying = segments[split];
+                    std::vector<uint32_t> seeds;
+                    std::vector<std::string_view> tails;
+                    if (split + 1 == segments.size()) {
+                        for (size_t i = t; i < varying.size(); i += threadCount) {
+                            seeds.push_back(state);
+                            tails.push_back(varying[i]);
+                        }
+                        TestBatch(seeds, tails, prefix);
+                        return;
+                    }
+                    for (size_t i = t; i < varying.size(); i += threadCount) {
+                        Expand(segments, split + 1, RcfHash::Update(state, varying[i]), prefix + std::string(varying[i]), seeds, tails);
+                    }
+                    });
+            }
+            for (auto& worker : workers) worker.join();
+        }
+
+        for (auto& hashMatches : m_Matches) {
+            for (auto& name : hashMatches.second) matches.push_back({ hashMatches.first, std::move(name) });
+        }
+        m_Matches.clear();
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("Name recovery: %llu candidates in %.2f s (%.1f M/s), %zu matches%s\n",
+            static_cast<unsigned long long>(m_Tested.load()), seconds, (seconds > 0.0) ? m_Tested.load() / seconds / 1e6 : 0.0, matches.size(),
+            m_bCancel ? ", cancelled" : "");
+        return matches;
+    }
+
+    uint64_t GetTestedCount() const { return m_Tested.load(); }
+
+private:
+    std::vector<uint32_t> m_Targets;
+    std::vector<uint64_t> m_TargetFilter;
+    bool m_bTargetsReady = false;
+
+    // Words are stored once, the set views the strings of the deque, which never moves them
+    struct WordList {
+        std::deque<std::string> words;
+        std::unordered_set<std::string_view> seen;
+    };
+
+    std::deque<std::string> m_Candidates;
+    std::unordered_set<std::string_view> m_CandidateSet;
+    std::map<std::string, WordList> m_WordLists;
+    std::vector<std::string> m_Templates;
+    uint64_t m_Limit = DefaultLimit;
+    std::atomic<bool> m_bCancel = false;
+
+    // Names found for each target hash, several names may share one
+    std::mutex m_MatchMutex;
+    std::unordered_map<uint32_t, std::vector<std::string>> m_Matches;
+    std::atomic<uint64_t> m_Tested = 0;
+
+    // Candidates are hashed in batches of this many names
+    static constexpr size_t BatchSize = 256;
+
+    // Bit filter over the low hash bits rejects almost every candidate without a search
+    static constexpr uint32_t FilterBits = 20;
+
+    void PrepareTargets()
+    {
+        if (m_bTargetsReady) return;
+        std::sort(m_Targets.begin(), m_Targets.end());
+        m_Targets.erase(std::unique(m_Targets.begin(), m_Targets.end()), m_Targets.end());
+        m_TargetFilter.assign((size_t(1) << FilterBits) / 64, 0);
+        for (uint32_t hash : m_Targets) {
+            uint32_t bit = hash & ((1u << FilterBits) - 1);
+            m_TargetFilter[bit / 64] |= uint64_t(1) << (bit % 64);
+        }
+        m_bTargetsReady = true;
+    }
+
+    bool IsTarget(uint32_t hash) const
+    {
+        uint32_t bit = hash & ((1u << FilterBits) - 1);
+        if ((m_TargetFilter[bit / 64] & (uint64_t(1) << (bit % 64))) == 0) return false;
+        return std::binary_search(m_Targets.begin(), m_Targets.end(), hash);
+    }
+
+    void AddMatch(uint32_t hash, std::string name)
+    {
+        std::lock_guard<std::mutex> lock(m_MatchMutex);
+        auto& names = m_Matches[hash];
+        for (auto& known : names) {
+            if (PathIndex::PathEquals(known, name)) return;
+        }
+        names.push_back(std::move(name));
+    }
+
+    // Names a parsed template expands to, saturating instead of overflowing
+    static uint64_t CountExpansions(const std::vector<std::vector<std::string_view>>& segments)
+    {
+        uint64_t count = 1;
+        for (auto& segment : segments) {
+            if (segment.empty()) return 0;
+            if (count > UINT64_MAX / segment.size()) return UINT64_MAX;
+            count *= segment.size();
+        }
+        return count;
+    }
+
+    // Hashes names continuing from the given states, full names are rebuilt only for hits
+    void TestBatch(const std::vector<uint32_t>& seeds, const std::vector<std::string_view>& names, const std::string& prefix = std::string())
+    {
+        uint32_t results[BatchSize];
+        for (size_t i = 0; i < names.size() && !m_bCancel; i += BatchSize) {
+            size_t count = (std::min)(BatchSize, names.size() - i);
+            RcfHash::UpdateBatch(seeds.data() + i, names.data() + i, results, count);
+            for (size_t k = 0; k < count; k++) {
+                uint32_t hash = RcfHash::Finish(results[k]);
+                if (IsTarget(hash)) AddMatch(hash, prefix + std::string(names[i + k]));
+            }
+        }
+        m_Tested += names.size();
+    }
+
+    // Walks the template depth first carrying the hash state of the prefix, the
+    // last segment is hashed in batches
+    void Expand(const std::vector<std::vector<std::string_view>>& segments, size_t index, uint32_t state, const std::string& prefix,
+        std::vector<uint32_t>& seeds, std::vector<std::string_view>& tails)
+    {
+        if (m_bCancel) return;
+        auto& segment = segments[index];
+        if (index + 1 == segments.size()) {
+            seeds.assign(segment.size(), state);
+            tails.assign(segment.begin(), segment.end());
+            TestBatch(seeds, tails, prefix);
+            return;
+        }
+
+        for (auto& part : segment) {
+            Expand(segments, index + 1, RcfHash::Update(state, part), prefix + std::string(part), seeds, tails);
+        }
+    }
+
+    // Splits a template into segments of alternatives, literal text is a single alternative
+    bool ParseTemplate(const std::string& pattern, std::vector<std::vector<std::string_view>>& segments)
+    {
+        std::string_view text(pattern);
+        while (!text.empty()) {
+            size_t open = text.find('{');
+            if (open != 0) {
+                segments.push_back({ text.substr(0, open) });
+                if (open == std::string_view::npos) break;
+                text.remove_prefix(open);
+            }
+
+            size_t close = text.find('}');
+            if (close == std::string_view::npos) {
+                std::cerr << "Unterminated template segment: " << pattern << std::endl;
+                return false;
+            }
+
+            std::string_view body = text.substr(1, close - 1);
+            std::vector<std::string_view> alternatives;
+            if (!body.empty() && body[0] == '$') {
+                auto it = m_WordLists.find(std::string(body.substr(1)));
+                if (it == m_WordLists.end() || it->second.words.empty()) return false;
+                for (auto& word : it->second.words) alternatives.push_back(word);
+            }
+            else {
+                while (true) {
+                    size_t comma = body.find(',');
+                    alternatives.push_back(body.substr(0, comma));
+                    if (comma == std::string_view::npos) break;
+                    body.remove_prefix(comma + 1);
+                }
+            }
+            segments.push_back(std::move(alternatives));
+            text.remove_prefix(close + 1);
+        }
+        return true;
+    }
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <thread>
+#include <iostream>
+
+#include "RcfArchive.hxx"
+#include "../io/BlockPack.hxx"
+
+// Converts cement libraries to block packs. Every entry is kept whole in one block unless it is
+// larger than a block, so opening an entry of the pack unpacks a single block. The tables are
+// unpacked when the pack is opened, RcfArchive opens packs like any other archive
+class RcfPack
+{
+public:
+    // Packs the archive into a new file, with LZ4 or zstd when they are built in and deflate otherwise
+    static bool Create(const RcfArchive& archive, const std::string& packFilePath, BlockPack::Codec codec,
+        uint32_t blockSize = BlockPack::DefaultBlockSize, unsigned int threadCount = std::thread::hardware_concurrency(), BlockPack::Stats* outStats = nullptr)
+    {
+        if (!archive.IsOpen()) return false;
+        if (archive.IsPacked()) {
+            std::cerr << "Archive is packed already." << std::endl;
+            return false;
+        }
+
+        // Header, directory and filename directory are read on every open
+        const RCFHeader& header = archive.GetHeader();
+        std::vector<BlockPack::Range> ranges;
+        ranges.push_back({ 0, sizeof(RCFHeader), true });
+        ranges.push_back({ header.dir_offset, uint64_t(header.number_files) * sizeof(RCFDirectoryEntry), true });
+        ranges.push_back({ header.flnames_dir_offset, uint64_t(header.flnames_dir_size) + 2 * sizeof(uint32_t), true });
+        for (auto& entry : archive.GetEntries()) ranges.push_back({ entry.dir->fl_offset, entry.dir->fl_size, false });
+
+        return BlockPack::Create(archive.GetData(), std::move(ranges), packFilePath, codec, blockSize, threadCount, outStats);
+    }
+};
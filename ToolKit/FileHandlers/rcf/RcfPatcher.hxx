@@ -0,0 +1,341 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <span>
+#include <filesystem>
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+
+#include "RCF.h"
+#include "RcfArchive.hxx"
+#include "RcfHash.hxx"
+
+// Patches a cement library in place. Replaced data is written over the old entry
+// when it fits in the slot up to the next entry, otherwise it is appended at the
+// end of the archive. Only the directory, the filename directory and the header
+// are rewritten, so the cost follows the bytes that changed
+class RcfPatcher
+{
+public:
+    struct Stats {
+        size_t inPlace = 0;
+        size_t appended = 0;
+        size_t added = 0;
+        uint64_t bytes = 0;
+        double seconds = 0.0;
+    };
+
+    void SetAlignment(uint32_t alignment) { m_Alignment = (alignment > 0) ? alignment : 1; }
+
+    // Replaces or adds the entry with the content of a file from disc
+    bool SetFile(std::string_view archivePath, const std::string& filePath)
+    {
+        std::error_code error;
+        uint64_t size = std::filesystem::file_size(filePath, error);
+        if (error) {
+            std::cerr << "Failed to open file " << filePath << std::endl;
+            return false;
+        }
+        auto time = std::filesystem::last_write_time(filePath, error);
+
+        Patch& patch = GetPatch(archivePath);
+        patch.size = size;
+        patch.filePath = filePath;
+        patch.data = {};
+        patch.date = error ? 0 : static_cast<uint32_t>(std::chrono::system_clock::to_time_t(std::chrono::file_clock::to_sys(time)));
+        return true;
+    }
+
+    // Replaces or adds the entry with data owned by the caller
+    void SetData(std::string_view archivePath, std::span<const uint8_t> data, uint32_t date = 0)
+    {
+        Patch& patch = GetPatch(archivePath);
+        patch.size = data.size();
+        patch.filePath.clear();
+        patch.data = data;
+        patch.date = date;
+    }
+
+    // Sets every file below the directory, archive paths are relative with '\' separators
+    bool SetDirectory(const std::string& rootDir)
+    {
+        std::error_code error;
+        for (auto& item : std::filesystem::recursive_directory_iterator(rootDir, error)) {
+            if (!item.is_regular_file()) continue;
+            std::string archivePath = std::filesystem::relative(item.path(), rootDir).generic_string();
+            std::replace(archivePath.begin(), archivePath.end(), '/', '\\');
+            if (!SetFile(archivePath, item.path().string())) return false;
+        }
+        return !error;
+    }
+
+    size_t GetPatchCount() const { return m_Patches.size(); }
+
+    // Applies the patches to the archive on disc, the archive must not be mapped by anyone else
+    bool Apply(const std::string& archiveFilePath, Stats* outStats = nullptr)
+    {
+        Stats stats;
+        auto start = std::chrono::steady_clock::now();
+
+        // Tables are copied out so the mapping can be released before writing
+        RCFHeader header;
+        uint32_t prefix[2] = {};
+        std::vector<Entry> entries;
+        uint64_t fileSize = 0;
+        {
+            RcfArchive archive;
+            if (!archive.Open(archiveFilePath)) return false;
+            if (archive.IsPacked()) {
+                std::cerr << "Can't patch a packed archive in place, repack it first." << std::endl;
+                return false;
+            }
+
+            header = archive.GetHeader();
+            fileSize = archive.GetData().size();
+            // A name table cut off by the end of the file gets a fresh prefix holding the entry count
+            if (header.flnames_dir_offset <= fileSize && sizeof(prefix) <= fileSize - header.flnames_dir_offset) {
+                memcpy(prefix, archive.GetData().data() + header.flnames_dir_offset, sizeof(prefix));
+            }
+            else {
+                prefix[0] = header.number_files;
+            }
+
+            for (auto& archiveEntry : archive.GetEntries()) {
+                Entry entry;
+                entry.dir = *archiveEntry.dir;
+                entry.path = archiveEntry.path;
+                if (archiveEntry.name) entry.name = *archiveEntry.name;
+                entry.named = !archiveEntry.path.empty();
+                entries.push_back(entry);
+            }
+        }
+
+        // Slot of an entry ends at the next entry, table or the end of the file
+        std::vector<uint64_t> boundaries = { header.dir_offset, header.flnames_dir_offset, fileSize };
+        for (auto& entry : entries) boundaries.push_back(entry.dir.fl_offset);
+        std::sort(boundaries.begin(), boundaries.end());
+
+        // Entries deduplicated on repack share their data, patching one of them in place would change all.
+        // Empty entries hold no data and may sit at the offset of the next one
+        std::vector<uint32_t> offsets;
+        for (auto& entry : entries) {
+            if (entry.dir.fl_size > 0) offsets.push_back(entry.dir.fl_offset);
+        }
+        std::sort(offsets.begin(), offsets.end());
+
+        PathIndex index;
+        index.Reserve(entries.size() + m_Patches.size());
+        for (uint32_t i = 0; i < entries.size(); i++) {
+            if (entries[i].named) index.Insert(entries[i].path, i);
+        }
+
+        FILE* file = fopen(archiveFilePath.c_str(), "r+b");
+        if (file == nullptr) {
+            std::cerr << "Failed to open " << archiveFilePath << " for writing" << std::endl;
+            return false;
+        }
+
+        // Entry data, appended entries go after everything currently in the file
+        uint64_t end = Align(fileSize);
+        bool ok = true;
+        for (auto& patch : m_Patches) {
+            uint32_t entryIndex = index.Find(patch.path);
+            uint64_t offset = 0;
+            if (entryIndex != PathIndex::npos) {
+                Entry& entry = entries[entryIndex];
+                // Entries at or past the end of the file, empty or corrupt, have no slot and get appended
+                auto next = std::upper_bound(boundaries.begin(), boundaries.end(), uint64_t(entry.dir.fl_offset));
+                uint64_t slotEnd = (next != boundaries.end()) ? *next : fileSize;
+                bool fits = entry.dir.fl_offset < fileSize && patch.size <= slotEnd - entry.dir.fl_offset;
+                auto sharing = std::equal_range(offsets.begin(), offsets.end(), entry.dir.fl_offset);
+                if (fits && sharing.second - sharing.first == (entry.dir.fl_size > 0 ? 1 : 0)) {
+                    offset = entry.dir.fl_offset;
+                    stats.inPlace++;
+                }
+                else {
+                    offset = end;
+                    end = Align(end + patch.size);
+                    stats.appended++;
+                }
+            }
+            else {
+                Entry entry;
+                entry.path = patch.path;
+                entry.dir.hash = RcfHash::HashName(patch.path);
+                entry.name = { 0, 0, 0, static_cast<uint32_t>(patch.path.size() + 1) };
+                entry.named = true;
+                entries.push_back(entry);
+                entryIndex = static_cast<uint32_t>(entries.size() - 1);
+
+                offset = end;
+                end = Align(end + patch.size);
+                stats.added++;
+            }
+
+            if (offset + patch.size > UINT32_MAX) {
+                std::cerr << "Error: RCF archives are limited to 4 GB." << std::endl;
+                ok = false;
+                break;
+            }
+
+            Entry& entry = entries[entryIndex];
+            entry.dir.fl_offset = static_cast<uint32_t>(offset);
+            entry.dir.fl_size = static_cast<uint32_t>(patch.size);
+            entry.name.date = patch.date;
+            if (!WritePatch(file, offset, patch)) {
+                std::cerr << "Failed to write " << patch.path << std::endl;
+                ok = false;
+                break;
+            }
+            stats.bytes += patch.size;
+        }
+
+        // Tables, written back to back over the old ones when they still fit before the first entry
+        // behind the first of them. Entries between the two tables keep them from being rewritten in place
+        if (ok) {
+            std::vector<uint8_t> directory, names;
+            BuildTables(entries, prefix, header.number_files, directory, names);
+
+            uint64_t tableStart = (std::min)(uint64_t(header.dir_offset), uint64_t(header.flnames_dir_offset));
+            uint64_t tableLimit = fileSize;
+            for (auto& entry : entries) {
+                if (entry.dir.fl_offset > tableStart) tableLimit = (std::min)(tableLimit, uint64_t(entry.dir.fl_offset));
+            }
+            uint64_t tableSize = directory.size() + names.size();
+
+            // Tables at the very end of the file may grow freely unless data got appended behind them
+            bool canGrow = (tableLimit == fileSize) && (end == Align(fileSize));
+            if (tableStart + tableSize > tableLimit && !canGrow) tableStart = end;
+
+            header.dir_offset = static_cast<uint32_t>(tableStart);
+            header.dir_size = static_cast<uint32_t>(directory.size());
+            header.flnames_dir_offset = static_cast<uint32_t>(tableStart + directory.size());
+            header.flnames_dir_size = static_cast<uint32_t>(names.size() - sizeof(prefix));
+            header.number_files = static_cast<uint32_t>(entries.size());
+
+            ok = WriteAt(file, tableStart, directory.data(), directory.size()) &&
+                WriteAt(file, tableStart + directory.size(), names.data(), names.size()) &&
+                WriteAt(file, 0, &header, sizeof(header));
+            stats.bytes += tableSize + sizeof(header);
+        }
+        ok = (fclose(file) == 0) && ok;
+
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("Patched %s: %zu in place, %zu appended, %zu added, %.1f KB written in %.3f s\n", archiveFilePath.c_str(),
+            stats.inPlace, stats.appended, stats.added, stats.bytes / 1024.0, stats.seconds);
+        if (outStats) *outStats = stats;
+        return ok;
+    }
+
+private:
+    struct Patch {
+        std::string path;
+        uint32_t date = 0;
+        uint64_t size = 0;
+        std::string filePath;
+        std::span<const uint8_t> data;
+    };
+
+    struct Entry {
+        RCFDirectoryEntry dir = {};
+        RCFFilenameEntryHeader name = {};
+        std::string path;
+        bool named = false;
+    };
+
+    std::deque<Patch> m_Patches;
+    PathIndex m_Index;
+    uint32_t m_Alignment = 2048;
+
+    uint64_t Align(uint64_t value) const { return (value + m_Alignment - 1) / m_Alignment * m_Alignment; }
+
+    Patch& GetPatch(std::string_view archivePath)
+    {
+        uint32_t index = m_Index.Find(archivePath);
+        if (index != PathIndex::npos) return m_Patches[index];
+
+        Patch& patch = m_Patches.emplace_back();
+        patch.path = archivePath;
+        m_Index.Insert(patch.path, static_cast<uint32_t>(m_Patches.size() - 1));
+        return patch;
+    }
+
+    static bool Seek(FILE* file, uint64_t offset)
+    {
+#ifdef _WIN32
+        return _fseeki64(file, static_cast<int64_t>(offset), SEEK_SET) == 0;
+#else
+        return fseeko(file, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+    }
+
+    static bool WriteAt(FILE* file, uint64_t offset, const void* data, size_t size)
+    {
+        return Seek(file, offset) && fwrite(data, 1, size, file) == size;
+    }
+
+    // Copies the patch into the archive, files from disc go through a fixed size buffer
+    bool WritePatch(FILE* file, uint64_t offset, const Patch& patch)
+    {
+        if (patch.filePath.empty()) return WriteAt(file, offset, patch.data.data(), patch.data.size());
+
+        FILE* source = fopen(patch.filePath.c_str(), "rb");
+        if (source == nullptr) return false;
+
+        bool ok = Seek(file, offset);
+        std::vector<uint8_t> buffer(static_cast<size_t>((std::min)(patch.size, uint64_t(4 * 1024 * 1024))));
+        uint64_t left = patch.size;
+        while (ok && left > 0) {
+            size_t size = static_cast<size_t>((std::min)(left, uint64_t(buffer.size())));
+            ok = fread(buffer.data(), 1, size, source) == size && fwrite(buffer.data(), 1, size, file) == size;
+            left -= size;
+        }
+        fclose(source);
+        return ok;
+    }
+
+    // Directory sorted by hash and filename directory in the data order RcfArchive pairs it with
+    static void BuildTables(const std::vector<Entry>& entries, const uint32_t prefix[2], uint32_t oldCount,
+        std::vector<uint8_t>& directory, std::vector<uint8_t>& names)
+    {
+        std::vector<uint32_t> byHash(entries.size());
+        for (uint32_t i = 0; i < byHash.size(); i++) byHash[i] = i;
+        std::stable_sort(byHash.begin(), byHash.end(), [&](uint32_t a, uint32_t b) {
+            return entries[a].dir.hash < entries[b].dir.hash;
+            });
+
+        directory.resize(entries.size() * sizeof(RCFDirectoryEntry));
+        for (size_t i = 0; i < byHash.size(); i++) {
+            memcpy(directory.data() + i * sizeof(RCFDirectoryEntry), &entries[byHash[i]].dir, sizeof(RCFDirectoryEntry));
+        }
+
+        // Ties on the offset are broken by the position in the directory, as the reader does
+        std::vector<uint32_t> byOffset(byHash.size());
+        for (uint32_t i = 0; i < byOffset.size(); i++) byOffset[i] = i;
+        std::sort(byOffset.begin(), byOffset.end(), [&](uint32_t a, uint32_t b) {
+            uint32_t offsetA = entries[byHash[a]].dir.fl_offset, offsetB = entries[byHash[b]].dir.fl_offset;
+            return (offsetA != offsetB) ? offsetA < offsetB : a < b;
+            });
+
+        uint32_t count[2] = { (prefix[0] == oldCount) ? static_cast<uint32_t>(entries.size()) : prefix[0], prefix[1] };
+        names.assign(reinterpret_cast<const uint8_t*>(count), reinterpret_cast<const uint8_t*>(count) + sizeof(count));
+        for (uint32_t position : byOffset) {
+            const Entry& entry = entries[byHash[position]];
+            if (!entry.named) continue;
+
+            RCFFilenameEntryHeader name = entry.name;
+            name.path_len = static_cast<uint32_t>(entry.path.size() + 1);
+            size_t start = names.size();
+            names.resize(start + sizeof(name) + entry.path.size() + sizeof(uint32_t), 0);
+            memcpy(names.data() + start, &name, sizeof(name));
+            memcpy(names.data() + start + sizeof(name), entry.path.data(), entry.path.size());
+        }
+    }
+};
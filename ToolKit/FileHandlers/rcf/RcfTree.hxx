@@ -0,0 +1,166 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <string_view>
+
+#include "RcfArchive.hxx"
+#include "../io/PathIndex.hxx"
+
+// Directory tree of an archive stored as one contiguous node array. Nodes link to
+// each other by index and their names are views into the archive paths, so the
+// tree holds no strings of its own
+class RcfTree
+{
+public:
+    static constexpr uint32_t npos = UINT32_MAX;
+
+    struct Node {
+        std::string_view name;
+        uint32_t parent = npos;
+        uint32_t firstChild = npos;
+        uint32_t nextSibling = npos;
+        uint32_t entry = npos;
+
+        bool IsDirectory() const { return entry == npos; }
+    };
+
+    RcfTree() {}
+    RcfTree(const RcfTree&) = delete;
+    RcfTree& operator=(const RcfTree&) = delete;
+
+    // Builds the tree of every named entry, the root is labeled with rootName.
+    // The archive has to outlive the tree
+    void Build(const RcfArchive& archive, std::string_view rootName)
+    {
+        m_RootName = rootName;
+        m_Nodes.clear();
+        m_Nodes.reserve(archive.GetEntryCount() + archive.GetEntryCount() / 4 + 1);
+        m_Nodes.push_back({ m_RootName });
+
+        // Last child per node keeps the archive order while appending, the child
+        // table finds a directory by parent and name without scanning siblings
+        m_LastChild.assign(1, npos);
+        m_ChildSlots.assign(NextPowerOfTwo(archive.GetEntryCount() / 2 + 16), npos);
+        m_ChildCount = 0;
+
+        // Files of one directory tend to be stored together, the last directory is reused
+        // when the next path starts with the same one
+        std::string_view lastDirectory;
+        uint32_t lastDirectoryNode = 0;
+
+        auto& entries = archive.GetEntries();
+        for (uint32_t i = 0; i < entries.size(); i++) {
+            std::string_view path = entries[i].path;
+            if (path.empty()) continue;
+
+            size_t separator = path.find_last_of("\\/");
+            std::string_view directory = (separator != std::string_view::npos) ? path.substr(0, separator) : std::string_view();
+            if (!PathIndex::PathEquals(directory, lastDirectory)) {
+                uint32_t current = 0;
+                size_t start = 0;
+                while (start < directory.size()) {
+                    size_t end = directory.find_first_of("\\/", start);
+                    if (end == std::string_view::npos) end = directory.size();
+                    if (end > start) current = GetDirectory(current, directory.substr(start, end - start));
+                    start = end + 1;
+                }
+                lastDirectory = directory;
+                lastDirectoryNode = current;
+            }
+
+            uint32_t file = AddNode(lastDirectoryNode, path.substr(separator + 1));
+            m_Nodes[file].entry = i;
+        }
+
+        m_LastChild.clear();
+        m_LastChild.shrink_to_fit();
+        m_ChildSlots.clear();
+        m_ChildSlots.shrink_to_fit();
+    }
+
+    void Clear()
+    {
+        m_Nodes.clear();
+        m_RootName.clear();
+    }
+
+    bool IsEmpty() const { return m_Nodes.empty(); }
+
+    const Node& GetRoot() const { return m_Nodes[0]; }
+
+    const Node& GetNode(uint32_t index) const { return m_Nodes[index]; }
+
+    size_t GetNodeCount() const { return m_Nodes.size(); }
+
+    // Approximate memory held by the tree
+    size_t GetMemoryUsage() const { return m_Nodes.capacity() * sizeof(Node) + m_RootName.capacity(); }
+
+private:
+    friend class RcfIndexCache;
+
+    std::vector<Node> m_Nodes;
+    std::string m_RootName;
+
+    // Build time only
+    std::vector<uint32_t> m_LastChild;
+    std::vector<uint32_t> m_ChildSlots;
+    size_t m_ChildCount = 0;
+
+    static size_t NextPowerOfTwo(size_t value)
+    {
+        size_t result = 1;
+        while (result < value) result <<= 1;
+        return result;
+    }
+
+    static uint64_t HashChild(uint32_t parent, std::string_view name)
+    {
+        return PathIndex::HashPath(name) ^ (uint64_t(parent) * 0x9E3779B97F4A7C15ull);
+    }
+
+    uint32_t AddNode(uint32_t parent, std::string_view name)
+    {
+        uint32_t index = static_cast<uint32_t>(m_Nodes.size());
+        Node& node = m_Nodes.emplace_back();
+        node.name = name;
+        node.parent = parent;
+        m_LastChild.push_back(npos);
+
+        if (m_LastChild[parent] == npos) m_Nodes[parent].firstChild = index;
+        else m_Nodes[m_LastChild[parent]].nextSibling = index;
+        m_LastChild[parent] = index;
+        return index;
+    }
+
+    // Finds or creates the directory with the given name under parent
+    uint32_t GetDirectory(uint32_t parent, std::string_view name)
+    {
+        uint64_t hash = HashChild(parent, name);
+        size_t mask = m_ChildSlots.size() - 1;
+        size_t slot = hash & mask;
+        for (; m_ChildSlots[slot] != npos; slot = (slot + 1) & mask) {
+            const Node& node = m_Nodes[m_ChildSlots[slot]];
+            if (node.parent == parent && PathIndex::PathEquals(node.name, name)) return m_ChildSlots[slot];
+        }
+
+        uint32_t index = AddNode(parent, name);
+        m_ChildSlots[slot] = index;
+        if (++m_ChildCount * 2 > m_ChildSlots.size()) GrowChildSlots();
+        return index;
+    }
+
+    void GrowChildSlots()
+    {
+        std::vector<uint32_t> slots(m_ChildSlots.size() * 2, npos);
+        size_t mask = slots.size() - 1;
+        for (uint32_t index : m_ChildSlots) {
+            if (index == npos) continue;
+            size_t slot = HashChild(m_Nodes[index].parent, m_Nodes[index].name) & mask;
+            while (slots[slot] != npos) slot = (slot + 1) & mask;
+            slots[slot] = index;
+        }
+        m_ChildSlots.swap(slots);
+    }
+};
@@ -0,0 +1,382 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <span>
+#include <filesystem>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+
+#include "RCF.h"
+#include "RcfArchive.hxx"
+#include "RcfHash.hxx"
+#include "RcfDedup.hxx"
+
+// Builds cement libraries. Files are laid out as header, directory sorted by hash,
+// filename directory in data order and the aligned entry data. Entry data is
+// streamed through a bounded ring of chunks, sources are read by a pool of
+// workers while a single writer appends the chunks to the archive in order.
+// Sources with identical content are stored once and share their data offset
+class RcfWriter
+{
+public:
+    // Entry data may come from a file on disc or from memory such as an archive mapping
+    struct Source {
+        std::string path;
+        uint32_t date = 0;
+        uint64_t size = 0;
+        std::string filePath;
+        std::span<const uint8_t> data;
+    };
+
+    void SetAlignment(uint32_t alignment) { m_Alignment = (alignment > 0) ? alignment : 1; }
+
+    void SetChunkSize(uint32_t chunkSize) { m_ChunkSize = (chunkSize > 0) ? chunkSize : 1; }
+
+    // Stores sources held in memory with the same content only once, on by default
+    void SetDeduplicate(bool deduplicate) { m_bDeduplicate = deduplicate; }
+
+    // Adds a file from disc, replaces an earlier source with the same archive path
+    bool AddFile(std::string_view archivePath, const std::string& filePath)
+    {
+        std::error_code error;
+        uint64_t size = std::filesystem::file_size(filePath, error);
+        if (error) {
+            std::cerr << "Failed to open file " << filePath << std::endl;
+            return false;
+        }
+        auto time = std::filesystem::last_write_time(filePath, error);
+
+        Source& source = GetSource(archivePath);
+        source.size = size;
+        source.filePath = filePath;
+        source.data = {};
+        source.date = error ? 0 : static_cast<uint32_t>(std::chrono::system_clock::to_time_t(std::chrono::file_clock::to_sys(time)));
+        return true;
+    }
+
+    // Adds data owned by the caller, it has to stay valid until Write returns
+    void AddData(std::string_view archivePath, std::span<const uint8_t> data, uint32_t date = 0)
+    {
+        Source& source = GetSource(archivePath);
+        source.size = data.size();
+        source.filePath.clear();
+        source.data = data;
+        source.date = date;
+    }
+
+    // Adds every file below the directory, archive paths are relative with '\' separators
+    bool AddDirectory(const std::string& rootDir)
+    {
+        std::error_code error;
+        std::vector<std::filesystem::path> files;
+        for (auto& item : std::filesystem::recursive_directory_iterator(rootDir, error)) {
+            if (item.is_regular_file()) files.push_back(item.path());
+        }
+        if (error) {
+            std::cerr << "Failed to read directory " << rootDir << std::endl;
+            return false;
+        }
+        std::sort(files.begin(), files.end());
+
+        for (auto& file : files) {
+            std::string archivePath = std::filesystem::relative(file, rootDir).generic_string();
+            std::replace(archivePath.begin(), archivePath.end(), '/', '\\');
+            if (!AddFile(archivePath, file.string())) return false;
+        }
+        return true;
+    }
+
+    // Adds every named entry of an archive in data order and keeps its unknown header fields,
+    // entries without a name can't be stored and are left out
+    void AddArchive(const RcfArchive& archive)
+    {
+        size_t skipped = 0;
+        for (auto& entry : archive.GetEntries()) {
+            if (entry.path.empty()) {
+                skipped++;
+                continue;
+            }
+            AddData(entry.path, archive.GetEntryData(entry), entry.name ? entry.name->date : 0);
+        }
+        if (skipped > 0) std::cerr << "Skipped " << skipped << " entries without a name." << std::endl;
+
+        m_Unk1 = archive.GetHeader().unk1;
+        m_Unk2 = archive.GetHeader().unk2;
+    }
+
+    size_t GetSourceCount() const { return m_Sources.size(); }
+
+    // Writes the archive, memory use is bounded by the chunk ring whatever the entry sizes
+    bool Write(const std::string& outputPath, unsigned int threadCount = std::thread::hardware_concurrency())
+    {
+        auto start = std::chrono::steady_clock::now();
+        if (threadCount == 0) threadCount = 1;
+
+        // Layout
+        RCFHeader header = {};
+        memcpy(header.file_id, "ATG CORE CEMENT LIBRARY", sizeof("ATG CORE CEMENT LIBRARY"));
+        header.unk1 = m_Unk1;
+        header.unk2 = m_Unk2;
+        header.number_files = static_cast<uint32_t>(m_Sources.size());
+        header.dir_offset = Align(sizeof(RCFHeader));
+        header.dir_size = header.number_files * sizeof(RCFDirectoryEntry);
+
+        uint64_t namesSize = 0;
+        for (auto& source : m_Sources) namesSize += sizeof(RCFFilenameEntryHeader) + source.path.size() + sizeof(uint32_t);
+        header.flnames_dir_offset = header.dir_offset + header.dir_size;
+        header.flnames_dir_size = static_cast<uint32_t>(namesSize);
+
+        // Duplicates point at the data of the first source holding the same bytes
+        GetOwners(threadCount);
+
+        std::vector<RCFDirectoryEntry> directory(m_Sources.size());
+        uint64_t dataStart = Align(uint64_t(header.flnames_dir_offset) + 8 + namesSize);
+        uint64_t position = dataStart;
+        uint64_t shared = 0;
+        for (size_t i = 0; i < m_Sources.size(); i++) {
+            directory[i].hash = RcfHash::HashName(m_Sources[i].path);
+            directory[i].fl_size = static_cast<uint32_t>(m_Sources[i].size);
+            if (m_Owners[i] != i) {
+                directory[i].fl_offset = directory[m_Owners[i]].fl_offset;
+                shared += m_Sources[i].size;
+                continue;
+            }
+
+            directory[i].fl_offset = static_cast<uint32_t>(position);
+            if (m_Sources[i].size > UINT32_MAX || position > UINT32_MAX) {
+                std::cerr << "Error: RCF archives are limited to 4 GB." << std::endl;
+                return false;
+            }
+            position = Align(position + m_Sources[i].size);
+        }
+        if (position > UINT32_MAX) {
+            std::cerr << "Error: RCF archives are limited to 4 GB." << std::endl;
+            return false;
+        }
+
+        FILE* file = fopen(outputPath.c_str(), "wb");
+        if (file == nullptr) {
+            std::cerr << "Failed to create file " << outputPath << std::endl;
+            return false;
+        }
+
+        // Tables
+        std::vector<uint8_t> tables(static_cast<size_t>(dataStart), 0);
+        memcpy(tables.data(), &header, sizeof(header));
+
+        std::vector<uint32_t> byHash(m_Sources.size());
+        for (uint32_t i = 0; i < byHash.size(); i++) byHash[i] = i;
+        std::sort(byHash.begin(), byHash.end(), [&directory](uint32_t a, uint32_t b) {
+            return (directory[a].hash != directory[b].hash) ? directory[a].hash < directory[b].hash : a < b;
+            });
+        std::vector<uint32_t> rank(m_Sources.size());
+        for (uint32_t i = 0; i < byHash.size(); i++) {
+            rank[byHash[i]] = i;
+            memcpy(tables.data() + header.dir_offset + i * sizeof(RCFDirectoryEntry), &directory[byHash[i]], sizeof(RCFDirectoryEntry));
+        }
+
+        // Names follow the data order, entries sharing an offset in the order of the directory
+        std::vector<uint32_t> nameOrder(m_Sources.size());
+        for (uint32_t i = 0; i < nameOrder.size(); i++) nameOrder[i] = i;
+        std::sort(nameOrder.begin(), nameOrder.end(), [&](uint32_t a, uint32_t b) {
+            return (directory[a].fl_offset != directory[b].fl_offset) ? directory[a].fl_offset < directory[b].fl_offset : rank[a] < rank[b];
+            });
+
+        // Filename directory follows an 8 byte prefix, written as the file count and zero
+        uint8_t* names = tables.data() + header.flnames_dir_offset;
+        uint32_t prefix[2] = { header.number_files, 0 };
+        memcpy(names, prefix, sizeof(prefix));
+        names += sizeof(prefix);
+        for (uint32_t i : nameOrder) {
+            const Source& source = m_Sources[i];
+            RCFFilenameEntryHeader name = { source.date, 0, 0, static_cast<uint32_t>(source.path.size() + 1) };
+            memcpy(names, &name, sizeof(name));
+            memcpy(names + sizeof(name), source.path.data(), source.path.size());
+            names += sizeof(name) + source.path.size() + sizeof(uint32_t);
+        }
+
+        bool ok = fwrite(tables.data(), 1, tables.size(), file) == tables.size();
+        if (ok) ok = StreamData(file, dataStart, threadCount);
+        ok = (fclose(file) == 0) && ok;
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (ok) {
+            printf("Wrote %s: %zu files, %.1f MB in %.2f s, %.1f MB/s, %.1f MB of duplicates shared\n", outputPath.c_str(), m_Sources.size(),
+                position / (1024.0 * 1024.0), seconds, (seconds > 0.0) ? position / seconds / (1024.0 * 1024.0) : 0.0, shared / (1024.0 * 1024.0));
+        }
+        else {
+            std::cerr << "Failed to write " << outputPath << std::endl;
+        }
+        return ok;
+    }
+
+private:
+    std::deque<Source> m_Sources;
+    PathIndex m_Index;
+    uint32_t m_Alignment = 2048;
+    uint32_t m_ChunkSize = 4 * 1024 * 1024;
+    uint32_t m_Unk1 = 0;
+    uint32_t m_Unk2 = 0;
+    bool m_bDeduplicate = true;
+
+    // Source whose data every source is stored with, itself unless it duplicates an earlier one
+    std::vector<uint32_t> m_Owners;
+
+    // Groups the sources held in memory by content, files from disc are always stored
+    void GetOwners(unsigned int threadCount)
+    {
+        m_Owners.resize(m_Sources.size());
+        for (uint32_t i = 0; i < m_Owners.size(); i++) m_Owners[i] = i;
+        if (!m_bDeduplicate) return;
+
+        std::vector<uint32_t> sources;
+        std::vector<std::span<const uint8_t>> data;
+        for (uint32_t i = 0; i < m_Sources.size(); i++) {
+            if (!m_Sources[i].filePath.empty() || m_Sources[i].size == 0) continue;
+            sources.push_back(i);
+            data.push_back(m_Sources[i].data);
+        }
+
+        for (auto& group : RcfDedup::GroupIdentical(data, RcfDedup::HashAll(data, threadCount))) {
+            for (uint32_t item : group.items) m_Owners[sources[item]] = sources[group.items[0]];
+        }
+    }
+
+    uint64_t Align(uint64_t value) const { return (value + m_Alignment - 1) / m_Alignment * m_Alignment; }
+
+    Source& GetSource(std::string_view archivePath)
+    {
+        uint32_t index = m_Index.Find(archivePath);
+        if (index != PathIndex::npos) return m_Sources[index];
+
+        Source& source = m_Sources.emplace_back();
+        source.path = archivePath;
+        m_Index.Insert(source.path, static_cast<uint32_t>(m_Sources.size() - 1));
+        return source;
+    }
+
+    struct Chunk {
+        uint32_t source;
+        uint64_t offset;
+        uint32_t size;
+    };
+
+    // Reads a chunk of a source into the buffer, files are opened per chunk so any worker can take any chunk
+    bool ReadChunk(const Chunk& chunk, uint8_t* buffer)
+    {
+        const Source& source = m_Sources[chunk.source];
+        if (source.filePath.empty()) {
+            memcpy(buffer, source.data.data() + chunk.offset, chunk.size);
+            return true;
+        }
+
+        FILE* file = fopen(source.filePath.c_str(), "rb");
+        if (file == nullptr) return false;
+#ifdef _WIN32
+        bool ok = _fseeki64(file, static_cast<int64_t>(chunk.offset), SEEK_SET) == 0;
+#else
+        bool ok = fseeko(file, static_cast<off_t>(chunk.offset), SEEK_SET) == 0;
+#endif
+        ok = ok && fread(buffer, 1, chunk.size, file) == chunk.size;
+        fclose(file);
+        return ok;
+    }
+
+    bool StreamData(FILE* file, uint64_t position, unsigned int threadCount)
+    {
+        std::vector<Chunk> chunks;
+        for (uint32_t i = 0; i < m_Sources.size(); i++) {
+            if (m_Owners[i] != i) continue;
+            uint64_t offset = 0;
+            do {
+                uint32_t size = static_cast<uint32_t>((std::min)(uint64_t(m_ChunkSize), m_Sources[i].size - offset));
+                chunks.push_back({ i, offset, size });
+                offset += size;
+            } while (offset < m_Sources[i].size);
+        }
+
+        // Ring of buffers, a slot holds chunk i once ready[i % slots] == i + 1
+        size_t slotCount = (std::max)(size_t(2), size_t(threadCount) * 2);
+        std::vector<std::vector<uint8_t>> buffers(slotCount);
+        std::vector<size_t> ready(slotCount, 0);
+        std::mutex mutex;
+        std::condition_variable readyChanged, slotFreed;
+        size_t written = 0;
+        std::atomic<size_t> next = 0;
+        std::atomic<bool> failed = false;
+
+        auto reader = [&]() {
+            for (size_t i = next++; i < chunks.size() && !failed; i = next++) {
+                size_t slot = i % slotCount;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    slotFreed.wait(lock, [&]() { return i < written + slotCount || failed; });
+                    if (failed) break;
+                }
+
+                auto& buffer = buffers[slot];
+                if (buffer.size() < chunks[i].size) buffer.resize(chunks[i].size);
+                bool ok = ReadChunk(chunks[i], buffer.data());
+
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!ok) {
+                    std::cerr << "Failed to read " << m_Sources[chunks[i].source].filePath << std::endl;
+                    failed = true;
+                    slotFreed.notify_all();
+                }
+                ready[slot] = i + 1;
+                readyChanged.notify_all();
+            }
+        };
+
+        std::vector<std::thread> readers;
+        for (unsigned int t = 0; t < threadCount; t++) readers.emplace_back(reader);
+
+        // Sequential writer, pads every entry up to the next aligned offset
+        static const std::vector<uint8_t> padding(65536, 0);
+        for (size_t i = 0; i < chunks.size() && !failed; i++) {
+            size_t slot = i % slotCount;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                readyChanged.wait(lock, [&]() { return ready[slot] == i + 1 || failed; });
+                if (failed) break;
+            }
+
+            if (fwrite(buffers[slot].data(), 1, chunks[i].size, file) != chunks[i].size) failed = true;
+            position += chunks[i].size;
+
+            bool lastChunk = (i + 1 == chunks.size()) || chunks[i + 1].source != chunks[i].source;
+            if (lastChunk && !failed) {
+                uint64_t end = Align(position);
+                while (position < end && !failed) {
+                    size_t size = static_cast<size_t>((std::min)(end - position, uint64_t(padding.size())));
+                    if (fwrite(padding.data(), 1, size, file) != size) failed = true;
+                    position += size;
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            written = i + 1;
+            slotFreed.notify_all();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (written < chunks.size()) failed = true;
+            slotFreed.notify_all();
+        }
+        for (auto& thread : readers) thread.join();
+        return !failed;
+    }
+};
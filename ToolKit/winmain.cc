@@ -90,6 +90,14 @@ namespace Render
             // Render different layouts based on file type
             if (g_FileHandler->m_bFileLoaded)
                 g_FileHandler->Render();
+
+            // Embedded file opened during the frame replaces the handler now it is done rendering
+            if (g_PendingFileView.IsOpen())
+            {
+                FileView m_View = std::move(g_PendingFileView);
+                g_PendingFileView.Close();
+                g_FileHandler->ProcessFile(g_PendingFilePath, m_View);
+            }
         }
         else 
         {